@@ -0,0 +1,731 @@
+#include "BatchIO.h"
+#include "ComponentCache.h"
+#include "Hash.h"
+#include "Logging.h"
+#include "PageProgram.h"
+#include "Paths.h"
+#include "Render.h"
+#include "RenderStages.h"
+#include "Scanner.h"
+#include "VarsCollection.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <new>
+#include <optional>
+#include <span>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**************************************************************************************************
+    esd_bench:
+
+        Runs each render stage on its own over generated pages and reports how long it takes per
+        byte of input, how many allocations it makes and its throughput. Inputs are generated
+        over a range of sizes, directive densities (statements per KiB) and include depths.
+
+        File reads, writes and stats are measured with every I/O backend (see BatchIO.h) over a
+        directory of small generated pages, in batches the size the render pipeline uses.
+
+        Small pages declaring a variable of their own are rendered after loading Vars.txt files
+        of different sizes, as a build that parses Vars.txt does.
+
+        Whole pages are rendered in memory and streamed (see RenderPageStreaming in Render.h), to
+        compare the two. They're also rendered for several variants (see Variants.h), from their
+        source every time and from a program compiled the first time.
+
+        Before measuring, every scanner backend is checked against the Reference backend on
+        every generated input, and tokenizing and hashing each input a piece at a time (as
+        streamed pages are) is checked against doing it all at once. esd_bench exits with 1 if
+        any of them disagree.
+
+        Usage: esd_bench [--quick] [--filter text]
+
+            --quick         Fewer inputs and shorter runs, for a fast sanity check.
+            --filter text   Only run benchmarks whose name contains text.
+**************************************************************************************************/
+
+namespace {
+    std::atomic<size_t> s_Allocations = 0;
+}
+
+void* operator new(size_t size) {
+    s_Allocations.fetch_add(1, std::memory_order_relaxed);
+    if(void* memory = std::malloc(size == 0 ? 1 : size)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete[](void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+    std::free(memory);
+}
+
+void operator delete[](void* memory, size_t) noexcept {
+    std::free(memory);
+}
+
+namespace {
+    constexpr ScannerBackend k_AllBackends[] = {
+        ScannerBackend::Reference,
+        ScannerBackend::Portable,
+        ScannerBackend::SSE2,
+        ScannerBackend::AVX2
+    };
+
+    constexpr std::string_view k_AllIndicators[] = {
+        Indicators::k_Include,
+        Indicators::k_VarDeclaration,
+        Indicators::k_VarSubstitution
+    };
+
+    constexpr IoBackend k_AllIoBackends[] = {
+        IoBackend::Sync,
+        IoBackend::Threads,
+        IoBackend::Uring
+    };
+
+    // Pages handed to BatchIO at once, as RenderPages does.
+    constexpr size_t k_IoBatchSize = 16;
+
+    // Variables are named var_0 through var_(k_VarsCount-1) in the generated Vars.txt.
+    constexpr int k_VarsCount = 64;
+
+    // Variants each page is rendered for by the variant benchmarks (see Variants.h).
+    constexpr int k_VariantCount = 8;
+
+    // Pages rendered per run by the inline variable benchmarks.
+    constexpr int k_InlineVarsPages = 200;
+
+    // Filler text the directives are scattered through. Includes braces that aren't statements, like a page's CSS would.
+    constexpr std::string_view k_Filler[] = {
+        "<p>Lorem ipsum dolor sit amet, consectetur adipiscing elit.</p>\n",
+        "<div class=\"post\">sed do eiusmod tempor incididunt</div>\n",
+        "body { margin: 0; padding: 0; }\n",
+        "<a href=\"/index.html\">ut labore et dolore magna aliqua</a>\n",
+        "function f() { return {a: 1}; }\n",
+        "Ut enim ad minim veniam, quis nostrud exercitation.\n",
+    };
+
+    struct BenchOptions {
+        bool Quick = false;
+        std::string Filter;
+    };
+
+    struct BenchInput {
+        std::string Name;
+        std::string Text;
+    };
+
+    BenchOptions s_Options;
+    bool s_HeaderPrinted = false;
+
+    // Makes a page of roughly size bytes with density statements per KiB.
+    // Statements are mostly substitutions, with some declarations and includes of the component named includeName.
+    std::string GeneratePage(size_t size, int density, std::string_view includeName, unsigned seed) {
+        std::mt19937 rng(seed);
+        std::string page;
+        page.reserve(size + 256);
+
+        size_t const statements = size * density / 1024;
+        size_t const spacing = statements == 0 ? size : size / statements;
+        size_t nextStatement = spacing / 2;
+        int declarations = 0;
+
+        while(page.size() < size) {
+            if(statements != 0 && page.size() >= nextStatement) {
+                nextStatement += spacing;
+                unsigned const kind = rng() % 10;
+                if(kind < 6) {
+                    page += "{$var_" + std::to_string(rng() % k_VarsCount) + "}";
+                } else if(kind < 8) {
+                    page += "{variable:inline_" + std::to_string(declarations++) + "=inline value}";
+                } else if(!includeName.empty()) {
+                    page += "{include:" + std::string(includeName) + "}";
+                } else {
+                    page += "{$inline_" + std::to_string(declarations == 0 ? 0 : rng() % declarations) + "}";
+                }
+            }
+            page += k_Filler[rng() % std::size(k_Filler)];
+        }
+
+        return page;
+    }
+
+    std::string GenerateVars(int count) {
+        std::string vars = "# Generated by esd_bench\n\n";
+        for(int i = 0; i < count; ++i) {
+            vars += "var_" + std::to_string(i) + "=value number " + std::to_string(i) + "\n";
+            if(i % 8 == 0) {
+                vars += "# comment\n";
+            }
+        }
+        return vars;
+    }
+
+    void WriteFile(std::filesystem::path const& path, std::string_view text) {
+        if(path.has_parent_path()) {
+            std::filesystem::create_directories(path.parent_path());
+        }
+        std::ofstream file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+        file.write(text.data(), static_cast<std::streamsize>(text.size()));
+    }
+
+    // Writes a chain of components: chain_<depth>_0.html includes chain_<depth>_1.html and so on, depth components deep.
+    // Returns the name of the first component in the chain.
+    std::string WriteComponentChain(int depth) {
+        for(int i = 0; i < depth; ++i) {
+            std::string component = "<nav>{$var_" + std::to_string(i % k_VarsCount) + "}</nav>\n";
+            if(i + 1 < depth) {
+                component += "{include:chain_" + std::to_string(depth) + "_" + std::to_string(i + 1) + ".html}\n";
+            }
+            WriteFile(GetComponentPath() / ("chain_" + std::to_string(depth) + "_" + std::to_string(i) + ".html"), component);
+        }
+        return "chain_" + std::to_string(depth) + "_0.html";
+    }
+
+    bool ShouldRun(std::string const& name) {
+        return s_Options.Filter.empty() || name.find(s_Options.Filter) != std::string::npos;
+    }
+
+    // Runs work until enough time has passed to get a stable number, then reports the time per byte of input,
+    // allocations per run and throughput.
+    void Measure(std::string const& name, size_t bytes, std::function<void()> const& work) {
+        if(!ShouldRun(name)) {
+            return;
+        }
+
+        if(!s_HeaderPrinted) {
+            std::printf("%-48s %10s %10s %12s %12s\n", "benchmark", "bytes", "ns/byte", "allocs/run", "MB/s");
+            s_HeaderPrinted = true;
+        }
+
+        // Warm up, and count the allocations of one run.
+        size_t const allocationsBefore = s_Allocations.load(std::memory_order_relaxed);
+        work();
+        size_t const allocations = s_Allocations.load(std::memory_order_relaxed) - allocationsBefore;
+
+        auto const minimumTime = s_Options.Quick ? std::chrono::milliseconds(20) : std::chrono::milliseconds(250);
+        size_t runs = 0;
+        auto const start = std::chrono::steady_clock::now();
+        auto elapsed = std::chrono::steady_clock::duration::zero();
+        do {
+            work();
+            ++runs;
+            elapsed = std::chrono::steady_clock::now() - start;
+        } while(elapsed < minimumTime);
+
+        double const nanoseconds = std::chrono::duration<double, std::nano>(elapsed).count() / static_cast<double>(runs);
+        double const nsPerByte = bytes == 0 ? 0.0 : nanoseconds / static_cast<double>(bytes);
+        double const megabytesPerSecond = static_cast<double>(bytes) / (nanoseconds / 1e9) / (1024.0 * 1024.0);
+        std::printf("%-48s %10zu %10.3f %12zu %12.1f\n", name.c_str(), bytes, nsPerByte, allocations, megabytesPerSecond);
+        std::fflush(stdout);
+    }
+
+    // Checks every supported scanner backend against the Reference backend. Returns the number of mismatches.
+    int CheckBackends(BenchInput const& input) {
+        int mismatches = 0;
+
+        std::vector<Token> const referenceTokens = Tokenize(input.Text, ScannerBackend::Reference);
+        for(ScannerBackend backend : k_AllBackends) {
+            if(backend == ScannerBackend::Reference || !IsScannerBackendSupported(backend)) {
+                continue;
+            }
+
+            for(std::string_view indicator : k_AllIndicators) {
+                auto const expected = FindIndicatorsWithCaps(input.Text, indicator, Indicators::k_Cap, ScannerBackend::Reference);
+                auto const actual = FindIndicatorsWithCaps(input.Text, indicator, Indicators::k_Cap, backend);
+                bool same = expected.size() == actual.size();
+                for(size_t i = 0; same && i < expected.size(); ++i) {
+                    same = expected[i].ResultStart == actual[i].ResultStart
+                        && expected[i].ResultSize == actual[i].ResultSize
+                        && expected[i].ResultCenter == actual[i].ResultCenter;
+                }
+                if(!same) {
+                    std::printf("MISMATCH: %s scanning for \"%s\" in %s\n", GetScannerBackendName(backend), std::string(indicator).c_str(), input.Name.c_str());
+                    ++mismatches;
+                }
+            }
+
+            std::vector<Token> const tokens = Tokenize(input.Text, backend);
+            bool same = referenceTokens.size() == tokens.size();
+            for(size_t i = 0; same && i < tokens.size(); ++i) {
+                same = referenceTokens[i].TokenType == tokens[i].TokenType
+                    && referenceTokens[i].Text.data() == tokens[i].Text.data()
+                    && referenceTokens[i].Text.size() == tokens[i].Text.size()
+                    && referenceTokens[i].Center == tokens[i].Center;
+            }
+            if(!same) {
+                std::printf("MISMATCH: %s tokenizing %s\n", GetScannerBackendName(backend), input.Name.c_str());
+                ++mismatches;
+            }
+        }
+
+        return mismatches;
+    }
+
+    // Tokens with neighbouring literals joined, since where literals are split depends on how the text was read.
+    void AppendTokens(std::vector<Token> const& tokens, std::vector<std::pair<Token::Type, std::string>>& joined) {
+        for(Token const& token : tokens) {
+            if(token.TokenType == Token::Type::Literal && !joined.empty() && joined.back().first == Token::Type::Literal) {
+                joined.back().second.append(token.Text);
+            } else {
+                joined.emplace_back(token.TokenType, std::string(token.Text));
+            }
+        }
+    }
+
+    // Checks that tokenizing and hashing input a piece at a time gives the same result as all at once.
+    // Returns the number of mismatches.
+    int CheckStreaming(BenchInput const& input) {
+        int mismatches = 0;
+
+        std::vector<std::pair<Token::Type, std::string>> expected;
+        AppendTokens(Tokenize(input.Text), expected);
+        uint64_t const expectedHash = HashBytes(input.Text);
+
+        for(size_t pieceSize : { size_t(7), size_t(4096) }) {
+            StreamTokenizer tokenizer;
+            StreamHash hash;
+            std::vector<std::pair<Token::Type, std::string>> streamed;
+            std::vector<Token> tokens;
+            std::string buffer;
+            for(size_t offset = 0; offset < input.Text.size() || offset == 0; offset += pieceSize) {
+                std::string_view const piece = std::string_view(input.Text).substr(std::min(offset, input.Text.size()), pieceSize);
+                bool const last = offset + pieceSize >= input.Text.size();
+                hash.Update(piece);
+                buffer += piece;
+                tokens.clear();
+                size_t const tokenized = tokenizer.Tokenize(buffer, last, tokens);
+                AppendTokens(tokens, streamed);
+                buffer.erase(0, tokenized);
+            }
+
+            if(streamed != expected) {
+                std::printf("MISMATCH: tokenizing %s %zu bytes at a time\n", input.Name.c_str(), pieceSize);
+                ++mismatches;
+            }
+            if(hash.GetHash() != expectedHash) {
+                std::printf("MISMATCH: hashing %s %zu bytes at a time\n", input.Name.c_str(), pieceSize);
+                ++mismatches;
+            }
+        }
+
+        return mismatches;
+    }
+
+    void BenchScanner(BenchInput const& input) {
+        for(ScannerBackend backend : k_AllBackends) {
+            if(!IsScannerBackendSupported(backend)) {
+                continue;
+            }
+            std::string const backendName = GetScannerBackendName(backend);
+
+            Measure("scan/" + backendName + "/" + input.Name, input.Text.size(), [&]() {
+                for(std::string_view indicator : k_AllIndicators) {
+                    auto results = FindIndicatorsWithCaps(input.Text, indicator, Indicators::k_Cap, backend);
+                    if(results.size() == size_t(-1)) {
+                        std::abort();
+                    }
+                }
+            });
+
+            Measure("tokenize/" + backendName + "/" + input.Name, input.Text.size(), [&]() {
+                auto tokens = Tokenize(input.Text, backend);
+                if(tokens.size() == size_t(-1)) {
+                    std::abort();
+                }
+            });
+        }
+    }
+
+    void BenchRenderStages(BenchInput const& input, std::optional<VarsCollection> const& vars) {
+        std::vector<Token> tokens = Tokenize(input.Text);
+
+        Measure("resolve-symbols/" + input.Name, input.Text.size(), [&]() {
+            RenderStages::ResolveSymbols(tokens);
+        });
+
+        RenderStages::IncludeExpansion expanded;
+        RenderStages::ExpandIncludes(tokens, expanded);
+
+        Measure("expand-includes/" + input.Name, input.Text.size(), [&]() {
+            RenderStages::IncludeExpansion expansion;
+            RenderStages::ExpandIncludes(tokens, expansion);
+        });
+
+        int variablesDeclared = 0;
+        std::optional<VarsCollection> const inlineVariables = RenderStages::ParseInlineVariables(expanded.Tokens, variablesDeclared);
+
+        Measure("parse-inline-variables/" + input.Name, input.Text.size(), [&]() {
+            int declared = 0;
+            auto collection = RenderStages::ParseInlineVariables(expanded.Tokens, declared);
+        });
+
+        VarsScope const siteScope(vars.has_value() ? &vars.value() : nullptr);
+        VarsScope const pageScope(inlineVariables.has_value() ? &inlineVariables.value() : nullptr, &siteScope);
+
+        std::string page;
+        Measure("substitute-variables/" + input.Name, input.Text.size(), [&]() {
+            RenderStages::SubstituteVariables(expanded.Tokens, page, pageScope);
+        });
+    }
+
+    void BenchStreaming(BenchInput const& input, std::optional<VarsCollection> const& vars) {
+        if(!ShouldRun("render-page/" + input.Name) && !ShouldRun("render-page-streaming/" + input.Name)) {
+            return;
+        }
+
+        std::filesystem::path const sourcePath = GetSitePath() / (input.Name + ".html");
+        std::filesystem::path const outputPath = GetPublicPath() / (input.Name + ".html");
+        WriteFile(sourcePath, input.Text);
+
+        // Every run after the first renders to what's already in the output, which both ways compare against.
+        Logging::LogLevel const logLevel = Logging::g_LogLevel;
+        uint64_t const streamThreshold = g_StreamThreshold;
+        Logging::g_LogLevel = Logging::LogLevel::Quiet;
+        g_StreamThreshold = UINT64_MAX;
+
+        Measure("render-page/" + input.Name, input.Text.size(), [&]() {
+            RenderPage(sourcePath, vars);
+        });
+
+        Measure("render-page-streaming/" + input.Name, input.Text.size(), [&]() {
+            PageRenderResult result;
+            RenderPageStreaming(sourcePath, outputPath, vars, result);
+        });
+
+        g_StreamThreshold = streamThreshold;
+        Logging::g_LogLevel = logLevel;
+    }
+
+    // Renders a page for k_VariantCount variants, from its source every time and the way a variant build does: from
+    // its source once, compiling it, and from its program after that.
+    void BenchVariants(BenchInput const& input, std::optional<VarsCollection> const& vars) {
+        if(!ShouldRun("render-variants/" + input.Name) && !ShouldRun("render-variants-program/" + input.Name)) {
+            return;
+        }
+
+        Logging::LogLevel const logLevel = Logging::g_LogLevel;
+        Logging::g_LogLevel = Logging::LogLevel::Quiet;
+
+        Measure("render-variants/" + input.Name, input.Text.size() * k_VariantCount, [&]() {
+            for(int variant = 0; variant < k_VariantCount; ++variant) {
+                std::string output;
+                PageRenderResult result;
+                RenderPageOutput(input.Text, vars, output, result);
+            }
+        });
+
+        Measure("render-variants-program/" + input.Name, input.Text.size() * k_VariantCount, [&]() {
+            PageProgram program;
+            std::string output;
+            PageRenderResult result;
+            RenderPageOutput(input.Text, vars, output, result, &program);
+            for(int variant = 1; variant < k_VariantCount; ++variant) {
+                std::string variantOutput;
+                PageRenderResult variantResult;
+                if(result.UsesVars) {
+                    RenderPageProgram(program, vars, variantOutput, variantResult, false);
+                } else {
+                    variantOutput = output;
+                }
+            }
+        });
+
+        Logging::g_LogLevel = logLevel;
+    }
+
+    // Expands a chain of components from scratch, the way the first page of a run that includes it does.
+    void BenchComponentSnapshots(int depth) {
+        std::string const name = "depth" + std::to_string(depth);
+        if(!ShouldRun("expand-component/" + name) && !ShouldRun("expand-component-snapshot/" + name)) {
+            return;
+        }
+
+        std::string const component = WriteComponentChain(depth);
+        ComponentCache::Get().Clear();
+        size_t const bytes = ComponentCache::Get().FindExpanded(component)->Text.GetText().size();
+
+        Measure("expand-component/" + name, bytes, [&]() {
+            ComponentCache::Get().Clear();
+            ComponentCache::Get().FindExpanded(component);
+        });
+
+        // The first expansion writes the snapshot, every one after that maps it.
+        ComponentCache::Get().SetSnapshotDirectory("Snapshots", true);
+        ComponentCache::Get().Clear();
+        ComponentCache::Get().FindExpanded(component);
+        Measure("expand-component-snapshot/" + name, bytes, [&]() {
+            ComponentCache::Get().Clear();
+            ComponentCache::Get().FindExpanded(component);
+        });
+        ComponentCache::Get().SetSnapshotDirectory({}, false);
+        ComponentCache::Get().Clear();
+    }
+
+    // Runs requests through io a batch at a time.
+    template<typename Request, typename Func>
+    void RunBatches(std::vector<Request>& requests, Func const& func) {
+        for(size_t first = 0; first < requests.size(); first += k_IoBatchSize) {
+            func(std::span<Request>(requests).subspan(first, std::min(k_IoBatchSize, requests.size() - first)));
+        }
+    }
+
+    void BenchIo(size_t count, size_t size) {
+        std::string const inputName = std::to_string(count) + "x" + std::to_string(size / 1024) + "KiB";
+        bool wanted = false;
+        for(IoBackend backend : k_AllIoBackends) {
+            for(char const* operation : { "io-read/", "io-write/", "io-stat/" }) {
+                wanted = wanted || ShouldRun(operation + std::string(GetIoBackendName(backend)) + "/" + inputName);
+            }
+        }
+        if(!wanted) {
+            return;
+        }
+
+        std::filesystem::path const directory = "io_" + inputName;
+        std::string const page = GeneratePage(size, 4, {}, static_cast<unsigned>(count));
+
+        std::vector<std::filesystem::path> paths;
+        for(size_t i = 0; i < count; ++i) {
+            paths.push_back(directory / ("page_" + std::to_string(i) + ".html"));
+            WriteFile(paths.back(), page);
+        }
+        size_t const bytes = count * page.size();
+
+        for(IoBackend backend : k_AllIoBackends) {
+            if(!IsIoBackendSupported(backend)) {
+                continue;
+            }
+            std::string const backendName = GetIoBackendName(backend);
+            BatchIO io(backend);
+
+            Measure("io-read/" + backendName + "/" + inputName, bytes, [&]() {
+                std::vector<FileReadRequest> requests(paths.size());
+                for(size_t i = 0; i < paths.size(); ++i) {
+                    requests[i].Path = paths[i];
+                }
+                RunBatches(requests, [&io](std::span<FileReadRequest> batch) { io.Read(batch); });
+                if(!requests.back().Succeeded) {
+                    std::abort();
+                }
+            });
+
+            Measure("io-write/" + backendName + "/" + inputName, bytes, [&]() {
+                std::vector<FileWriteRequest> requests(paths.size());
+                for(size_t i = 0; i < paths.size(); ++i) {
+                    requests[i].Path = paths[i];
+                    requests[i].Data = page;
+                }
+                RunBatches(requests, [&io](std::span<FileWriteRequest> batch) { io.Write(batch); });
+                if(!requests.back().Succeeded) {
+                    std::abort();
+                }
+            });
+
+            Measure("io-stat/" + backendName + "/" + inputName, bytes, [&]() {
+                std::vector<FileStatRequest> requests(paths.size());
+                for(size_t i = 0; i < paths.size(); ++i) {
+                    requests[i].Path = paths[i];
+                }
+                RunBatches(requests, [&io](std::span<FileStatRequest> batch) { io.Stat(batch); });
+                if(!requests.back().IsRegularFile) {
+                    std::abort();
+                }
+            });
+        }
+    }
+
+    void BenchVars(int count) {
+        std::string const name = "load-vars/" + std::to_string(count) + "vars";
+        if(!ShouldRun(name)) {
+            return;
+        }
+
+        std::filesystem::path const path = "Vars_" + std::to_string(count) + ".txt";
+        WriteFile(path, GenerateVars(count));
+        size_t const bytes = static_cast<size_t>(std::filesystem::file_size(path));
+
+        Measure(name, bytes, [&]() {
+            auto collection = VarsCollection::TryLoadVarsCollection(path);
+        });
+
+        // The first load writes the snapshot, every load after that maps it.
+        std::filesystem::path const snapshotPath = "Vars_" + std::to_string(count) + ".esdvars";
+        VarsCollection::TryLoadVarsCollection(path, snapshotPath);
+        Measure("load-vars-snapshot/" + std::to_string(count) + "vars", bytes, [&]() {
+            auto collection = VarsCollection::TryLoadVarsCollection(path, snapshotPath);
+        });
+    }
+
+    // Renders small pages that each declare a variable of their own, with a Vars.txt of count variables loaded first the
+    // way a build parses it. What a page costs shouldn't depend on how big Vars.txt is.
+    void BenchInlineVars(int count) {
+        std::string const name = "render-inline-vars/" + std::to_string(count) + "vars";
+        if(!ShouldRun(name)) {
+            return;
+        }
+
+        std::filesystem::path const path = "Vars_" + std::to_string(count) + ".txt";
+        WriteFile(path, GenerateVars(count));
+        std::optional<VarsCollection> const vars = VarsCollection::TryLoadVarsCollection(path);
+        if(!vars.has_value()) {
+            std::abort();
+        }
+
+        // Named after count so it's interned after every name in Vars.txt.
+        std::string const title = "title_" + std::to_string(count);
+        std::string const text = "{variable:" + title + "=Inline}<h1>{$" + title + "}</h1>\n<p>{$var_0}</p>\n";
+        std::vector<Token> tokens = Tokenize(text);
+        RenderStages::ResolveSymbols(tokens);
+
+        VarsScope const siteScope(&vars.value());
+        std::string page;
+        Measure(name, text.size() * k_InlineVarsPages, [&]() {
+            for(int i = 0; i < k_InlineVarsPages; ++i) {
+                int declared = 0;
+                std::optional<VarsCollection> const inlineVariables = RenderStages::ParseInlineVariables(tokens, declared);
+                VarsScope const pageScope(inlineVariables.has_value() ? &inlineVariables.value() : nullptr, &siteScope);
+                RenderStages::SubstituteVariables(tokens, page, pageScope);
+            }
+        });
+        if(ShouldRun(name) && page != "<h1>Inline</h1>\n<p>value number 0</p>\n") {
+            std::abort();
+        }
+    }
+}
+
+int main(int argc, char const* argv[])
+{
+    for(int i = 1; i < argc; ++i) {
+        if(std::strcmp(argv[i], "--quick") == 0) {
+            s_Options.Quick = true;
+        } else if(std::strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            s_Options.Filter = argv[++i];
+        } else {
+            std::printf("Usage: esd_bench [--quick] [--filter text]\n");
+            return std::strcmp(argv[i], "-h") == 0 || std::strcmp(argv[i], "--help") == 0 ? 0 : 1;
+        }
+    }
+
+    // Components are found relative to the working directory, so the generated site lives in its own directory.
+    std::filesystem::path const originalDirectory = std::filesystem::current_path();
+    std::filesystem::path const benchDirectory = std::filesystem::temp_directory_path() / ("esd_bench_" + std::to_string(std::random_device()()));
+    std::filesystem::create_directories(benchDirectory);
+    std::filesystem::current_path(benchDirectory);
+
+    int mismatches = 0;
+    try
+    {
+        std::printf("Best scanner backend: %s\n\n", GetScannerBackendName(GetBestScannerBackend()));
+
+        WriteFile("Vars.txt", GenerateVars(k_VarsCount));
+        std::optional<VarsCollection> const vars = VarsCollection::TryLoadVarsCollection("Vars.txt");
+        std::string const leafComponent = WriteComponentChain(1);
+
+        std::vector<size_t> const sizes = s_Options.Quick
+            ? std::vector<size_t>{ 4 * 1024, 64 * 1024 }
+            : std::vector<size_t>{ 4 * 1024, 64 * 1024, 1024 * 1024 };
+        std::vector<int> const densities = { 0, 4, 32 };
+        std::vector<int> const includeDepths = s_Options.Quick
+            ? std::vector<int>{ 1, 8 }
+            : std::vector<int>{ 1, 4, 16, 30 };
+
+        std::vector<BenchInput> inputs;
+        for(size_t size : sizes) {
+            for(int density : densities) {
+                inputs.push_back({
+                    std::to_string(size / 1024) + "KiB/" + std::to_string(density) + "perKiB",
+                    GeneratePage(size, density, leafComponent, static_cast<unsigned>(size + density))
+                });
+            }
+        }
+
+        std::vector<BenchInput> includeInputs;
+        for(int depth : includeDepths) {
+            includeInputs.push_back({
+                "64KiB/4perKiB/depth" + std::to_string(depth),
+                GeneratePage(64 * 1024, 4, WriteComponentChain(depth), static_cast<unsigned>(depth))
+            });
+        }
+
+        for(BenchInput const& input : inputs) {
+            mismatches += CheckBackends(input);
+        }
+        if(mismatches == 0) {
+            std::printf("All scanner backends match the Reference backend.\n");
+        }
+        int streamingMismatches = 0;
+        for(BenchInput const& input : inputs) {
+            streamingMismatches += CheckStreaming(input);
+        }
+        if(streamingMismatches == 0) {
+            std::printf("Tokenizing and hashing a piece at a time matches doing it all at once.\n\n");
+        }
+        mismatches += streamingMismatches;
+
+        for(BenchInput const& input : inputs) {
+            BenchScanner(input);
+        }
+        for(BenchInput const& input : inputs) {
+            BenchRenderStages(input, vars);
+        }
+        for(BenchInput const& input : includeInputs) {
+            BenchRenderStages(input, vars);
+        }
+        for(BenchInput const& input : inputs) {
+            BenchStreaming(input, vars);
+        }
+        for(BenchInput const& input : includeInputs) {
+            BenchVariants(input, vars);
+        }
+        for(int depth : includeDepths) {
+            BenchComponentSnapshots(depth);
+        }
+        std::vector<int> const varsCounts = s_Options.Quick
+            ? std::vector<int>{ k_VarsCount, 4096 }
+            : std::vector<int>{ k_VarsCount, 4096, 200000 };
+        for(int count : varsCounts) {
+            BenchVars(count);
+        }
+        for(int count : varsCounts) {
+            BenchInlineVars(count);
+        }
+
+        BenchIo(s_Options.Quick ? 500 : 2000, 4 * 1024);
+    }
+    catch(std::exception& e)
+    {
+        std::printf("Error: %s\n", e.what());
+        mismatches = -1;
+    }
+
+    ComponentCache::Get().Clear();
+    std::filesystem::current_path(originalDirectory);
+    std::error_code error;
+    std::filesystem::remove_all(benchDirectory, error);
+
+    return mismatches == 0 ? 0 : 1;
+}
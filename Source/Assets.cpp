@@ -0,0 +1,104 @@
+#include "Assets.h"
+
+#include "FileIO.h"
+#include "Logging.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstring>
+#include <string>
+
+AssetOptions g_AssetOptions;
+
+namespace {
+    // Only warn once when the requested copy mode isn't available.
+    std::atomic<bool> s_FallbackWarned = false;
+
+    void WarnFallback(char const* mode, std::filesystem::path const& outputPath) {
+        if(!s_FallbackWarned.exchange(true)) {
+            Logging::LogWarning("Couldn't %s %s, assets will be copied instead where this fails.", mode, outputPath.string().c_str());
+        }
+    }
+}
+
+bool TryParseAssetCopyMode(char const* text, AssetCopyMode& mode) {
+    if(std::strcmp(text, "copy") == 0) {
+        mode = AssetCopyMode::Copy;
+    } else if(std::strcmp(text, "reflink") == 0) {
+        mode = AssetCopyMode::Reflink;
+    } else if(std::strcmp(text, "hardlink") == 0) {
+        mode = AssetCopyMode::Hardlink;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool IsAssetPath(std::filesystem::path const& path) {
+    // A total smattering of file types we know won't contain esd template information.
+    // If a file in public/site has one of these extensions it will be copied directly instead of looking for template information.
+    auto const knownBinaryExtensions = {
+        ".exe", ".zip", ".7z",
+        ".psd", ".xcf", ".ai",
+        ".svg", ".tiff", ".bmp", ".jpg", ".jpeg", ".gif", ".png", ".eps", ".raw",
+        ".woff", ".woff2", ".ttf", ".otf",
+        ".mp3", ".wav", ".m4a", ".flac", ".aac",
+        ".mp4", ".webm"
+    };
+
+    std::string extension = path.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return std::tolower(c); });
+
+    return std::find(knownBinaryExtensions.begin(), knownBinaryExtensions.end(), extension) != knownBinaryExtensions.end();
+}
+
+bool CopyAsset(std::filesystem::path const& sourcePath, std::filesystem::path const& outputPath) {
+    auto span = Profiler::Span("Copy Asset", "io");
+    span.SetPath(outputPath);
+
+    std::error_code error;
+    Profiler::CountSyscalls();
+    if(std::filesystem::exists(outputPath, error)) {
+        // Writing through a hard link to the source (left by hardlink mode) would overwrite the source.
+        Profiler::CountSyscalls(2);
+        if(std::filesystem::equivalent(sourcePath, outputPath, error)) {
+            if(g_AssetOptions.CopyMode == AssetCopyMode::Hardlink) {
+                return true;
+            }
+        }
+        Profiler::CountSyscalls();
+        std::filesystem::remove(outputPath, error);
+    }
+
+    switch(g_AssetOptions.CopyMode) {
+        case AssetCopyMode::Hardlink:
+            Profiler::CountSyscalls();
+            std::filesystem::create_hard_link(sourcePath, outputPath, error);
+            if(!error) {
+                return true;
+            }
+            WarnFallback("hard link", outputPath);
+            break;
+        case AssetCopyMode::Reflink:
+            if(CloneFile(sourcePath, outputPath)) {
+                return true;
+            }
+            WarnFallback("clone", outputPath);
+            break;
+        default:
+            break;
+    }
+
+    Profiler::CountSyscalls();
+    uintmax_t const size = std::filesystem::file_size(sourcePath, error);
+    if(!error) {
+        span.SetBytes(size);
+    }
+    if(!CopyFileContents(sourcePath, outputPath)) {
+        Logging::LogError("Could not copy asset to: %s", outputPath.string().c_str());
+        return false;
+    }
+    return true;
+}
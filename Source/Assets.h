@@ -0,0 +1,43 @@
+#pragma once
+
+#include <filesystem>
+
+/**************************************************************************************************
+Assets:
+    Files in Private/Site with a known binary extension (images, fonts, video...) don't contain
+    esd statements, so they're copied to Public as-is rather than rendered.
+
+    Copies are made by the kernel where possible. Instead of copying, assets can be cloned
+    (reflink, on file systems that support copy-on-write) or hard linked, both of which take no
+    time or extra space no matter how big the asset is. A hard linked asset is the same file as
+    its source, so editing it in Public edits the source too.
+
+    The build manifest records the size and modification time of both sides of every copy, so
+    assets are only copied again when either side changes. With content hashing an asset whose
+    stamp changed but whose contents didn't (ie: after a fresh checkout) isn't copied either.
+**************************************************************************************************/
+
+enum class AssetCopyMode {
+    Copy,
+    Reflink,
+    Hardlink
+};
+
+struct AssetOptions {
+    AssetCopyMode CopyMode = AssetCopyMode::Copy;
+    // Remember a hash of each asset's contents to avoid copies when only its stamp changed.
+    bool HashContents = false;
+};
+
+// Set from the command line.
+extern AssetOptions g_AssetOptions;
+
+// Parses "copy", "reflink" or "hardlink". Returns false for anything else.
+bool TryParseAssetCopyMode(char const* text, AssetCopyMode& mode);
+
+// True if path has one of the known binary extensions.
+bool IsAssetPath(std::filesystem::path const& path);
+
+// Copies an asset from sourcePath to outputPath using g_AssetOptions.CopyMode, falling back to a plain copy
+// if that mode isn't possible. Returns false (and logs why) if the asset couldn't be copied.
+bool CopyAsset(std::filesystem::path const& sourcePath, std::filesystem::path const& outputPath);
@@ -0,0 +1,578 @@
+#include "BatchIO.h"
+
+#include "Logging.h"
+#include "Profiler.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <latch>
+#include <mutex>
+#include <vector>
+
+#if defined(__linux__) || defined(__APPLE__)
+#define ESD_USE_POSIX_STAT 1
+#include <sys/stat.h>
+#endif
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define ESD_USE_URING 1
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+IoBackend g_IoBackend = IoBackend::Sync;
+
+namespace {
+    // Threads the Threads backend does its I/O on, shared by every BatchIO.
+    constexpr size_t k_IoPoolThreads = 8;
+
+    ThreadPool& GetIoPool() {
+        static ThreadPool s_Pool(k_IoPoolThreads);
+        return s_Pool;
+    }
+
+    void ReadSync(FileReadRequest& request) {
+        request.Succeeded = request.File.Open(request.Path);
+        if(request.Succeeded) {
+            request.File.Prefetch();
+        }
+    }
+
+    void WriteSync(FileWriteRequest& request) {
+        // Opening, writing and closing.
+        Profiler::CountSyscalls(3);
+        std::ofstream file(request.Path, std::ios::out | std::ios::binary | std::ios::trunc);
+        request.Succeeded = file.is_open() && file.write(request.Data.data(), static_cast<std::streamsize>(request.Data.size()));
+    }
+
+    void StatSync(FileStatRequest& request) {
+#if defined(ESD_USE_POSIX_STAT)
+        struct stat status {};
+        Profiler::CountSyscalls();
+        request.IsRegularFile = stat(request.Path.c_str(), &status) == 0 && S_ISREG(status.st_mode);
+#if defined(__APPLE__)
+        timespec const& modified = status.st_mtimespec;
+#else
+        timespec const& modified = status.st_mtim;
+#endif
+        request.Stamp = request.IsRegularFile ? FileStamp::FromStat(status.st_size, modified.tv_sec, modified.tv_nsec) : FileStamp();
+#else
+        std::error_code error;
+        request.IsRegularFile = std::filesystem::is_regular_file(request.Path, error);
+        request.Stamp = request.IsRegularFile ? FileStamp::Of(request.Path) : FileStamp();
+#endif
+    }
+
+    // Runs func on every request on the I/O pool and waits for all of them. The syscalls made on the pool are
+    // counted as the calling thread's.
+    template<typename Request, typename Func>
+    void RunOnIoPool(std::span<Request> requests, Func const& func) {
+        if(requests.size() <= 1) {
+            for(Request& request : requests) {
+                func(request);
+            }
+            return;
+        }
+
+        std::latch done(static_cast<std::ptrdiff_t>(requests.size()));
+        std::atomic<uint64_t> syscalls = 0;
+        for(Request& request : requests) {
+            GetIoPool().Submit([&request, &func, &done, &syscalls]() {
+                uint64_t const syscallsBefore = Profiler::GetSyscallCount();
+                // The request stays marked as failed if func throws (ie: out of memory).
+                try {
+                    func(request);
+                } catch(...) {
+                }
+                syscalls += Profiler::GetSyscallCount() - syscallsBefore;
+                done.count_down();
+            });
+        }
+        done.wait();
+        Profiler::CountSyscalls(syscalls);
+    }
+}
+
+char const* GetIoBackendName(IoBackend backend) {
+    switch(backend) {
+        case IoBackend::Sync:    return "sync";
+        case IoBackend::Threads: return "threads";
+        case IoBackend::Uring:   return "uring";
+    }
+    return "unknown";
+}
+
+bool TryParseIoBackend(char const* text, IoBackend& backend) {
+    for(IoBackend candidate : { IoBackend::Sync, IoBackend::Threads, IoBackend::Uring }) {
+        if(std::strcmp(text, GetIoBackendName(candidate)) == 0) {
+            backend = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+#if defined(ESD_USE_URING)
+
+/**************************************************************************************************
+    A single io_uring, driven with the raw syscalls so there's nothing to link against.
+
+    Requests are split into rounds that fit in the submission queue. Reading a file takes two
+    rounds: OPENAT and STATX for every file, then READ into a buffer of the size statx found,
+    hard linked to a CLOSE so the file is closed whether or not the read worked. Writing is the
+    same with WRITE, stats take a single round of STATX.
+**************************************************************************************************/
+struct BatchIO::Uring {
+    // Submission queue entries asked for, the kernel may round it up.
+    static constexpr unsigned k_Entries = 256;
+
+    // What a completion was for, in the low bits of its user data (the request index is above them).
+    enum Operation : uint64_t {
+        k_Open,
+        k_Stat,
+        k_Transfer,
+        k_Close
+    };
+    static constexpr unsigned k_OperationBits = 2;
+
+    // A file as it goes through the rounds.
+    struct OpenFile {
+        int Fd = -1;
+        int StatResult = -1;
+        struct statx Status {};
+        int64_t Transferred = -1;
+        std::unique_ptr<char[]> Buffer;
+    };
+
+    ~Uring() {
+        if(Sqes != MAP_FAILED) {
+            munmap(Sqes, SqesSize);
+        }
+        if(CqRing != MAP_FAILED) {
+            munmap(CqRing, CqRingSize);
+        }
+        if(SqRing != MAP_FAILED) {
+            munmap(SqRing, SqRingSize);
+        }
+        if(Fd >= 0) {
+            close(Fd);
+        }
+    }
+
+    // Returns false if this kernel can't run everything BatchIO asks of it.
+    bool Setup() {
+        io_uring_params params {};
+        Fd = static_cast<int>(syscall(__NR_io_uring_setup, k_Entries, &params));
+        if(Fd < 0) {
+            return false;
+        }
+
+        // Every operation used here came with Linux 5.6, as did probing for them.
+        std::vector<io_uring_probe_op> probeStorage(2 + 256);
+        io_uring_probe* const probe = reinterpret_cast<io_uring_probe*>(probeStorage.data());
+        if(syscall(__NR_io_uring_register, Fd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+            return false;
+        }
+        for(unsigned operation : { IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_CLOSE }) {
+            if(operation > probe->last_op || (probe->ops[operation].flags & IO_URING_OP_SUPPORTED) == 0) {
+                return false;
+            }
+        }
+
+        SqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        CqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        SqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        SqRing = mmap(nullptr, SqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Fd, IORING_OFF_SQ_RING);
+        CqRing = mmap(nullptr, CqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Fd, IORING_OFF_CQ_RING);
+        Sqes = mmap(nullptr, SqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Fd, IORING_OFF_SQES);
+        if(SqRing == MAP_FAILED || CqRing == MAP_FAILED || Sqes == MAP_FAILED) {
+            return false;
+        }
+
+        char* const sq = static_cast<char*>(SqRing);
+        SqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        SqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        SqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        SqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        SqEntries = params.sq_entries;
+        SqLocalTail = *SqTail;
+
+        char* const cq = static_cast<char*>(CqRing);
+        CqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        CqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        CqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        Cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    static uint64_t Encode(size_t index, Operation operation) {
+        return (static_cast<uint64_t>(index) << k_OperationBits) | operation;
+    }
+
+    // Fills in the next submission queue entry. At most SqEntries can be prepared before Run().
+    io_uring_sqe& Prepare(uint8_t opcode, int fd, size_t index, Operation operation) {
+        unsigned const slot = SqLocalTail & SqMask;
+        io_uring_sqe& entry = static_cast<io_uring_sqe*>(Sqes)[slot];
+        std::memset(&entry, 0, sizeof(entry));
+        entry.opcode = opcode;
+        entry.fd = fd;
+        entry.user_data = Encode(index, operation);
+        SqArray[slot] = slot;
+        ++SqLocalTail;
+        ++Prepared;
+        return entry;
+    }
+
+    // Submits everything prepared and calls onComplete(index, operation, result) for each entry as it completes.
+    // Returns false if the ring itself failed.
+    template<typename Func>
+    bool Run(Func const& onComplete) {
+        std::atomic_ref<unsigned>(*SqTail).store(SqLocalTail, std::memory_order_release);
+        unsigned toSubmit = Prepared;
+        unsigned pending = Prepared;
+        Prepared = 0;
+
+        while(pending > 0) {
+            Profiler::CountSyscalls();
+            long const submitted = syscall(__NR_io_uring_enter, Fd, toSubmit, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if(submitted < 0) {
+                if(errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+                    continue;
+                }
+                return false;
+            }
+            toSubmit -= std::min(toSubmit, static_cast<unsigned>(submitted));
+
+            std::atomic_ref<unsigned> head(*CqHead);
+            unsigned next = head.load(std::memory_order_relaxed);
+            unsigned const tail = std::atomic_ref<unsigned>(*CqTail).load(std::memory_order_acquire);
+            for(; next != tail; ++next) {
+                io_uring_cqe const& completion = Cqes[next & CqMask];
+                uint64_t const data = completion.user_data;
+                onComplete(static_cast<size_t>(data >> k_OperationBits), static_cast<Operation>(data & ((1u << k_OperationBits) - 1)), completion.res);
+                --pending;
+            }
+            head.store(next, std::memory_order_release);
+        }
+        return true;
+    }
+
+    // How many files fit in a round, each needs two entries.
+    size_t GetFilesPerRound() const {
+        return SqEntries / 2;
+    }
+
+    void PrepareOpen(std::filesystem::path const& path, size_t index, int flags, unsigned mode) {
+        io_uring_sqe& open = Prepare(IORING_OP_OPENAT, AT_FDCWD, index, k_Open);
+        open.addr = reinterpret_cast<uintptr_t>(path.c_str());
+        open.open_flags = static_cast<uint32_t>(flags);
+        open.len = mode;
+    }
+
+    void PrepareStat(std::filesystem::path const& path, struct statx& status, size_t index) {
+        io_uring_sqe& stat = Prepare(IORING_OP_STATX, AT_FDCWD, index, k_Stat);
+        stat.addr = reinterpret_cast<uintptr_t>(path.c_str());
+        stat.len = STATX_TYPE | STATX_SIZE | STATX_MTIME;
+        stat.off = reinterpret_cast<uintptr_t>(&status);
+    }
+
+    // Queues a transfer (if there's anything to transfer) followed by closing the file.
+    void PrepareTransferAndClose(uint8_t opcode, OpenFile const& file, void const* data, size_t size, size_t index) {
+        if(size > 0) {
+            io_uring_sqe& transfer = Prepare(opcode, file.Fd, index, k_Transfer);
+            transfer.addr = reinterpret_cast<uintptr_t>(data);
+            transfer.len = static_cast<uint32_t>(size);
+            transfer.off = 0;
+            // Hard linked so the file is closed even if the transfer fails.
+            transfer.flags = IOSQE_IO_HARDLINK;
+        }
+        Prepare(IORING_OP_CLOSE, file.Fd, index, k_Close);
+    }
+
+    static bool IsReadable(OpenFile const& file) {
+        return file.Fd >= 0 && file.StatResult == 0 && S_ISREG(file.Status.stx_mode) && file.Status.stx_size <= INT_MAX;
+    }
+
+    // Closes whatever a failed round left open.
+    static void CloseFiles(std::vector<OpenFile>& files) {
+        for(OpenFile& file : files) {
+            if(file.Fd >= 0) {
+                Profiler::CountSyscalls();
+                close(file.Fd);
+                file.Fd = -1;
+            }
+        }
+    }
+
+    void Read(std::span<FileReadRequest> requests) {
+        std::vector<OpenFile> files(requests.size());
+        auto const onComplete = [&files](size_t index, Operation operation, int result) {
+            OpenFile& file = files[index];
+            switch(operation) {
+                case k_Open:     file.Fd = result; break;
+                case k_Stat:     file.StatResult = result; break;
+                case k_Transfer: file.Transferred = result; break;
+                case k_Close:    file.Fd = -1; break;
+                default:         break;
+            }
+        };
+
+        for(size_t i = 0; i < requests.size(); ++i) {
+            PrepareOpen(requests[i].Path, i, O_RDONLY | O_CLOEXEC, 0);
+            PrepareStat(requests[i].Path, files[i].Status, i);
+        }
+        if(!Run(onComplete)) {
+            CloseFiles(files);
+            return;
+        }
+
+        for(size_t i = 0; i < requests.size(); ++i) {
+            OpenFile& file = files[i];
+            if(file.Fd < 0) {
+                continue;
+            }
+            bool const readable = IsReadable(file);
+            size_t const size = readable ? static_cast<size_t>(file.Status.stx_size) : 0;
+            if(size > 0) {
+                file.Buffer = std::unique_ptr<char[]>(new char[size]);
+            }
+            PrepareTransferAndClose(IORING_OP_READ, file, file.Buffer.get(), size, i);
+            if(readable && size == 0) {
+                // An empty file, nothing to read.
+                file.Transferred = 0;
+            }
+        }
+        if(!Run(onComplete)) {
+            CloseFiles(files);
+            return;
+        }
+
+        for(size_t i = 0; i < requests.size(); ++i) {
+            OpenFile& file = files[i];
+            if(file.Transferred >= 0) {
+                // A short read means the file shrank since it was stat'ed, like MappedFile::Open this keeps what was there.
+                requests[i].File.Adopt(std::move(file.Buffer), static_cast<size_t>(file.Transferred));
+                requests[i].Succeeded = true;
+            }
+        }
+    }
+
+    void Write(std::span<FileWriteRequest> requests) {
+        std::vector<OpenFile> files(requests.size());
+        auto const onComplete = [&files](size_t index, Operation operation, int result) {
+            OpenFile& file = files[index];
+            switch(operation) {
+                case k_Open:     file.Fd = result; break;
+                case k_Transfer: file.Transferred = result; break;
+                case k_Close:    file.Fd = -1; break;
+                default:         break;
+            }
+        };
+
+        for(size_t i = 0; i < requests.size(); ++i) {
+            PrepareOpen(requests[i].Path, i, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        }
+        if(!Run(onComplete)) {
+            CloseFiles(files);
+            return;
+        }
+
+        for(size_t i = 0; i < requests.size(); ++i) {
+            OpenFile& file = files[i];
+            if(file.Fd < 0) {
+                continue;
+            }
+            // Too big for a single write, it's written the Sync way once it's closed.
+            size_t const size = requests[i].Data.size() <= INT_MAX ? requests[i].Data.size() : 0;
+            PrepareTransferAndClose(IORING_OP_WRITE, file, requests[i].Data.data(), size, i);
+            if(size == 0) {
+                file.Transferred = 0;
+            }
+        }
+        if(!Run(onComplete)) {
+            CloseFiles(files);
+            return;
+        }
+
+        for(size_t i = 0; i < requests.size(); ++i) {
+            requests[i].Succeeded = files[i].Transferred >= 0 && static_cast<size_t>(files[i].Transferred) == requests[i].Data.size();
+        }
+    }
+
+    void Stat(std::span<FileStatRequest> requests) {
+        std::vector<OpenFile> files(requests.size());
+        for(size_t i = 0; i < requests.size(); ++i) {
+            PrepareStat(requests[i].Path, files[i].Status, i);
+        }
+        bool const ran = Run([&files](size_t index, Operation, int result) {
+            files[index].StatResult = result;
+        });
+
+        for(size_t i = 0; i < requests.size(); ++i) {
+            OpenFile const& file = files[i];
+            if(!ran || (file.StatResult < 0 && file.StatResult != -ENOENT && file.StatResult != -ENOTDIR)) {
+                // Anything but a missing file is tried again the Sync way.
+                StatSync(requests[i]);
+                continue;
+            }
+            requests[i].IsRegularFile = file.StatResult == 0 && S_ISREG(file.Status.stx_mode);
+            requests[i].Stamp = requests[i].IsRegularFile
+                ? FileStamp::FromStat(static_cast<int64_t>(file.Status.stx_size), file.Status.stx_mtime.tv_sec, file.Status.stx_mtime.tv_nsec)
+                : FileStamp();
+        }
+    }
+
+    int Fd = -1;
+    void* SqRing = MAP_FAILED;
+    size_t SqRingSize = 0;
+    void* CqRing = MAP_FAILED;
+    size_t CqRingSize = 0;
+    void* Sqes = MAP_FAILED;
+    size_t SqesSize = 0;
+
+    unsigned* SqHead = nullptr;
+    unsigned* SqTail = nullptr;
+    unsigned SqMask = 0;
+    unsigned* SqArray = nullptr;
+    unsigned SqEntries = 0;
+    // Entries are filled in past the shared tail, which only moves when they are submitted.
+    unsigned SqLocalTail = 0;
+    unsigned Prepared = 0;
+
+    unsigned* CqHead = nullptr;
+    unsigned* CqTail = nullptr;
+    unsigned CqMask = 0;
+    io_uring_cqe* Cqes = nullptr;
+};
+
+#else
+
+struct BatchIO::Uring {
+};
+
+#endif
+
+bool IsIoBackendSupported(IoBackend backend) {
+    if(backend != IoBackend::Uring) {
+        return true;
+    }
+#if defined(ESD_USE_URING)
+    static bool const s_Supported = []() {
+        BatchIO::Uring ring;
+        return ring.Setup();
+    }();
+    return s_Supported;
+#else
+    return false;
+#endif
+}
+
+BatchIO::BatchIO(IoBackend backend)
+: m_Backend(backend) {
+#if defined(ESD_USE_URING)
+    if(m_Backend == IoBackend::Uring) {
+        m_Uring = std::make_unique<Uring>();
+        if(!m_Uring->Setup()) {
+            m_Uring.reset();
+        }
+    }
+#endif
+    if(m_Backend == IoBackend::Uring && !m_Uring) {
+        static std::once_flag s_Warned;
+        std::call_once(s_Warned, []() {
+            Logging::LogWarning("io_uring isn't available on this system, using --io=threads instead.");
+        });
+        m_Backend = IoBackend::Threads;
+    }
+}
+
+BatchIO::~BatchIO() = default;
+
+IoBackend BatchIO::GetBackend() const {
+    return m_Backend;
+}
+
+void BatchIO::Read(std::span<FileReadRequest> requests) {
+    auto span = Profiler::Span("Read Files", "io");
+
+    if(m_Backend == IoBackend::Threads) {
+        RunOnIoPool(requests, &ReadSync);
+    } else {
+#if defined(ESD_USE_URING)
+        if(m_Uring) {
+            size_t const perRound = m_Uring->GetFilesPerRound();
+            for(size_t first = 0; first < requests.size(); first += perRound) {
+                m_Uring->Read(requests.subspan(first, std::min(perRound, requests.size() - first)));
+            }
+        }
+#endif
+        for(FileReadRequest& request : requests) {
+            if(!request.Succeeded) {
+                ReadSync(request);
+            }
+        }
+    }
+
+    uint64_t bytes = 0;
+    for(FileReadRequest const& request : requests) {
+        bytes += request.File.GetText().size();
+    }
+    span.SetBytes(bytes);
+}
+
+void BatchIO::Write(std::span<FileWriteRequest> requests) {
+    auto span = Profiler::Span("Write Files", "io");
+
+    if(m_Backend == IoBackend::Threads) {
+        RunOnIoPool(requests, &WriteSync);
+    } else {
+#if defined(ESD_USE_URING)
+        if(m_Uring) {
+            size_t const perRound = m_Uring->GetFilesPerRound();
+            for(size_t first = 0; first < requests.size(); first += perRound) {
+                m_Uring->Write(requests.subspan(first, std::min(perRound, requests.size() - first)));
+            }
+        }
+#endif
+        for(FileWriteRequest& request : requests) {
+            if(!request.Succeeded) {
+                WriteSync(request);
+            }
+        }
+    }
+
+    uint64_t bytes = 0;
+    for(FileWriteRequest const& request : requests) {
+        bytes += request.Data.size();
+    }
+    span.SetBytes(bytes);
+}
+
+void BatchIO::Stat(std::span<FileStatRequest> requests) {
+    auto span = Profiler::Span("Stat Files", "io");
+
+    if(m_Backend == IoBackend::Threads) {
+        RunOnIoPool(requests, &StatSync);
+        return;
+    }
+#if defined(ESD_USE_URING)
+    if(m_Uring) {
+        size_t const perRound = m_Uring->GetFilesPerRound() * 2;
+        for(size_t first = 0; first < requests.size(); first += perRound) {
+            m_Uring->Stat(requests.subspan(first, std::min(perRound, requests.size() - first)));
+        }
+        return;
+    }
+#endif
+    for(FileStatRequest& request : requests) {
+        StatSync(request);
+    }
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "BuildManifest.h"
+#include "FileIO.h"
+
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <string_view>
+
+/**************************************************************************************************
+Batch I/O:
+    Reads, writes and stats many files at once. The render pipeline (see RenderPages in Site.h)
+    hands a batch of pages to each call instead of going through the file system one file (and
+    one syscall) at a time.
+
+    I/O Backends:
+
+        Sync: Does every request in a row on the calling thread, one file at a time. Sizes and
+        modification times come from one stat() per file.
+
+        Threads: Spreads the requests of a batch over a pool of I/O threads and waits for all of
+        them. Works everywhere.
+
+        Uring: Linux only. Submits a whole batch through an io_uring (opening, statx, reading,
+        writing and closing every file) so the kernel works through it with a few syscalls per
+        batch instead of several per file. Needs Linux 5.6 or newer, when the ring can't be set
+        up (an older kernel, or io_uring disabled) Threads is used instead.
+
+    Requests that fail are marked as such, they are never thrown. Requests the Uring backend
+    couldn't finish are retried the Sync way, so the reason a request failed is always the same.
+**************************************************************************************************/
+enum class IoBackend {
+    Sync,
+    Threads,
+    Uring
+};
+
+char const* GetIoBackendName(IoBackend backend);
+
+// Parses "sync", "threads" or "uring". Returns false if text is none of them.
+bool TryParseIoBackend(char const* text, IoBackend& backend);
+
+// Returns false if backend can't run on this system.
+bool IsIoBackendSupported(IoBackend backend);
+
+// Chosen with --io=, Sync by default.
+extern IoBackend g_IoBackend;
+
+struct FileReadRequest {
+    std::filesystem::path Path;
+    // The file's entire contents when Succeeded.
+    MappedFile File;
+    bool Succeeded = false;
+};
+
+struct FileWriteRequest {
+    std::filesystem::path Path;
+    // Replaces whatever was in the file. Must stay valid until Write() returns.
+    std::string_view Data;
+    bool Succeeded = false;
+};
+
+struct FileStatRequest {
+    std::filesystem::path Path;
+    // Set for regular files (and symbolic links to them) only, everything else gets a stamp of a file that doesn't exist.
+    FileStamp Stamp;
+    bool IsRegularFile = false;
+};
+
+// Does batches of requests with one backend. Each thread doing I/O needs its own BatchIO, a single one
+// isn't safe to use from multiple threads at once.
+class BatchIO
+{
+public:
+    // Falls back to Threads (with a warning) if backend isn't supported.
+    explicit BatchIO(IoBackend backend = g_IoBackend);
+    ~BatchIO();
+
+    BatchIO(BatchIO const&)            = delete;
+    BatchIO& operator=(BatchIO const&) = delete;
+
+    IoBackend GetBackend() const;
+
+    // Reads each file in full. Returns once every request is done.
+    void Read(std::span<FileReadRequest> requests);
+    // Creates or replaces each file. The directories must exist already.
+    void Write(std::span<FileWriteRequest> requests);
+    void Stat(std::span<FileStatRequest> requests);
+
+private:
+    friend bool IsIoBackendSupported(IoBackend backend);
+    struct Uring;
+
+    IoBackend m_Backend;
+    std::unique_ptr<Uring> m_Uring;
+};
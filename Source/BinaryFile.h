@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+/**************************************************************************************************
+Binary File:
+    Helpers for the files esd keeps under .esd between runs (see ComponentSnapshot.h and
+    PageProgram.h). Values are written in native byte order, each file's header records it.
+**************************************************************************************************/
+namespace BinaryFile {
+    template<typename T>
+    void Append(std::string& data, T const& value) {
+        data.append(reinterpret_cast<char const*>(&value), sizeof(T));
+    }
+
+    // The size (uint64) followed by the characters.
+    inline void AppendString(std::string& data, std::string_view text) {
+        Append(data, static_cast<uint64_t>(text.size()));
+        data.append(text);
+    }
+
+    // Reads a file front to back, failing (instead of reading past the end) once anything doesn't fit.
+    class Reader
+    {
+    public:
+        explicit Reader(std::string_view data)
+        : m_Data(data) {
+        }
+
+        template<typename T>
+        bool Read(T& value) {
+            if(m_Data.size() - m_Offset < sizeof(T)) {
+                return false;
+            }
+            std::memcpy(&value, m_Data.data() + m_Offset, sizeof(T));
+            m_Offset += sizeof(T);
+            return true;
+        }
+
+        bool ReadString(std::string& text) {
+            uint64_t size = 0;
+            if(!Read(size) || m_Data.size() - m_Offset < size) {
+                return false;
+            }
+            text.assign(m_Data.data() + m_Offset, static_cast<size_t>(size));
+            m_Offset += static_cast<size_t>(size);
+            return true;
+        }
+
+        // Everything that wasn't read yet.
+        std::string_view GetRemainder() const {
+            return m_Data.substr(m_Offset);
+        }
+
+    private:
+        std::string_view m_Data;
+        size_t m_Offset = 0;
+    };
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+/**************************************************************************************************
+Bounded Queue:
+    Hands items from one stage of a pipeline to the next. Push() blocks while the queue is full,
+    so a stage that runs ahead of the next one waits instead of piling up work in memory.
+
+    Close() once nothing more will be pushed: Pop() drains what's left and then returns nothing.
+    Abort() is for when the pipeline fails, every Push() and Pop() returns right away (and any
+    items still queued are dropped).
+**************************************************************************************************/
+template<typename T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(size_t capacity)
+    : m_Capacity(capacity == 0 ? 1 : capacity) {
+    }
+
+    BoundedQueue(BoundedQueue const&)            = delete;
+    BoundedQueue& operator=(BoundedQueue const&) = delete;
+
+    // Returns false (dropping item) if the queue was aborted or closed.
+    bool Push(T item) {
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            m_NotFull.wait(lock, [this]() { return m_Items.size() < m_Capacity || m_Closed || m_Aborted; });
+            if(m_Closed || m_Aborted) {
+                return false;
+            }
+            m_Items.push_back(std::move(item));
+        }
+        m_NotEmpty.notify_one();
+        return true;
+    }
+
+    // Returns nothing once the queue is closed and empty, or aborted.
+    std::optional<T> Pop() {
+        std::optional<T> item;
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            m_NotEmpty.wait(lock, [this]() { return !m_Items.empty() || m_Closed || m_Aborted; });
+            if(m_Aborted || m_Items.empty()) {
+                return item;
+            }
+            item.emplace(std::move(m_Items.front()));
+            m_Items.pop_front();
+        }
+        m_NotFull.notify_one();
+        return item;
+    }
+
+    // Waits for at least one item like Pop(), then takes up to maxItems without waiting for more.
+    // Returns nothing once the queue is closed and empty, or aborted.
+    std::vector<T> PopSome(size_t maxItems) {
+        std::vector<T> items;
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            m_NotEmpty.wait(lock, [this]() { return !m_Items.empty() || m_Closed || m_Aborted; });
+            if(m_Aborted) {
+                return items;
+            }
+            while(!m_Items.empty() && items.size() < maxItems) {
+                items.push_back(std::move(m_Items.front()));
+                m_Items.pop_front();
+            }
+        }
+        m_NotFull.notify_all();
+        return items;
+    }
+
+    void Close() {
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_Closed = true;
+        }
+        m_NotEmpty.notify_all();
+        m_NotFull.notify_all();
+    }
+
+    void Abort() {
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_Aborted = true;
+            m_Items.clear();
+        }
+        m_NotEmpty.notify_all();
+        m_NotFull.notify_all();
+    }
+
+private:
+    size_t const m_Capacity;
+
+    std::mutex m_Mutex;
+    std::condition_variable m_NotEmpty;
+    std::condition_variable m_NotFull;
+    std::deque<T> m_Items;
+    bool m_Closed = false;
+    bool m_Aborted = false;
+};
@@ -0,0 +1,345 @@
+#include "BuildManifest.h"
+
+#include "Hash.h"
+#include "Logging.h"
+#include "Profiler.h"
+
+#include <fstream>
+#include <sstream>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <sys/stat.h>
+#endif
+
+namespace {
+    constexpr char const* k_ManifestHeader = "esd-manifest 3";
+
+    // Reads "<time> <size>" following the kind of a manifest line.
+    bool ParseStamp(std::istringstream& line, FileStamp& stamp) {
+        return static_cast<bool>(line >> stamp.Time >> stamp.Size);
+    }
+
+    // Reads the path at the end of a manifest line. Paths are last so they may contain spaces.
+    std::string ReadRemainder(std::istringstream& line) {
+        std::string remainder;
+        line.get(); // the separating space
+        std::getline(line, remainder);
+        return remainder;
+    }
+}
+
+//static
+FileStamp FileStamp::Of(std::filesystem::path const& path) {
+#if defined(__linux__) || defined(__APPLE__)
+    struct stat status {};
+    Profiler::CountSyscalls();
+    if(stat(path.c_str(), &status) != 0 || !S_ISREG(status.st_mode)) {
+        return FileStamp();
+    }
+#if defined(__APPLE__)
+    return FromStat(status.st_size, status.st_mtimespec.tv_sec, status.st_mtimespec.tv_nsec);
+#else
+    return FromStat(status.st_size, status.st_mtim.tv_sec, status.st_mtim.tv_nsec);
+#endif
+#else
+    std::error_code error;
+    FileStamp stamp;
+    uintmax_t const size = std::filesystem::file_size(path, error);
+    if(error) {
+        return stamp;
+    }
+    auto const time = std::filesystem::last_write_time(path, error);
+    if(error) {
+        return stamp;
+    }
+    stamp.Size = static_cast<int64_t>(size);
+    stamp.Time = static_cast<int64_t>(time.time_since_epoch().count());
+    return stamp;
+#endif
+}
+
+//static
+FileStamp FileStamp::FromStat(int64_t size, int64_t seconds, int64_t nanoseconds) {
+    FileStamp stamp;
+    stamp.Time = seconds * 1'000'000'000 + nanoseconds;
+    stamp.Size = size;
+    return stamp;
+}
+
+void BuildManifest::Load(std::filesystem::path const& path) {
+    auto span = Profiler::Span("Load Manifest", "io");
+    span.SetPath(path);
+
+    m_Pages.clear();
+
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    if(!file.is_open()) {
+        return;
+    }
+
+    std::string text;
+    if(!std::getline(file, text) || text != k_ManifestHeader) {
+        Logging::LogWarning("Ignoring %s, it isn't a manifest this version of esd understands.", path.string().c_str());
+        return;
+    }
+
+    PageEntry* currentPage = nullptr;
+    while(std::getline(file, text)) {
+        std::istringstream line(text);
+        std::string kind;
+        line >> kind;
+
+        FileStamp stamp;
+        if(!ParseStamp(line, stamp)) {
+            Logging::LogWarning("Ignoring %s, it's malformed. Every page will be rendered.", path.string().c_str());
+            m_Pages.clear();
+            return;
+        }
+
+        if(kind == "vars") {
+            m_VarsStamp = stamp;
+        }
+        else if(kind == "page") {
+            int usesVars = 0;
+            FileStamp output;
+            uint64_t outputHash = 0;
+            if(!(line >> usesVars) || !ParseStamp(line, output) || !(line >> outputHash)) {
+                Logging::LogWarning("Ignoring %s, it's malformed. Every page will be rendered.", path.string().c_str());
+                m_Pages.clear();
+                return;
+            }
+            currentPage = &m_Pages[ReadRemainder(line)];
+            currentPage->Source = stamp;
+            currentPage->UsesVars = usesVars != 0;
+            currentPage->Output = output;
+            currentPage->ContentHash = outputHash;
+        }
+        else if(kind == "asset") {
+            FileStamp output;
+            uint64_t contentHash = 0;
+            if(!ParseStamp(line, output) || !(line >> contentHash)) {
+                Logging::LogWarning("Ignoring %s, it's malformed. Every page will be rendered.", path.string().c_str());
+                m_Pages.clear();
+                return;
+            }
+            currentPage = nullptr;
+            PageEntry& asset = m_Pages[ReadRemainder(line)];
+            asset.Source = stamp;
+            asset.IsAsset = true;
+            asset.Output = output;
+            asset.ContentHash = contentHash;
+        }
+        else if(kind == "dep" && currentPage != nullptr) {
+            currentPage->Components.push_back({ReadRemainder(line), stamp});
+        }
+    }
+}
+
+void BuildManifest::Save(std::filesystem::path const& path) const {
+    auto span = Profiler::Span("Save Manifest", "io");
+    span.SetPath(path);
+
+    std::error_code error;
+    std::filesystem::create_directories(path.parent_path(), error);
+
+    std::ofstream file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if(!file.is_open()) {
+        Logging::LogWarning("Couldn't write %s. The next run will render every page.", path.string().c_str());
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    file << k_ManifestHeader << '\n';
+    file << "vars " << m_VarsStamp.Time << ' ' << m_VarsStamp.Size << '\n';
+    for(auto const& [page, entry] : m_Pages) {
+        if(entry.IsAsset) {
+            file << "asset " << entry.Source.Time << ' ' << entry.Source.Size << ' ' << entry.Output.Time << ' ' << entry.Output.Size << ' ' << entry.ContentHash << ' ' << page << '\n';
+            continue;
+        }
+        file << "page " << entry.Source.Time << ' ' << entry.Source.Size << ' ' << (entry.UsesVars ? 1 : 0) << ' ' << entry.Output.Time << ' ' << entry.Output.Size << ' ' << entry.ContentHash << ' ' << page << '\n';
+        for(Dependency const& dependency : entry.Components) {
+            file << "dep " << dependency.Stamp.Time << ' ' << dependency.Stamp.Size << ' ' << dependency.Path << '\n';
+        }
+    }
+}
+
+void BuildManifest::BeginRun(FileStamp const& varsStamp) {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_PreviousPages = std::move(m_Pages);
+    m_Pages.clear();
+    m_PreviousVarsStamp = m_VarsStamp;
+    m_VarsStamp = varsStamp;
+    m_ComponentStamps.clear();
+}
+
+void BuildManifest::RefreshStamps(FileStamp const& varsStamp) {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_VarsStamp = varsStamp;
+    m_ComponentStamps.clear();
+}
+
+std::vector<std::filesystem::path> BuildManifest::GetAffectedPages(std::set<std::string> const& changedComponents, bool varsChanged) const {
+    std::vector<std::filesystem::path> pages;
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    for(auto const& [page, entry] : m_Pages) {
+        bool affected = varsChanged && entry.UsesVars;
+        for(size_t i = 0; !affected && i < entry.Components.size(); ++i) {
+            affected = changedComponents.count(entry.Components[i].Path) != 0;
+        }
+        if(affected) {
+            pages.push_back(page);
+        }
+    }
+    return pages;
+}
+
+void BuildManifest::ForeachDependency(std::function<void(std::string const& page, std::string const& component)> const& func) const {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    for(auto const& [page, entry] : m_Pages) {
+        for(Dependency const& dependency : entry.Components) {
+            func(page, dependency.Path);
+        }
+    }
+}
+
+bool BuildManifest::CheckPageUpToDate(std::filesystem::path const& sitePathRelative, std::filesystem::path const& sourcePath, std::filesystem::path const& outputPath) {
+    if(m_PreviousPages.count(sitePathRelative.generic_string()) == 0) {
+        // Not worth stat'ing anything.
+        return false;
+    }
+    return CheckPageUpToDate(sitePathRelative, FileStamp::Of(sourcePath), FileStamp::Of(outputPath));
+}
+
+bool BuildManifest::CheckPageUpToDate(std::filesystem::path const& sitePathRelative, FileStamp const& sourceStamp, FileStamp const& outputStamp) {
+    std::string const key = sitePathRelative.generic_string();
+    auto const found = m_PreviousPages.find(key);
+    if(found == m_PreviousPages.end()) {
+        return false;
+    }
+
+    PageEntry const& entry = found->second;
+    if(entry.UsesVars && m_PreviousVarsStamp != m_VarsStamp) {
+        return false;
+    }
+    if(sourceStamp != entry.Source || outputStamp.Size < 0) {
+        return false;
+    }
+    for(Dependency const& dependency : entry.Components) {
+        if(GetComponentStamp(dependency.Path) != dependency.Stamp) {
+            return false;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_Pages[key] = entry;
+    return true;
+}
+
+std::optional<uint64_t> BuildManifest::GetOutputHash(std::filesystem::path const& sitePathRelative, std::filesystem::path const& outputPath) const {
+    return GetOutputHash(sitePathRelative, FileStamp::Of(outputPath));
+}
+
+std::optional<uint64_t> BuildManifest::GetOutputHash(std::filesystem::path const& sitePathRelative, FileStamp const& outputStamp) const {
+    std::string const key = sitePathRelative.generic_string();
+
+    FileStamp output;
+    uint64_t outputHash = 0;
+    {
+        // In watch mode the page may have been rendered again since the run began.
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        auto found = m_Pages.find(key);
+        if(found == m_Pages.end()) {
+            found = m_PreviousPages.find(key);
+            if(found == m_PreviousPages.end()) {
+                return {};
+            }
+        }
+        if(found->second.IsAsset) {
+            return {};
+        }
+        output = found->second.Output;
+        outputHash = found->second.ContentHash;
+    }
+
+    if(output.Size < 0 || outputStamp != output) {
+        return {};
+    }
+    return outputHash;
+}
+
+void BuildManifest::RecordPage(std::filesystem::path const& sitePathRelative, std::filesystem::path const& sourcePath, std::filesystem::path const& outputPath, std::set<std::filesystem::path> const& components, bool usesVars, uint64_t outputHash) {
+    RecordPage(sitePathRelative, FileStamp::Of(sourcePath), FileStamp::Of(outputPath), components, usesVars, outputHash);
+}
+
+void BuildManifest::RecordPage(std::filesystem::path const& sitePathRelative, FileStamp const& sourceStamp, FileStamp const& outputStamp, std::set<std::filesystem::path> const& components, bool usesVars, uint64_t outputHash) {
+    PageEntry entry;
+    entry.Source = sourceStamp;
+    entry.UsesVars = usesVars;
+    entry.Output = outputStamp;
+    entry.ContentHash = outputHash;
+    entry.Components.reserve(components.size());
+    for(std::filesystem::path const& component : components) {
+        std::string path = component.generic_string();
+        FileStamp const stamp = GetComponentStamp(path);
+        entry.Components.push_back({std::move(path), stamp});
+    }
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_Pages[sitePathRelative.generic_string()] = std::move(entry);
+}
+
+bool BuildManifest::CheckAssetUpToDate(std::filesystem::path const& sitePathRelative, std::filesystem::path const& sourcePath, std::filesystem::path const& outputPath, bool hashContents) {
+    std::string const key = sitePathRelative.generic_string();
+    auto const found = m_PreviousPages.find(key);
+    if(found == m_PreviousPages.end() || !found->second.IsAsset) {
+        return false;
+    }
+
+    PageEntry entry = found->second;
+    if(FileStamp::Of(outputPath) != entry.Output) {
+        return false;
+    }
+    FileStamp const source = FileStamp::Of(sourcePath);
+    if(source != entry.Source) {
+        if(!hashContents || entry.ContentHash == 0 || source.Size != entry.Source.Size) {
+            return false;
+        }
+        std::optional<uint64_t> const contentHash = HashFile(sourcePath);
+        if(!contentHash.has_value() || contentHash.value() != entry.ContentHash) {
+            return false;
+        }
+        // Same contents under a new stamp, remember the new stamp so it isn't hashed again next time.
+        entry.Source = source;
+    }
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_Pages[key] = entry;
+    return true;
+}
+
+void BuildManifest::RecordAsset(std::filesystem::path const& sitePathRelative, std::filesystem::path const& sourcePath, std::filesystem::path const& outputPath, uint64_t contentHash) {
+    PageEntry entry;
+    entry.Source = FileStamp::Of(sourcePath);
+    entry.IsAsset = true;
+    entry.Output = FileStamp::Of(outputPath);
+    entry.ContentHash = contentHash;
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_Pages[sitePathRelative.generic_string()] = std::move(entry);
+}
+
+FileStamp BuildManifest::GetComponentStamp(std::string const& path) {
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        auto const found = m_ComponentStamps.find(path);
+        if(found != m_ComponentStamps.end()) {
+            return found->second;
+        }
+    }
+
+    FileStamp const stamp = FileStamp::Of(path);
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_ComponentStamps.emplace(path, stamp);
+    return stamp;
+}
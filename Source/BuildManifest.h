@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**************************************************************************************************
+Build Manifest:
+    Remembers what every page depended on the last time it was rendered so unchanged pages can
+    be skipped on the next run.
+
+    For each page the manifest stores the size and modification time of the source file, of
+    every component it included (directly or through other components, including components that
+    didn't exist) and whether any of its variable substitutions read from Vars.txt. A page is up
+    to date when none of those have changed and its output still exists.
+
+    The stamp and a hash of the page's output are stored as well, so a page that renders to the
+    same bytes as before isn't written again (see GetOutputHash).
+
+    Assets are copied rather than rendered, for them the stamps of the source and of the copy
+    are stored, along with a hash of the contents when --hash-assets is used.
+
+    The manifest is a plain text file in the cache directory (see GetManifestPath):
+
+        esd-manifest 3
+        vars <time> <size>
+        page <time> <size> <uses vars: 0|1> <output time> <output size> <output hash> <path relative to Private/Site>
+        dep <time> <size> <path of a component>
+        asset <time> <size> <output time> <output size> <content hash or 0> <path relative to Private/Site>
+
+    Each "dep" line belongs to the "page" line above it. A size of -1 means the file didn't exist.
+**************************************************************************************************/
+
+// The size and modification time of a file, used to tell if it changed between runs.
+struct FileStamp {
+    // Nanoseconds since the Unix epoch where there's stat(), the count of a std::filesystem::file_time_type elsewhere.
+    int64_t Time = 0;
+    // -1 when the file doesn't exist.
+    int64_t Size = -1;
+
+    static FileStamp Of(std::filesystem::path const& path);
+    // The stamp Of() makes, from a size and modification time (since the Unix epoch) found by stat() or statx().
+    static FileStamp FromStat(int64_t size, int64_t seconds, int64_t nanoseconds);
+
+    bool operator==(FileStamp const& other) const { return Time == other.Time && Size == other.Size; }
+    bool operator!=(FileStamp const& other) const { return !(*this == other); }
+};
+
+class BuildManifest
+{
+public:
+    // Reads the manifest left by the previous run. A missing or unreadable manifest means every page will be rendered.
+    // Component paths are compared by their generic (forward slash) form.
+    void Load(std::filesystem::path const& path);
+
+    // Writes every page recorded (or carried over) during this run. Pages that weren't seen this run are dropped.
+    void Save(std::filesystem::path const& path) const;
+
+    // Starts a run: what was loaded (or recorded by the last run) becomes what pages are checked against.
+    // varsStamp is the current Vars.txt stamp. Must be called before any pages are checked.
+    void BeginRun(FileStamp const& varsStamp);
+
+    // For long running sessions (watch mode): forgets the component stamps cached this run and updates the
+    // Vars.txt stamp, without forgetting any pages.
+    void RefreshStamps(FileStamp const& varsStamp);
+
+    // Pages (relative to Private/Site) recorded this run that included any of the components, or that read
+    // Vars.txt if varsChanged is set.
+    std::vector<std::filesystem::path> GetAffectedPages(std::set<std::string> const& changedComponents, bool varsChanged) const;
+
+    // Calls func(page, component) for every component a page recorded (or carried over) this run included.
+    void ForeachDependency(std::function<void(std::string const& page, std::string const& component)> const& func) const;
+
+    // Returns true if the page (relative to Private/Site) doesn't need to be rendered again.
+    // When it returns true the page's entry is carried over into this run's manifest.
+    // Safe to call from multiple threads.
+    bool CheckPageUpToDate(std::filesystem::path const& sitePathRelative, std::filesystem::path const& sourcePath, std::filesystem::path const& outputPath);
+    // As above with the source's and output's stamps already known (see BatchIO::Stat).
+    bool CheckPageUpToDate(std::filesystem::path const& sitePathRelative, FileStamp const& sourceStamp, FileStamp const& outputStamp);
+
+    // Returns the hash of the page's output as of the last time it was rendered, if the output file hasn't changed since.
+    // Safe to call from multiple threads.
+    std::optional<uint64_t> GetOutputHash(std::filesystem::path const& sitePathRelative, std::filesystem::path const& outputPath) const;
+    std::optional<uint64_t> GetOutputHash(std::filesystem::path const& sitePathRelative, FileStamp const& outputStamp) const;
+
+    // Records what a freshly rendered page depends on and the hash of what's in its output now.
+    // Safe to call from multiple threads.
+    void RecordPage(std::filesystem::path const& sitePathRelative, std::filesystem::path const& sourcePath, std::filesystem::path const& outputPath, std::set<std::filesystem::path> const& components, bool usesVars, uint64_t outputHash);
+    void RecordPage(std::filesystem::path const& sitePathRelative, FileStamp const& sourceStamp, FileStamp const& outputStamp, std::set<std::filesystem::path> const& components, bool usesVars, uint64_t outputHash);
+
+    // Returns true if the asset (relative to Private/Site) and its copy in Public haven't changed since it was last copied.
+    // With hashContents an asset whose stamp changed is hashed, and still up to date if its contents are the same.
+    // When it returns true the asset's entry is carried over into this run's manifest.
+    // Safe to call from multiple threads.
+    bool CheckAssetUpToDate(std::filesystem::path const& sitePathRelative, std::filesystem::path const& sourcePath, std::filesystem::path const& outputPath, bool hashContents);
+
+    // Records a freshly copied asset. contentHash is 0 when contents aren't hashed. Safe to call from multiple threads.
+    void RecordAsset(std::filesystem::path const& sitePathRelative, std::filesystem::path const& sourcePath, std::filesystem::path const& outputPath, uint64_t contentHash);
+
+    // Returns the stamp of a component (by its generic path). Components are shared by many pages, so each is only
+    // stat'ed once per run. Safe to call from multiple threads.
+    FileStamp GetComponentStamp(std::string const& path);
+
+private:
+    struct Dependency {
+        std::string Path;
+        FileStamp Stamp;
+    };
+
+    struct PageEntry {
+        FileStamp Source;
+        bool UsesVars = false;
+        std::vector<Dependency> Components;
+        bool IsAsset = false;
+        FileStamp Output;
+        // The output's hash for pages, the source's (if hashed) for assets.
+        uint64_t ContentHash = 0;
+    };
+
+    FileStamp m_PreviousVarsStamp;
+    FileStamp m_VarsStamp;
+    std::unordered_map<std::string, PageEntry> m_PreviousPages;
+
+    mutable std::mutex m_Mutex;
+    std::unordered_map<std::string, PageEntry> m_Pages;
+    std::unordered_map<std::string, FileStamp> m_ComponentStamps;
+};
@@ -0,0 +1,204 @@
+#include "BuildReport.h"
+
+#include "BuildManifest.h"
+#include "Json.h"
+#include "Logging.h"
+#include "Render.h"
+#include "Symbols.h"
+#include "VarsCollection.h"
+
+#include <algorithm>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace BuildReport {
+    namespace {
+        // How many pages and components are listed as the slowest and most included.
+        constexpr size_t k_TopCount = 10;
+
+        struct PageEntry {
+            std::string Path;
+            Outcome PageOutcome;
+            double Milliseconds;
+            PageRenderMetrics Metrics;
+        };
+
+        bool s_Enabled = false;
+        std::filesystem::path s_OutputPath;
+
+        std::mutex s_Mutex;
+        std::vector<PageEntry> s_Pages;
+        std::unordered_set<SymbolId> s_UsedSymbols;
+
+        char const* GetOutcomeName(Outcome outcome) {
+            switch(outcome) {
+                case Outcome::Written:      return "written";
+                case Outcome::Unchanged:    return "unchanged";
+                case Outcome::Skipped:      return "skipped";
+                case Outcome::Failed:       return "failed";
+                case Outcome::AssetCopied:  return "asset-copied";
+                case Outcome::AssetSkipped: return "asset-skipped";
+                default:                    return "unknown";
+            }
+        }
+
+        void WritePage(std::ostream& os, PageEntry const& page) {
+            os << "{\"path\":";
+            Json::WriteString(os, page.Path);
+            os << ",\"outcome\":\"" << GetOutcomeName(page.PageOutcome) << '"'
+                << ",\"milliseconds\":" << page.Milliseconds
+                << ",\"bytesIn\":" << page.Metrics.BytesIn
+                << ",\"bytesOut\":" << page.Metrics.BytesOut
+                << ",\"includes\":" << page.Metrics.IncludesProcessed
+                << ",\"inlineVariables\":" << page.Metrics.VariablesDeclared
+                << ",\"substitutions\":" << page.Metrics.VariablesSubstituted
+                << ",\"failedSubstitutions\":" << page.Metrics.FailedSubstitutions
+                << '}';
+        }
+    }
+
+    void Start(std::filesystem::path const& outputPath) {
+        s_OutputPath = outputPath;
+        s_Enabled = true;
+    }
+
+    bool IsEnabled() {
+        return s_Enabled;
+    }
+
+    void RecordPage(std::filesystem::path const& page, Outcome outcome, double milliseconds, PageRenderMetrics const& metrics) {
+        if(!s_Enabled) {
+            return;
+        }
+
+        PageEntry entry { page.generic_string(), outcome, milliseconds, {} };
+        entry.Metrics.BytesIn = metrics.BytesIn;
+        entry.Metrics.BytesOut = metrics.BytesOut;
+        entry.Metrics.IncludesProcessed = metrics.IncludesProcessed;
+        entry.Metrics.VariablesDeclared = metrics.VariablesDeclared;
+        entry.Metrics.VariablesSubstituted = metrics.VariablesSubstituted;
+        entry.Metrics.FailedSubstitutions = metrics.FailedSubstitutions;
+
+        std::lock_guard<std::mutex> lock(s_Mutex);
+        s_Pages.push_back(std::move(entry));
+        s_UsedSymbols.insert(metrics.OuterSymbols.begin(), metrics.OuterSymbols.end());
+    }
+
+    void Save(BuildManifest const& manifest, std::optional<VarsCollection> const& vars, bool wholeSite) {
+        if(!s_Enabled) {
+            return;
+        }
+
+        std::vector<PageEntry> pages;
+        std::unordered_set<SymbolId> usedSymbols;
+        {
+            std::lock_guard<std::mutex> lock(s_Mutex);
+            pages.swap(s_Pages);
+            usedSymbols.swap(s_UsedSymbols);
+        }
+        std::sort(pages.begin(), pages.end(), [](PageEntry const& a, PageEntry const& b) { return a.Path < b.Path; });
+
+        std::ofstream file(s_OutputPath, std::ios::out | std::ios::binary | std::ios::trunc);
+        if(!file.is_open()) {
+            Logging::LogError("Could not open the build report for writing: %s", s_OutputPath.string().c_str());
+            return;
+        }
+
+        // Totals
+        PageRenderMetrics totals;
+        std::unordered_map<Outcome, int> outcomeCounts;
+        double totalMilliseconds = 0.0;
+        for(PageEntry const& page : pages) {
+            totals.BytesIn += page.Metrics.BytesIn;
+            totals.BytesOut += page.Metrics.BytesOut;
+            totals.IncludesProcessed += page.Metrics.IncludesProcessed;
+            totals.VariablesDeclared += page.Metrics.VariablesDeclared;
+            totals.VariablesSubstituted += page.Metrics.VariablesSubstituted;
+            totals.FailedSubstitutions += page.Metrics.FailedSubstitutions;
+            totalMilliseconds += page.Milliseconds;
+            ++outcomeCounts[page.PageOutcome];
+        }
+
+        file << "{\"version\":1,\n\"totals\":{\"pages\":" << pages.size();
+        for(Outcome outcome : { Outcome::Written, Outcome::Unchanged, Outcome::Skipped, Outcome::Failed, Outcome::AssetCopied, Outcome::AssetSkipped }) {
+            file << ",\"" << GetOutcomeName(outcome) << "\":" << outcomeCounts[outcome];
+        }
+        file << ",\"milliseconds\":" << totalMilliseconds
+            << ",\"bytesIn\":" << totals.BytesIn
+            << ",\"bytesOut\":" << totals.BytesOut
+            << ",\"includes\":" << totals.IncludesProcessed
+            << ",\"inlineVariables\":" << totals.VariablesDeclared
+            << ",\"substitutions\":" << totals.VariablesSubstituted
+            << ",\"failedSubstitutions\":" << totals.FailedSubstitutions
+            << "},\n";
+
+        // Every page
+        file << "\"pages\":[";
+        for(size_t i = 0; i < pages.size(); ++i) {
+            file << (i == 0 ? "\n" : ",\n");
+            WritePage(file, pages[i]);
+        }
+        file << "\n],\n";
+
+        // Slowest pages
+        std::vector<PageEntry const*> slowest;
+        slowest.reserve(pages.size());
+        for(PageEntry const& page : pages) {
+            slowest.push_back(&page);
+        }
+        size_t const slowestCount = std::min(k_TopCount, slowest.size());
+        std::partial_sort(slowest.begin(), slowest.begin() + slowestCount, slowest.end(), [](PageEntry const* a, PageEntry const* b) {
+            return a->Milliseconds > b->Milliseconds;
+        });
+        file << "\"slowestPages\":[";
+        for(size_t i = 0; i < slowestCount; ++i) {
+            file << (i == 0 ? "\n" : ",\n") << "{\"path\":";
+            Json::WriteString(file, slowest[i]->Path);
+            file << ",\"milliseconds\":" << slowest[i]->Milliseconds << '}';
+        }
+        file << "\n],\n";
+
+        // Components included by the most pages. Pages that were skipped still count, the manifest knows what they include.
+        std::unordered_map<std::string, int> componentPages;
+        manifest.ForeachDependency([&componentPages](std::string const&, std::string const& component) {
+            ++componentPages[component];
+        });
+        std::vector<std::pair<std::string, int>> components(componentPages.begin(), componentPages.end());
+        size_t const componentCount = std::min(k_TopCount, components.size());
+        std::partial_sort(components.begin(), components.begin() + componentCount, components.end(), [](auto const& a, auto const& b) {
+            return a.second != b.second ? a.second > b.second : a.first < b.first;
+        });
+        file << "\"mostIncludedComponents\":[";
+        for(size_t i = 0; i < componentCount; ++i) {
+            file << (i == 0 ? "\n" : ",\n") << "{\"path\":";
+            Json::WriteString(file, components[i].first);
+            file << ",\"pages\":" << components[i].second << '}';
+        }
+        file << "\n],\n";
+
+        // Vars.txt entries no rendered page read.
+        bool const unusedVarsComplete = wholeSite && outcomeCounts[Outcome::Skipped] == 0;
+        file << "\"unusedVarsComplete\":" << (unusedVarsComplete ? "true" : "false") << ",\n\"unusedVars\":[";
+        if(vars.has_value()) {
+            bool first = true;
+            vars.value().ForeachKey([&](std::string_view name) {
+                std::optional<SymbolId> const symbol = SymbolTable::Get().Find(name);
+                if(symbol.has_value() && usedSymbols.count(symbol.value()) != 0) {
+                    return;
+                }
+                file << (first ? "\n" : ",\n");
+                first = false;
+                Json::WriteString(file, name);
+            });
+        }
+        file << "\n]}\n";
+
+        if(!file) {
+            Logging::LogError("Could not write the build report: %s", s_OutputPath.string().c_str());
+        }
+    }
+}
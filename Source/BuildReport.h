@@ -0,0 +1,51 @@
+#pragma once
+
+#include <filesystem>
+#include <optional>
+
+class BuildManifest;
+class VarsCollection;
+struct PageRenderMetrics;
+
+/**************************************************************************************************
+Build Report:
+    A machine readable summary of a build (--report build.json), for dashboards and scripts.
+
+    For every page it lists what happened to it (written, unchanged, skipped, copied...), the
+    bytes read and written, includes expanded, inline variables declared, substitutions made and
+    failed, and how long it took. It also has totals, the slowest pages, the components included
+    by the most pages and the Vars.txt entries no page used.
+
+    Which Vars.txt entries pages use is only known for pages rendered in the build, so unused
+    variables are only listed as complete ("unusedVarsComplete": true) when every page was.
+
+    Pages are kept in memory until Save(). With --watch the report is rewritten after every
+    rebuild and covers only what that rebuild did.
+**************************************************************************************************/
+namespace BuildReport {
+
+    // Turns the report on. Save() will write it to outputPath.
+    void Start(std::filesystem::path const& outputPath);
+
+    bool IsEnabled();
+
+    enum class Outcome {
+        // Rendered and written to Public.
+        Written,
+        // Rendered to exactly what was already in Public, so it wasn't written.
+        Unchanged,
+        // Up to date according to the build manifest, not rendered.
+        Skipped,
+        // Couldn't be rendered or copied, the reason was logged.
+        Failed,
+        AssetCopied,
+        AssetSkipped
+    };
+
+    // Records what happened to page (relative to Private/Site). Safe to call from multiple threads.
+    void RecordPage(std::filesystem::path const& page, Outcome outcome, double milliseconds, PageRenderMetrics const& metrics);
+
+    // Writes everything recorded since the last call to the path given to Start() and starts over.
+    // wholeSite is false when only some of the site's pages were built (ie: a watch mode rebuild).
+    void Save(BuildManifest const& manifest, std::optional<VarsCollection> const& vars, bool wholeSite);
+}
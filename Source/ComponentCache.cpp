@@ -0,0 +1,372 @@
+#include "ComponentCache.h"
+
+#include "ComponentSnapshot.h"
+#include "Paths.h"
+#include "Profiler.h"
+#include "RenderStages.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <unordered_set>
+
+std::filesystem::path GetNormalizedComponentPath(std::string_view includeName) {
+    return (GetComponentPath() / includeName).lexically_normal();
+}
+
+namespace {
+    // The components a component's include statements name, in order.
+    std::vector<std::filesystem::path> GetIncludedPaths(Component const& component) {
+        std::vector<std::filesystem::path> paths;
+        for(Token const& token : component.Tokens) {
+            if(token.TokenType == Token::Type::Include) {
+                paths.push_back(GetNormalizedComponentPath(token.Center));
+            }
+        }
+        return paths;
+    }
+
+    // "a.html -> b.html -> a.html", relative to Private/Components.
+    std::string DescribeCycle(std::vector<std::filesystem::path> const& cycle) {
+        std::string description;
+        for(std::filesystem::path const& path : cycle) {
+            if(!description.empty()) {
+                description += " -> ";
+            }
+            description += path.lexically_relative(GetComponentPath().lexically_normal()).generic_string();
+        }
+        return description;
+    }
+
+    // Copies the text of tokens into a buffer owned by expanded, in order, and points expanded's tokens at it.
+    // Neighbouring literals become one token.
+    void CopyTokens(std::vector<Token> const& tokens, ExpandedComponent& expanded) {
+        size_t size = 0;
+        for(Token const& token : tokens) {
+            size += token.Text.size();
+        }
+
+        std::unique_ptr<char[]> buffer(new char[size]);
+        size_t offset = 0;
+        expanded.Tokens.reserve(tokens.size());
+        for(Token const& token : tokens) {
+            if(token.Text.empty() && token.TokenType == Token::Type::Literal) {
+                continue;
+            }
+            std::memcpy(buffer.get() + offset, token.Text.data(), token.Text.size());
+            std::string_view const text(buffer.get() + offset, token.Text.size());
+            offset += text.size();
+
+            if(token.TokenType == Token::Type::Literal && !expanded.Tokens.empty() && expanded.Tokens.back().TokenType == Token::Type::Literal) {
+                Token& previous = expanded.Tokens.back();
+                previous.Text = std::string_view(previous.Text.data(), previous.Text.size() + text.size());
+                continue;
+            }
+
+            Token copy = token;
+            copy.Text = text;
+            copy.Center = token.Center.empty() ? std::string_view() : text.substr(token.Center.data() - token.Text.data(), token.Center.size());
+            expanded.Tokens.push_back(copy);
+        }
+        expanded.Text.Adopt(std::move(buffer), size);
+    }
+
+    // Finds the strongly connected components of the include graph with Tarjan's algorithm. Every component in one
+    // with more than one member (or that includes itself) is in a cycle.
+    class CycleSearch
+    {
+    public:
+        using IncludesFunction = std::function<std::vector<std::filesystem::path>(std::filesystem::path const&)>;
+
+        // cycles holds what earlier searches found, those components aren't visited again.
+        CycleSearch(IncludesFunction getIncludes, std::unordered_map<std::string, std::vector<std::filesystem::path>>& cycles)
+        : m_GetIncludes(std::move(getIncludes))
+        , m_Cycles(cycles) {
+        }
+
+        // Adds every component reachable from path to cycles, with the cycle that leads back to it (empty if none).
+        void Run(std::filesystem::path const& path) {
+            std::string const key = path.generic_string();
+            if(m_Cycles.count(key) == 0 && m_Nodes.count(key) == 0) {
+                Visit(key, path);
+            }
+        }
+
+    private:
+        struct Node {
+            std::filesystem::path Path;
+            // Keys of the components this one includes.
+            std::vector<std::string> Includes;
+            int Index = 0;
+            int LowLink = 0;
+            bool OnStack = false;
+        };
+
+        void Visit(std::string const& key, std::filesystem::path const& path) {
+            // Nodes never move once added, so this stays valid while visiting what the component includes.
+            Node& node = m_Nodes[key];
+            node.Path = path;
+            node.Index = node.LowLink = m_NextIndex++;
+            node.OnStack = true;
+            m_Stack.push_back(key);
+
+            for(std::filesystem::path const& included : m_GetIncludes(path)) {
+                std::string includedKey = included.generic_string();
+                node.Includes.push_back(includedKey);
+                if(m_Cycles.count(includedKey) != 0) {
+                    // Finished, in an earlier search or an earlier part of this one.
+                    continue;
+                }
+                auto found = m_Nodes.find(includedKey);
+                if(found == m_Nodes.end()) {
+                    Visit(includedKey, included);
+                    node.LowLink = std::min(node.LowLink, m_Nodes[includedKey].LowLink);
+                } else if(found->second.OnStack) {
+                    node.LowLink = std::min(node.LowLink, found->second.Index);
+                }
+            }
+
+            if(node.LowLink != node.Index) {
+                return;
+            }
+
+            std::unordered_set<std::string> members;
+            std::string member;
+            do {
+                member = m_Stack.back();
+                m_Stack.pop_back();
+                m_Nodes[member].OnStack = false;
+                members.insert(member);
+            } while(member != key);
+
+            bool const circular = members.size() > 1 || std::find(node.Includes.begin(), node.Includes.end(), key) != node.Includes.end();
+            for(std::string const& cycleMember : members) {
+                m_Cycles[cycleMember] = circular ? FindCycle(cycleMember, members) : std::vector<std::filesystem::path>();
+            }
+        }
+
+        // The shortest path of includes from start back to itself, inside its strongly connected component.
+        std::vector<std::filesystem::path> FindCycle(std::string const& start, std::unordered_set<std::string> const& members) {
+            std::unordered_map<std::string, std::string> reachedFrom;
+            std::queue<std::string> queue;
+            queue.push(start);
+            while(!queue.empty()) {
+                std::string const current = queue.front();
+                queue.pop();
+                for(std::string const& included : m_Nodes[current].Includes) {
+                    if(members.count(included) == 0 || reachedFrom.count(included) != 0) {
+                        continue;
+                    }
+                    reachedFrom[included] = current;
+                    if(included == start) {
+                        std::vector<std::filesystem::path> cycle = { m_Nodes[start].Path };
+                        for(std::string step = current; step != start; step = reachedFrom[step]) {
+                            cycle.push_back(m_Nodes[step].Path);
+                        }
+                        cycle.push_back(m_Nodes[start].Path);
+                        std::reverse(cycle.begin(), cycle.end());
+                        return cycle;
+                    }
+                    queue.push(included);
+                }
+            }
+            return {};
+        }
+
+        IncludesFunction m_GetIncludes;
+        std::unordered_map<std::string, std::vector<std::filesystem::path>>& m_Cycles;
+        std::unordered_map<std::string, Node> m_Nodes;
+        std::vector<std::string> m_Stack;
+        int m_NextIndex = 0;
+    };
+}
+
+//static
+ComponentCache& ComponentCache::Get() {
+    static ComponentCache s_Cache;
+    return s_Cache;
+}
+
+std::shared_ptr<Component const> ComponentCache::Find(std::string_view includeName) {
+    return FindPath(GetNormalizedComponentPath(includeName));
+}
+
+std::shared_ptr<ExpandedComponent const> ComponentCache::FindExpanded(std::string_view includeName) {
+    std::string name(includeName);
+    {
+        std::shared_lock<std::shared_mutex> lock(m_Mutex);
+        auto found = m_ExpandedByName.find(name);
+        if(found != m_ExpandedByName.end()) {
+            return found->second;
+        }
+    }
+
+    std::lock_guard<std::mutex> expandLock(m_ExpandMutex);
+    std::shared_ptr<ExpandedComponent const> expanded = Expand(GetNormalizedComponentPath(includeName));
+
+    std::unique_lock<std::shared_mutex> lock(m_Mutex);
+    m_ExpandedByName.try_emplace(std::move(name), expanded);
+    return expanded;
+}
+
+std::shared_ptr<Component const> ComponentCache::FindPath(std::filesystem::path const& path) {
+    std::string const key = path.generic_string();
+
+    {
+        std::shared_lock<std::shared_mutex> lock(m_Mutex);
+        auto found = m_Components.find(key);
+        if(found != m_Components.end()) {
+            return found->second;
+        }
+    }
+
+    // Load without holding the lock so other pages aren't blocked on disk. If two threads race
+    // to load the same component the first one to finish wins and both use its copy.
+    std::shared_ptr<Component const> component = Load(path);
+
+    std::unique_lock<std::shared_mutex> lock(m_Mutex);
+    return m_Components.try_emplace(key, std::move(component)).first->second;
+}
+
+void ComponentCache::Invalidate(std::filesystem::path const& componentPath) {
+    std::lock_guard<std::mutex> expandLock(m_ExpandMutex);
+    std::unique_lock<std::shared_mutex> lock(m_Mutex);
+    m_Components.erase(componentPath.lexically_normal().generic_string());
+    m_ExpandedByName.clear();
+    m_Expanded.clear();
+    m_Cycles.clear();
+    m_Stamps.clear();
+}
+
+void ComponentCache::Clear() {
+    std::lock_guard<std::mutex> expandLock(m_ExpandMutex);
+    std::unique_lock<std::shared_mutex> lock(m_Mutex);
+    m_Components.clear();
+    m_ExpandedByName.clear();
+    m_Expanded.clear();
+    m_Cycles.clear();
+    m_Stamps.clear();
+}
+
+void ComponentCache::SetSnapshotDirectory(std::filesystem::path const& directory, bool useExisting) {
+    std::lock_guard<std::mutex> expandLock(m_ExpandMutex);
+    m_SnapshotDirectory = directory;
+    m_UseExistingSnapshots = useExisting;
+}
+
+std::shared_ptr<ExpandedComponent const> ComponentCache::Expand(std::filesystem::path const& path) {
+    std::string const key = path.generic_string();
+    auto found = m_Expanded.find(key);
+    if(found != m_Expanded.end()) {
+        return found->second;
+    }
+
+    auto const getStamp = [this](std::filesystem::path const& component) { return GetStamp(component); };
+    std::filesystem::path snapshotPath;
+    if(!m_SnapshotDirectory.empty()) {
+        snapshotPath = ComponentSnapshot::GetPath(m_SnapshotDirectory, path);
+        if(m_UseExistingSnapshots) {
+            // Nothing it was built from changed, so it still isn't in a cycle either.
+            if(std::shared_ptr<ExpandedComponent const> snapshot = ComponentSnapshot::TryOpen(snapshotPath, path, getStamp)) {
+                m_Expanded.emplace(key, snapshot);
+                return snapshot;
+            }
+        }
+    }
+
+    auto expanded = std::make_shared<ExpandedComponent>();
+    expanded->Path = path;
+    std::shared_ptr<Component const> const root = FindPath(path);
+    expanded->Exists = root != nullptr;
+    if(root) {
+        if(m_Cycles.count(key) == 0) {
+            FindCycles(path);
+        }
+        std::vector<std::filesystem::path> const& cycle = m_Cycles[key];
+        if(!cycle.empty()) {
+            expanded->Cycle = DescribeCycle(cycle);
+            // The rest of the cycle. Whoever includes this records it already.
+            expanded->Dependencies.assign(cycle.begin() + 1, cycle.end() - 1);
+        }
+    }
+
+    // Nothing below can lead back here: this component isn't in a cycle, so neither is anything expanded from it.
+    if(root && expanded->Cycle.empty()) {
+        // Point into the component and the expansions of what it includes until they're copied together.
+        std::vector<Token> tokens;
+        for(Token const& token : root->Tokens) {
+            if(token.TokenType != Token::Type::Include) {
+                tokens.push_back(token);
+                continue;
+            }
+
+            ++expanded->IncludesProcessed;
+            std::shared_ptr<ExpandedComponent const> const included = Expand(GetNormalizedComponentPath(token.Center));
+            expanded->Dependencies.push_back(included->Path);
+            expanded->Dependencies.insert(expanded->Dependencies.end(), included->Dependencies.begin(), included->Dependencies.end());
+            if(!included->Exists) {
+                expanded->Errors.push_back("Include file not found: " + (GetComponentPath() / token.Center).string());
+                continue;
+            }
+            if(!included->Cycle.empty()) {
+                expanded->Errors.push_back("Circular include: " + included->Cycle);
+                tokens.push_back({Token::Type::Literal, token.Text, {}});
+                continue;
+            }
+            expanded->IncludesProcessed += included->IncludesProcessed;
+            expanded->Errors.insert(expanded->Errors.end(), included->Errors.begin(), included->Errors.end());
+            tokens.insert(tokens.end(), included->Tokens.begin(), included->Tokens.end());
+        }
+        CopyTokens(tokens, *expanded);
+
+        if(!snapshotPath.empty()) {
+            ComponentSnapshot::Write(snapshotPath, *expanded, getStamp);
+        }
+    }
+
+    m_Expanded.emplace(key, expanded);
+    return expanded;
+}
+
+void ComponentCache::FindCycles(std::filesystem::path const& path) {
+    CycleSearch search([this](std::filesystem::path const& component) {
+        std::shared_ptr<Component const> const loaded = FindPath(component);
+        return loaded ? GetIncludedPaths(*loaded) : std::vector<std::filesystem::path>();
+    }, m_Cycles);
+    search.Run(path);
+}
+
+FileStamp ComponentCache::GetStamp(std::filesystem::path const& path) {
+    std::string const key = path.generic_string();
+    auto found = m_Stamps.find(key);
+    if(found == m_Stamps.end()) {
+        found = m_Stamps.emplace(key, FileStamp::Of(path)).first;
+    }
+    return found->second;
+}
+
+//static
+std::shared_ptr<Component const> ComponentCache::Load(std::filesystem::path const& path) {
+    auto span = Profiler::Span("Load Component", "component");
+    span.SetPath(path);
+
+    std::error_code error;
+    Profiler::CountSyscalls();
+    if(!std::filesystem::is_regular_file(path, error)) {
+        return nullptr;
+    }
+
+    auto component = std::make_shared<Component>();
+    component->Path = path;
+    if(!component->Source.Open(path)) {
+        return nullptr;
+    }
+
+    component->Tokens = Tokenize(component->Source.GetText());
+    RenderStages::ResolveSymbols(component->Tokens);
+    span.SetBytes(component->Source.GetText().size());
+
+    return component;
+}
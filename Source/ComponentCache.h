@@ -0,0 +1,128 @@
+#pragma once
+
+#include "BuildManifest.h"
+#include "FileIO.h"
+#include "Scanner.h"
+
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/**************************************************************************************************
+Component Cache:
+    A process-wide cache of the files in Private/Components.
+
+    Each component is read from disk and tokenized once, the first time any page includes it.
+    After that every page shares the same loaded copy. Components that don't exist are cached
+    too, so a missing include is only looked for on disk once per run.
+
+    Components are keyed by their normalized path, so "nav/menu.html" and "./nav/../nav/menu.html"
+    share an entry. The cache is safe to use from multiple threads.
+
+    A component's expansion (its tokens with every include inside it expanded, see FindExpanded)
+    doesn't depend on the page including it, so it's also built once and shared by every page.
+    Before a component is expanded the include graph around it is searched for cycles (strongly
+    connected components), so a component that includes itself, directly or through others, is
+    found right away, along with the path of includes that leads back to it.
+
+    An expansion is laid out in a single buffer of its own, with neighbouring literals merged, so
+    including it splices in a handful of tokens no matter how many components it's made of. With
+    SetSnapshotDirectory expansions are also kept on disk between runs (see ComponentSnapshot.h).
+**************************************************************************************************/
+
+// The normalized path of the component an include statement names. Used as the cache key.
+std::filesystem::path GetNormalizedComponentPath(std::string_view includeName);
+
+struct Component {
+    // Normalized path of the component file.
+    std::filesystem::path Path;
+    // The component file, mapped or read once.
+    MappedFile Source;
+    // The contents of Source split into literals and statements, in order. The tokens point into Source.
+    std::vector<Token> Tokens;
+};
+
+// A component with every include inside it expanded, built once and shared by every page that includes it.
+struct ExpandedComponent {
+    // Normalized path of the component file.
+    std::filesystem::path Path;
+    // False if there's no such component.
+    bool Exists = false;
+    // Set if the component includes itself, directly or through others, to the includes that lead back to it
+    // (ie: "a.html -> b.html -> a.html"). Such a component isn't expanded.
+    std::string Cycle;
+    // The component's tokens with every include replaced by the tokens of the component it names, recursively. An
+    // include of a component that doesn't exist is left out, one of a component in a cycle is left as a literal.
+    // Neighbouring literals are merged. The tokens cover Text in order.
+    std::vector<Token> Tokens;
+    // The text of every token, copied together (or mapped from a snapshot).
+    MappedFile Text;
+    // Every component included along the way in order, even ones that don't exist. For a component in a cycle, the
+    // components in the cycle.
+    std::vector<std::filesystem::path> Dependencies;
+    // Include statements expanded along the way.
+    int IncludesProcessed = 0;
+    // Missing and circular includes found along the way, logged again by every page that includes this.
+    std::vector<std::string> Errors;
+};
+
+class ComponentCache
+{
+public:
+    static ComponentCache& Get();
+
+    // Returns the component the include statement names (relative to Private/Components).
+    // Returns nullptr if there's no such component.
+    std::shared_ptr<Component const> Find(std::string_view includeName);
+
+    // Returns the expansion of the component the include statement names, never nullptr (see ExpandedComponent for
+    // components that don't exist or include themselves).
+    std::shared_ptr<ExpandedComponent const> FindExpanded(std::string_view includeName);
+
+    // Forgets one component (by normalized path) so it's read from disk again the next time it's included.
+    // Every expansion is built again too, any of them may include it.
+    void Invalidate(std::filesystem::path const& componentPath);
+
+    // Forgets everything that was loaded so components are read from disk again.
+    void Clear();
+
+    // Writes a snapshot of every expansion built to directory, and if useExisting is set, opens the snapshots found
+    // there instead of expanding again. Snapshots aren't used unless this is called, or if directory is empty.
+    void SetSnapshotDirectory(std::filesystem::path const& directory, bool useExisting);
+
+private:
+    ComponentCache() = default;
+
+    static std::shared_ptr<Component const> Load(std::filesystem::path const& path);
+
+    std::shared_ptr<Component const> FindPath(std::filesystem::path const& path);
+
+    // These expect m_ExpandMutex to be held.
+    std::shared_ptr<ExpandedComponent const> Expand(std::filesystem::path const& path);
+    // Sets m_Cycles for every component reachable from path that isn't in it yet.
+    void FindCycles(std::filesystem::path const& path);
+    // Stats a component file once per run (or until it's invalidated).
+    FileStamp GetStamp(std::filesystem::path const& path);
+
+    std::shared_mutex m_Mutex;
+    // A null entry records that the component doesn't exist.
+    std::unordered_map<std::string, std::shared_ptr<Component const>> m_Components;
+    // Expansions by the include name pages used, so a page's include is found without normalizing its path.
+    std::unordered_map<std::string, std::shared_ptr<ExpandedComponent const>> m_ExpandedByName;
+
+    // Expanding (and searching for cycles) happens one component at a time. Each one is only expanded once.
+    std::mutex m_ExpandMutex;
+    // By normalized path.
+    std::unordered_map<std::string, std::shared_ptr<ExpandedComponent const>> m_Expanded;
+    // The cycle each component is in, starting and ending with it. Empty for components that aren't in any.
+    std::unordered_map<std::string, std::vector<std::filesystem::path>> m_Cycles;
+    std::unordered_map<std::string, FileStamp> m_Stamps;
+    // Empty unless snapshots are used.
+    std::filesystem::path m_SnapshotDirectory;
+    bool m_UseExistingSnapshots = false;
+};
@@ -0,0 +1,217 @@
+#include "ComponentSnapshot.h"
+
+#include "BinaryFile.h"
+#include "ComponentCache.h"
+#include "Hash.h"
+#include "Logging.h"
+#include "Profiler.h"
+#include "RenderStages.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <string_view>
+
+namespace {
+    constexpr char k_SnapshotMagic[8] = { 'E', 'S', 'D', 'C', 'O', 'M', 'P', '1' };
+    // Reads back differently on a machine with the other byte order.
+    constexpr uint32_t k_ByteOrderMark = 0x01020304;
+
+    struct Header {
+        char Magic[8];
+        uint32_t ByteOrder;
+        int32_t IncludesProcessed;
+        // The stamp of the component itself.
+        int64_t Time;
+        int64_t Size;
+        uint64_t DependencyCount;
+        uint64_t ErrorCount;
+        uint64_t TokenCount;
+        uint64_t TextSize;
+    };
+
+    struct Stamp {
+        int64_t Time;
+        int64_t Size;
+    };
+
+    struct TokenEntry {
+        uint64_t TextSize;
+        // Where the token's center starts within its text.
+        uint64_t CenterOffset;
+        uint64_t CenterSize;
+        uint32_t Type;
+        uint32_t Padding;
+    };
+
+    void AppendStamp(std::string& data, FileStamp const& stamp) {
+        BinaryFile::Append(data, Stamp { stamp.Time, stamp.Size });
+    }
+}
+
+namespace ComponentSnapshot {
+    std::filesystem::path GetPath(std::filesystem::path const& directory, std::filesystem::path const& componentPath) {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.esdcomp", static_cast<unsigned long long>(HashBytes(componentPath.generic_string())));
+        return directory / name;
+    }
+
+    std::shared_ptr<ExpandedComponent const> TryOpen(std::filesystem::path const& path, std::filesystem::path const& componentPath, StampFunction const& getStamp) {
+        auto span = Profiler::Span("Open Component Snapshot", "component");
+        span.SetPath(componentPath);
+
+        auto expanded = std::make_shared<ExpandedComponent>();
+        if(!expanded->Text.Open(path)) {
+            return nullptr;
+        }
+
+        std::string_view const data = expanded->Text.GetText();
+        BinaryFile::Reader reader(data);
+        Header header {};
+        if(!reader.Read(header) || std::memcmp(header.Magic, k_SnapshotMagic, sizeof(k_SnapshotMagic)) != 0 || header.ByteOrder != k_ByteOrderMark) {
+            return nullptr;
+        }
+
+        std::string storedPath;
+        if(!reader.ReadString(storedPath) || storedPath != componentPath.generic_string()) {
+            // Another component with the same hash.
+            return nullptr;
+        }
+        if(getStamp(componentPath) != FileStamp { header.Time, header.Size }) {
+            return nullptr;
+        }
+
+        // Stamps are checked as they're read, so an out of date snapshot stops at the first component that changed.
+        for(uint64_t i = 0; i < header.DependencyCount; ++i) {
+            Stamp stamp {};
+            std::string dependency;
+            if(!reader.Read(stamp) || !reader.ReadString(dependency)) {
+                Logging::LogWarning("Ignoring %s, it's malformed.", path.string().c_str());
+                return nullptr;
+            }
+            std::filesystem::path dependencyPath = std::filesystem::path(dependency).make_preferred();
+            if(getStamp(dependencyPath) != FileStamp { stamp.Time, stamp.Size }) {
+                return nullptr;
+            }
+            expanded->Dependencies.push_back(std::move(dependencyPath));
+        }
+
+        for(uint64_t i = 0; i < header.ErrorCount; ++i) {
+            std::string error;
+            if(!reader.ReadString(error)) {
+                Logging::LogWarning("Ignoring %s, it's malformed.", path.string().c_str());
+                return nullptr;
+            }
+            expanded->Errors.push_back(std::move(error));
+        }
+
+        std::vector<TokenEntry> entries;
+        entries.reserve(static_cast<size_t>(std::min<uint64_t>(header.TokenCount, reader.GetRemainder().size() / sizeof(TokenEntry))));
+        for(uint64_t i = 0; i < header.TokenCount; ++i) {
+            TokenEntry entry {};
+            if(!reader.Read(entry)) {
+                Logging::LogWarning("Ignoring %s, it's malformed.", path.string().c_str());
+                return nullptr;
+            }
+            entries.push_back(entry);
+        }
+
+        // The tokens have to cover the text exactly.
+        std::string_view const text = reader.GetRemainder();
+        size_t offset = 0;
+        expanded->Tokens.reserve(entries.size());
+        for(TokenEntry const& entry : entries) {
+            bool const fits = entry.Type <= static_cast<uint32_t>(Token::Type::Substitution)
+                && entry.TextSize <= text.size() - offset
+                && entry.CenterOffset <= entry.TextSize
+                && entry.CenterSize <= entry.TextSize - entry.CenterOffset;
+            if(!fits) {
+                Logging::LogWarning("Ignoring %s, it's malformed.", path.string().c_str());
+                return nullptr;
+            }
+
+            Token token;
+            token.TokenType = static_cast<Token::Type>(entry.Type);
+            token.Text = text.substr(offset, static_cast<size_t>(entry.TextSize));
+            token.Center = token.Text.substr(static_cast<size_t>(entry.CenterOffset), static_cast<size_t>(entry.CenterSize));
+            expanded->Tokens.push_back(token);
+            offset += static_cast<size_t>(entry.TextSize);
+        }
+        if(offset != text.size() || header.TextSize != text.size()) {
+            Logging::LogWarning("Ignoring %s, it's malformed.", path.string().c_str());
+            return nullptr;
+        }
+
+        RenderStages::ResolveSymbols(expanded->Tokens);
+        expanded->Path = componentPath;
+        expanded->Exists = true;
+        expanded->IncludesProcessed = header.IncludesProcessed;
+        span.SetBytes(data.size());
+        return expanded;
+    }
+
+    bool Write(std::filesystem::path const& path, ExpandedComponent const& expanded, StampFunction const& getStamp) {
+        auto span = Profiler::Span("Write Component Snapshot", "component");
+        span.SetPath(expanded.Path);
+
+        std::string_view const text = expanded.Text.GetText();
+        FileStamp const stamp = getStamp(expanded.Path);
+
+        Header header {};
+        std::memcpy(header.Magic, k_SnapshotMagic, sizeof(k_SnapshotMagic));
+        header.ByteOrder = k_ByteOrderMark;
+        header.IncludesProcessed = expanded.IncludesProcessed;
+        header.Time = stamp.Time;
+        header.Size = stamp.Size;
+        header.DependencyCount = expanded.Dependencies.size();
+        header.ErrorCount = expanded.Errors.size();
+        header.TokenCount = expanded.Tokens.size();
+        header.TextSize = text.size();
+
+        std::string data;
+        data.reserve(sizeof(Header) + expanded.Tokens.size() * sizeof(TokenEntry) + text.size());
+        BinaryFile::Append(data, header);
+        BinaryFile::AppendString(data, expanded.Path.generic_string());
+        for(std::filesystem::path const& dependency : expanded.Dependencies) {
+            AppendStamp(data, getStamp(dependency));
+            BinaryFile::AppendString(data, dependency.generic_string());
+        }
+        for(std::string const& error : expanded.Errors) {
+            BinaryFile::AppendString(data, error);
+        }
+        for(Token const& token : expanded.Tokens) {
+            TokenEntry entry {};
+            entry.Type = static_cast<uint32_t>(token.TokenType);
+            entry.TextSize = token.Text.size();
+            entry.CenterOffset = token.Center.empty() ? 0 : static_cast<uint64_t>(token.Center.data() - token.Text.data());
+            entry.CenterSize = token.Center.size();
+            BinaryFile::Append(data, entry);
+        }
+        data.append(text);
+
+        std::error_code error;
+        std::filesystem::create_directories(path.parent_path(), error);
+
+        // Write next to the snapshot and move it into place, the old snapshot may still be mapped.
+        std::filesystem::path temporaryPath = path;
+        temporaryPath += ".tmp";
+        {
+            std::ofstream file(temporaryPath, std::ios::out | std::ios::binary | std::ios::trunc);
+            if(!file.is_open() || !file.write(data.data(), static_cast<std::streamsize>(data.size()))) {
+                Logging::LogWarning("Couldn't write %s.", temporaryPath.string().c_str());
+                return false;
+            }
+        }
+        std::filesystem::rename(temporaryPath, path, error);
+        if(error) {
+            Logging::LogWarning("Couldn't write %s.", path.string().c_str());
+            std::filesystem::remove(temporaryPath, error);
+            return false;
+        }
+
+        span.SetBytes(data.size());
+        return true;
+    }
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "BuildManifest.h"
+
+#include <filesystem>
+#include <functional>
+#include <memory>
+
+struct ExpandedComponent;
+
+/**************************************************************************************************
+Component Snapshots:
+    Copies of expanded components (see ComponentCache::FindExpanded) kept in .esd/components, so
+    the next run maps a component's whole expansion into memory instead of reading, tokenizing
+    and expanding every component it includes again.
+
+    A snapshot records the size and modification time of the component and of every component
+    it includes, directly or not (missing ones too). It's only used while all of them still
+    match, otherwise the component is expanded as usual and the snapshot is written again.
+    Components that include themselves have no snapshot.
+
+    File layout (native byte order, the header records it):
+        Header
+        uint64 + char[]                        component path
+        Stamp + uint64 + char[]  [Dependencies] every component included along the way
+        uint64 + char[]          [Errors]
+        TokenEntry[Tokens]
+        char[]                                 the expansion's text, which the tokens cover in order
+**************************************************************************************************/
+namespace ComponentSnapshot {
+    // Returns the current stamp of a component file.
+    using StampFunction = std::function<FileStamp(std::filesystem::path const&)>;
+
+    // Where the snapshot of the component at componentPath (normalized) is kept within directory.
+    std::filesystem::path GetPath(std::filesystem::path const& directory, std::filesystem::path const& componentPath);
+
+    // Opens the snapshot at path if it's of the component at componentPath and every file it was built from still
+    // matches getStamp. Returns nullptr otherwise.
+    std::shared_ptr<ExpandedComponent const> TryOpen(std::filesystem::path const& path, std::filesystem::path const& componentPath, StampFunction const& getStamp);
+
+    // Writes a snapshot of expanded, stamping it and its dependencies with getStamp.
+    // The file is replaced in one step, so a snapshot that is currently open stays intact.
+    bool Write(std::filesystem::path const& path, ExpandedComponent const& expanded, StampFunction const& getStamp);
+}
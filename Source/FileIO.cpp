@@ -0,0 +1,366 @@
+#include "FileIO.h"
+
+#include "Profiler.h"
+
+#include <cerrno>
+#include <fstream>
+#include <mutex>
+#include <set>
+
+#if defined(__linux__) || defined(__APPLE__)
+#define ESD_USE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#elif defined(__APPLE__)
+#include <copyfile.h>
+#include <sys/clonefile.h>
+#endif
+
+namespace {
+    // Below this size reading into a buffer is cheaper than setting up (and tearing down) a mapping.
+    constexpr size_t k_MinimumMappedSize = 64 * 1024;
+}
+
+MappedFile::~MappedFile() {
+    Close();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+: m_Mapping(other.m_Mapping)
+, m_MappingSize(other.m_MappingSize)
+, m_Buffer(std::move(other.m_Buffer))
+, m_BufferSize(other.m_BufferSize) {
+    other.m_Mapping = nullptr;
+    other.m_MappingSize = 0;
+    other.m_BufferSize = 0;
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+    if(this != &other) {
+        Close();
+        m_Mapping = other.m_Mapping;
+        m_MappingSize = other.m_MappingSize;
+        m_Buffer = std::move(other.m_Buffer);
+        m_BufferSize = other.m_BufferSize;
+        other.m_Mapping = nullptr;
+        other.m_MappingSize = 0;
+        other.m_BufferSize = 0;
+    }
+    return *this;
+}
+
+bool MappedFile::Open(std::filesystem::path const& path) {
+    Close();
+
+    auto span = Profiler::Span("Read File", "io");
+    span.SetPath(path);
+
+#if defined(ESD_USE_MMAP)
+    Profiler::CountSyscalls();
+    int const fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return false;
+    }
+
+    // fstat and, whichever way the file is read, close.
+    Profiler::CountSyscalls(2);
+    struct stat status {};
+    if(fstat(fd, &status) != 0) {
+        close(fd);
+        return false;
+    }
+
+    size_t const size = static_cast<size_t>(status.st_size);
+    if(S_ISREG(status.st_mode) && size >= k_MinimumMappedSize) {
+        Profiler::CountSyscalls();
+        void* const mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(mapping != MAP_FAILED) {
+            // Sources are read front to back exactly once.
+            Profiler::CountSyscalls();
+            madvise(mapping, size, MADV_SEQUENTIAL);
+            close(fd);
+            m_Mapping = mapping;
+            m_MappingSize = size;
+            span.SetBytes(size);
+            return true;
+        }
+    }
+
+    if(!S_ISREG(status.st_mode)) {
+        close(fd);
+        return false;
+    }
+
+    m_Buffer = std::unique_ptr<char[]>(new char[size]);
+    size_t offset = 0;
+    while(offset < size) {
+        Profiler::CountSyscalls();
+        ssize_t const bytesRead = read(fd, m_Buffer.get() + offset, size - offset);
+        if(bytesRead < 0) {
+            close(fd);
+            m_Buffer.reset();
+            return false;
+        }
+        if(bytesRead == 0) {
+            // The file shrank since we checked its size.
+            break;
+        }
+        offset += static_cast<size_t>(bytesRead);
+    }
+    m_BufferSize = offset;
+    close(fd);
+    span.SetBytes(offset);
+    return true;
+#else
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    if(!file.is_open()) {
+        return false;
+    }
+
+    file.seekg(0, std::ios::end);
+    std::streamsize const size = file.tellg();
+    file.seekg(0, std::ios::beg);
+    if(size < 0) {
+        return false;
+    }
+
+    m_Buffer = std::unique_ptr<char[]>(new char[static_cast<size_t>(size)]);
+    if(size > 0 && !file.read(m_Buffer.get(), size)) {
+        m_Buffer.reset();
+        return false;
+    }
+    m_BufferSize = static_cast<size_t>(size);
+    span.SetBytes(m_BufferSize);
+    return true;
+#endif
+}
+
+void MappedFile::Adopt(std::unique_ptr<char[]> buffer, size_t size) {
+    Close();
+    m_Buffer = std::move(buffer);
+    m_BufferSize = m_Buffer ? size : 0;
+}
+
+void MappedFile::Close() {
+#if defined(ESD_USE_MMAP)
+    if(m_Mapping != nullptr) {
+        munmap(m_Mapping, m_MappingSize);
+    }
+#endif
+    m_Mapping = nullptr;
+    m_MappingSize = 0;
+    m_Buffer.reset();
+    m_BufferSize = 0;
+}
+
+std::string_view MappedFile::GetText() const {
+    if(m_Mapping != nullptr) {
+        return std::string_view(static_cast<char const*>(m_Mapping), m_MappingSize);
+    }
+    return std::string_view(m_Buffer.get(), m_BufferSize);
+}
+
+void MappedFile::Prefetch() const {
+#if defined(ESD_USE_MMAP)
+    if(m_Mapping == nullptr) {
+        return;
+    }
+
+    auto span = Profiler::Span("Prefetch File", "io");
+    span.SetBytes(m_MappingSize);
+
+    Profiler::CountSyscalls();
+    madvise(m_Mapping, m_MappingSize, MADV_WILLNEED);
+    // Touching a byte of every page waits for the read ahead to land.
+    size_t const pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    char const* const bytes = static_cast<char const*>(m_Mapping);
+    unsigned char touched = 0;
+    for(size_t offset = 0; offset < m_MappingSize; offset += pageSize) {
+        touched ^= static_cast<unsigned char>(*static_cast<char const volatile*>(bytes + offset));
+    }
+    static_cast<void>(touched);
+#endif
+}
+
+bool MappedFile::IsMapped() const {
+    return m_Mapping != nullptr;
+}
+
+namespace {
+    // Output directories that are known to exist. Pages render concurrently so creating them is synchronized.
+    std::mutex s_OutputDirectoriesMutex;
+    std::set<std::filesystem::path> s_OutputDirectories;
+}
+
+void EnsureOutputDirectory(std::filesystem::path const& directory) {
+    std::lock_guard<std::mutex> lock(s_OutputDirectoriesMutex);
+    if(s_OutputDirectories.count(directory) != 0) {
+        return;
+    }
+#if defined(ESD_USE_MMAP)
+    // Usually the directory is there already or only it is missing, either takes a single mkdir.
+    Profiler::CountSyscalls();
+    if(mkdir(directory.c_str(), 0777) != 0 && errno != EEXIST) {
+        std::filesystem::create_directories(directory);
+    }
+#else
+    if (!std::filesystem::exists(directory)) {
+        std::filesystem::create_directories(directory);
+    }
+#endif
+    s_OutputDirectories.insert(directory);
+}
+
+#if defined(__linux__)
+
+namespace {
+    // Copies size bytes from in to out, falling back from copy_file_range to sendfile to read and write
+    // depending on what the kernel and file systems support.
+    bool CopyDescriptor(int in, int out, size_t size) {
+        size_t copied = 0;
+
+        bool useCopyFileRange = true;
+        while(useCopyFileRange && copied < size) {
+            Profiler::CountSyscalls();
+            ssize_t const result = copy_file_range(in, nullptr, out, nullptr, size - copied, 0);
+            if(result > 0) {
+                copied += static_cast<size_t>(result);
+            } else if(result == 0) {
+                // The file shrank since we checked its size.
+                return true;
+            } else if(errno == EINTR) {
+                continue;
+            } else if(errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP) {
+                useCopyFileRange = false;
+            } else {
+                return false;
+            }
+        }
+
+        bool useSendfile = true;
+        while(useSendfile && copied < size) {
+            Profiler::CountSyscalls();
+            ssize_t const result = sendfile(out, in, nullptr, size - copied);
+            if(result > 0) {
+                copied += static_cast<size_t>(result);
+            } else if(result == 0) {
+                return true;
+            } else if(errno == EINTR) {
+                continue;
+            } else if(errno == EINVAL || errno == ENOSYS) {
+                useSendfile = false;
+            } else {
+                return false;
+            }
+        }
+
+        char buffer[64 * 1024];
+        while(copied < size) {
+            Profiler::CountSyscalls();
+            ssize_t const bytesRead = read(in, buffer, sizeof(buffer));
+            if(bytesRead == 0) {
+                return true;
+            }
+            if(bytesRead < 0) {
+                if(errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            for(ssize_t written = 0; written < bytesRead; ) {
+                Profiler::CountSyscalls();
+                ssize_t const result = write(out, buffer + written, static_cast<size_t>(bytesRead - written));
+                if(result < 0) {
+                    if(errno == EINTR) {
+                        continue;
+                    }
+                    return false;
+                }
+                written += result;
+            }
+            copied += static_cast<size_t>(bytesRead);
+        }
+        return true;
+    }
+}
+#endif
+
+bool CopyFileContents(std::filesystem::path const& source, std::filesystem::path const& destination) {
+#if defined(__linux__) || defined(__APPLE__)
+    Profiler::CountSyscalls();
+    int const in = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+    if(in < 0) {
+        return false;
+    }
+    struct stat status {};
+    Profiler::CountSyscalls();
+    if(fstat(in, &status) != 0) {
+        close(in);
+        return false;
+    }
+    Profiler::CountSyscalls();
+    int const out = open(destination.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, status.st_mode & 0777);
+    if(out < 0) {
+        close(in);
+        return false;
+    }
+
+#if defined(__linux__)
+    bool const copied = CopyDescriptor(in, out, static_cast<size_t>(status.st_size));
+#else
+    Profiler::CountSyscalls();
+    bool const copied = fcopyfile(in, out, nullptr, COPYFILE_DATA) == 0;
+#endif
+
+    Profiler::CountSyscalls(2);
+    close(in);
+    return close(out) == 0 && copied;
+#else
+    std::error_code error;
+    std::filesystem::copy_file(source, destination, std::filesystem::copy_options::overwrite_existing, error);
+    return !error;
+#endif
+}
+
+bool CloneFile(std::filesystem::path const& source, std::filesystem::path const& destination) {
+#if defined(__linux__) && defined(FICLONE)
+    Profiler::CountSyscalls();
+    int const in = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+    if(in < 0) {
+        return false;
+    }
+    Profiler::CountSyscalls();
+    int const out = open(destination.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(out < 0) {
+        close(in);
+        return false;
+    }
+    Profiler::CountSyscalls();
+    bool const cloned = ioctl(out, FICLONE, in) == 0;
+    Profiler::CountSyscalls(2);
+    close(in);
+    close(out);
+    if(!cloned) {
+        std::error_code error;
+        std::filesystem::remove(destination, error);
+    }
+    return cloned;
+#elif defined(__APPLE__)
+    // clonefile won't replace an existing file.
+    std::error_code error;
+    std::filesystem::remove(destination, error);
+    return clonefile(source.c_str(), destination.c_str(), 0) == 0;
+#else
+    (void)source;
+    (void)destination;
+    return false;
+#endif
+}
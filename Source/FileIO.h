@@ -0,0 +1,64 @@
+#pragma once
+
+#include <filesystem>
+#include <memory>
+#include <string_view>
+
+/**************************************************************************************************
+Mapped File:
+    Read-only access to the entire contents of a file without copying it.
+
+    On Linux and MacOS larger files are memory mapped, so GetText() points straight at the page
+    cache. Small files (where mapping costs more than it saves), files that can't be mapped and
+    other platforms fall back to reading the file into a buffer.
+
+    Views returned by GetText() are valid until the MappedFile is closed or destroyed. They stay
+    valid when the MappedFile is moved.
+
+    A mapped file that is truncated by another program while it's open can crash esd when read,
+    so avoid rewriting sources in place while esd is rendering them.
+**************************************************************************************************/
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(MappedFile const&)            = delete;
+    MappedFile& operator=(MappedFile const&) = delete;
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+
+    // Opens the file at path, closing whatever was open before. Returns false if it couldn't be read.
+    bool Open(std::filesystem::path const& path);
+    // Takes ownership of size bytes already read into buffer (see BatchIO.h), closing whatever was open before.
+    void Adopt(std::unique_ptr<char[]> buffer, size_t size);
+    void Close();
+
+    std::string_view GetText() const;
+    bool IsMapped() const;
+
+    // Makes sure a mapped file's contents are in memory, so the first reads of GetText() don't block on the disk.
+    // Buffered files were read in full by Open() already.
+    void Prefetch() const;
+
+private:
+    void* m_Mapping = nullptr;
+    size_t m_MappingSize = 0;
+    // Used instead of a mapping by the buffered fallback. Not a std::string so moving never moves the text.
+    std::unique_ptr<char[]> m_Buffer;
+    size_t m_BufferSize = 0;
+};
+
+// Creates directory (and its parents) if it doesn't exist yet. Directories are remembered once created, so
+// calling this for every output file only touches the file system once per directory. Safe to call from multiple threads.
+void EnsureOutputDirectory(std::filesystem::path const& directory);
+
+// Copies the contents of source to destination, replacing destination if it exists.
+// The data is copied by the kernel where possible (copy_file_range or sendfile on Linux, fcopyfile on MacOS)
+// so it never passes through esd. Returns false if the copy failed.
+bool CopyFileContents(std::filesystem::path const& source, std::filesystem::path const& destination);
+
+// Makes destination a copy-on-write clone of source (a reflink) if the file system supports it. Nothing is
+// copied, the two files share storage until one of them is modified. Returns false if cloning isn't possible.
+bool CloneFile(std::filesystem::path const& source, std::filesystem::path const& destination);
@@ -0,0 +1,153 @@
+#include "Hash.h"
+
+#include "FileIO.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+    constexpr uint64_t k_Prime1 = 11400714785074694791ull;
+    constexpr uint64_t k_Prime2 = 14029467366897019727ull;
+    constexpr uint64_t k_Prime3 = 1609587929392839161ull;
+    constexpr uint64_t k_Prime4 = 9650029242287828579ull;
+    constexpr uint64_t k_Prime5 = 2870177450012600261ull;
+
+    uint64_t RotateLeft(uint64_t value, int bits) {
+        return (value << bits) | (value >> (64 - bits));
+    }
+
+    // Reads little endian so the hash is the same everywhere.
+    uint64_t Read64(unsigned char const* data) {
+        uint64_t value = 0;
+        for(int i = 7; i >= 0; --i) {
+            value = (value << 8) | data[i];
+        }
+        return value;
+    }
+
+    uint32_t Read32(unsigned char const* data) {
+        return static_cast<uint32_t>(data[0]) | (static_cast<uint32_t>(data[1]) << 8)
+            | (static_cast<uint32_t>(data[2]) << 16) | (static_cast<uint32_t>(data[3]) << 24);
+    }
+
+    uint64_t Round(uint64_t accumulator, uint64_t input) {
+        accumulator += input * k_Prime2;
+        accumulator = RotateLeft(accumulator, 31);
+        return accumulator * k_Prime1;
+    }
+
+    uint64_t MergeRound(uint64_t accumulator, uint64_t value) {
+        accumulator ^= Round(0, value);
+        return accumulator * k_Prime1 + k_Prime4;
+    }
+
+    // Consumes every whole 32 byte stripe between it and end into the four lanes of v. Returns where it stopped.
+    unsigned char const* Stripes(uint64_t (&v)[4], unsigned char const* it, unsigned char const* end) {
+        while(end - it >= 32) {
+            v[0] = Round(v[0], Read64(it));
+            v[1] = Round(v[1], Read64(it + 8));
+            v[2] = Round(v[2], Read64(it + 16));
+            v[3] = Round(v[3], Read64(it + 24));
+            it += 32;
+        }
+        return it;
+    }
+
+    uint64_t Converge(uint64_t const (&v)[4]) {
+        uint64_t hash = RotateLeft(v[0], 1) + RotateLeft(v[1], 7) + RotateLeft(v[2], 12) + RotateLeft(v[3], 18);
+        hash = MergeRound(hash, v[0]);
+        hash = MergeRound(hash, v[1]);
+        hash = MergeRound(hash, v[2]);
+        hash = MergeRound(hash, v[3]);
+        return hash;
+    }
+
+    // Mixes in the last (less than 32) bytes and scrambles the result.
+    uint64_t Finish(uint64_t hash, unsigned char const* it, unsigned char const* end) {
+        while(it + 8 <= end) {
+            hash ^= Round(0, Read64(it));
+            hash = RotateLeft(hash, 27) * k_Prime1 + k_Prime4;
+            it += 8;
+        }
+        if(it + 4 <= end) {
+            hash ^= static_cast<uint64_t>(Read32(it)) * k_Prime1;
+            hash = RotateLeft(hash, 23) * k_Prime2 + k_Prime3;
+            it += 4;
+        }
+        while(it < end) {
+            hash ^= static_cast<uint64_t>(*it) * k_Prime5;
+            hash = RotateLeft(hash, 11) * k_Prime1;
+            ++it;
+        }
+
+        hash ^= hash >> 33;
+        hash *= k_Prime2;
+        hash ^= hash >> 29;
+        hash *= k_Prime3;
+        hash ^= hash >> 32;
+        return hash;
+    }
+}
+
+uint64_t HashBytes(std::string_view data) {
+    unsigned char const* it = reinterpret_cast<unsigned char const*>(data.data());
+    unsigned char const* const end = it + data.size();
+    uint64_t hash;
+
+    if(data.size() >= 32) {
+        uint64_t v[4] = { k_Prime1 + k_Prime2, k_Prime2, 0, 0 - k_Prime1 };
+        it = Stripes(v, it, end);
+        hash = Converge(v);
+    } else {
+        hash = k_Prime5;
+    }
+
+    hash += static_cast<uint64_t>(data.size());
+    return Finish(hash, it, end);
+}
+
+StreamHash::StreamHash()
+: m_Lanes{ k_Prime1 + k_Prime2, k_Prime2, 0, 0 - k_Prime1 } {
+}
+
+void StreamHash::Update(std::string_view data) {
+    unsigned char const* it = reinterpret_cast<unsigned char const*>(data.data());
+    unsigned char const* const end = it + data.size();
+    m_Size += data.size();
+
+    // Top up a stripe left over from before.
+    if(m_PendingSize > 0) {
+        size_t const taken = std::min(data.size(), sizeof(m_Pending) - m_PendingSize);
+        std::memcpy(m_Pending + m_PendingSize, it, taken);
+        m_PendingSize += taken;
+        it += taken;
+        if(m_PendingSize < sizeof(m_Pending)) {
+            return;
+        }
+        Stripes(m_Lanes, m_Pending, m_Pending + sizeof(m_Pending));
+        m_PendingSize = 0;
+    }
+
+    it = Stripes(m_Lanes, it, end);
+    m_PendingSize = static_cast<size_t>(end - it);
+    std::memcpy(m_Pending, it, m_PendingSize);
+}
+
+uint64_t StreamHash::GetHash() const {
+    uint64_t hash = m_Size >= 32 ? Converge(m_Lanes) : k_Prime5;
+    hash += m_Size;
+    return Finish(hash, m_Pending, m_Pending + m_PendingSize);
+}
+
+std::optional<uint64_t> HashFile(std::filesystem::path const& path) {
+    auto span = Profiler::Span("Hash File", "io");
+    span.SetPath(path);
+
+    MappedFile file;
+    if(!file.Open(path)) {
+        return {};
+    }
+    span.SetBytes(file.GetText().size());
+    return HashBytes(file.GetText());
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string_view>
+
+// A fast 64 bit hash of data (XXH64). Stable between runs and platforms, so it can be stored in files
+// under .esd and compared on the next run. Not suitable for anything security related.
+uint64_t HashBytes(std::string_view data);
+
+// HashBytes of the entire contents of a file. Returns {} if the file can't be read.
+std::optional<uint64_t> HashFile(std::filesystem::path const& path);
+
+// HashBytes of data that arrives a piece at a time. The hash of all of the pieces is the same as HashBytes of
+// them joined together.
+class StreamHash
+{
+public:
+    StreamHash();
+
+    void Update(std::string_view data);
+    // The hash of everything so far. More can still be added after.
+    uint64_t GetHash() const;
+
+private:
+    uint64_t m_Lanes[4];
+    uint64_t m_Size = 0;
+    // The start of a 32 byte stripe that hasn't been mixed in yet.
+    unsigned char m_Pending[32];
+    size_t m_PendingSize = 0;
+};
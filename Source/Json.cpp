@@ -0,0 +1,29 @@
+#include "Json.h"
+
+#include <cstdio>
+
+namespace Json {
+
+    void WriteString(std::ostream& os, std::string_view text) {
+        os << '"';
+        for(char ch : text) {
+            switch(ch) {
+                case '"':  os << "\\\""; break;
+                case '\\': os << "\\\\"; break;
+                case '\n': os << "\\n"; break;
+                case '\r': os << "\\r"; break;
+                case '\t': os << "\\t"; break;
+                default:
+                    if(static_cast<unsigned char>(ch) < 0x20) {
+                        char escaped[8];
+                        std::snprintf(escaped, sizeof(escaped), "\\u%04x", ch);
+                        os << escaped;
+                    } else {
+                        os << ch;
+                    }
+                    break;
+            }
+        }
+        os << '"';
+    }
+}
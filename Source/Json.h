@@ -0,0 +1,11 @@
+#pragma once
+
+#include <ostream>
+#include <string_view>
+
+// Helpers for the JSON files esd writes (--profile and --report).
+namespace Json {
+
+    // Writes text as a quoted JSON string, escaping whatever JSON requires.
+    void WriteString(std::ostream& os, std::string_view text);
+}
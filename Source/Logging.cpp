@@ -7,30 +7,44 @@
 
 #include "Logging.h"
 
-#include <iostream>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
 #include <filesystem>
+#include <mutex>
 #include <stdarg.h>
 #include <stdio.h>
+#include <string>
+#include <thread>
+#include <vector>
 
 
 // Header for all logging and assertions
 
 namespace Logging {
-    // can be set with -v argument on the command line.
-    bool g_Verbose = false;
+    // can be set with -v or --log=<level> on the command line.
+    LogLevel g_LogLevel = LogLevel::Normal;
 
     namespace {
-        size_t s_Indentation = 0;
+        enum class ConsoleColor
+        {
+            Normal, Red, Yellow, Cyan
+        };
+    }
+
+    struct LogRecord {
+        ConsoleColor Color;
+        std::string Text;
+    };
+
+    namespace {
+        // Indentation is per thread so concurrently rendered pages don't indent each other's logs.
+        thread_local size_t s_Indentation = 0;
         constexpr size_t k_MaxIndentation = 6;
         std::string GetIndentation() {
             return std::string(std::min<size_t>(s_Indentation, k_MaxIndentation)*2, ' ');
         }
 
-
-        enum class ConsoleColor
-        {
-            Normal, Red, Yellow, Cyan
-        };
 #if defined(_MSC_VER)
         void SetConsoleColor(ConsoleColor color) {
             switch (color) {
@@ -50,26 +64,204 @@ namespace Logging {
                 break;
             }
         }
+
+        void WriteRecords(std::vector<LogRecord> const& records) {
+            // Colors are set on the console itself, so each record is written on its own.
+            for(LogRecord const& record : records) {
+                if(record.Color != ConsoleColor::Normal) {
+                    fflush(stdout);
+                    SetConsoleColor(record.Color);
+                }
+                fwrite(record.Text.data(), 1, record.Text.size(), stdout);
+                fputc('\n', stdout);
+                if(record.Color != ConsoleColor::Normal) {
+                    fflush(stdout);
+                    SetConsoleColor(ConsoleColor::Normal);
+                }
+            }
+        }
 #else
-        void SetConsoleColor(ConsoleColor color) {
+        char const* GetColorCode(ConsoleColor color) {
             switch (color) {
             case ConsoleColor::Normal:
-                std::cout << "\x1B[0m";
-                break;
+                return "\x1B[0m";
             case ConsoleColor::Red:
-                std::cout << "\x1B[31m";
-                break;
+                return "\x1B[31m";
             case ConsoleColor::Yellow:
-                std::cout << "\x1B[33m";
-                break;
+                return "\x1B[33m";
             case ConsoleColor::Cyan:
-                std::cout << "\x1B[36m";
-                break;
+                return "\x1B[36m";
             default:
-                break;
+                return "";
             }
-    }
+        }
+
+        void WriteRecords(std::vector<LogRecord> const& records) {
+            // Everything is written with a single call, colors are escape codes in the text.
+            std::string text;
+            for(LogRecord const& record : records) {
+                if(record.Color != ConsoleColor::Normal) {
+                    text += GetColorCode(record.Color);
+                }
+                text += record.Text;
+                text += '\n';
+                if(record.Color != ConsoleColor::Normal) {
+                    text += GetColorCode(ConsoleColor::Normal);
+                }
+            }
+            fwrite(text.data(), 1, text.size(), stdout);
+        }
 #endif
+
+        // Records queued together are always printed together.
+        struct LogBatch {
+            LogBatch* Next = nullptr;
+            std::vector<LogRecord> Records;
+        };
+
+        // Prints batches queued by any thread on its own thread.
+        // Batches are pushed onto a lock free list, the writer takes the whole list at once and prints it in the
+        // order it was queued. Logs from one thread are always printed in the order they were made. The mutex is
+        // only taken to put the writer to sleep and wake it (or a thread flushing) up again.
+        class LogWriter {
+        public:
+            LogWriter()
+            : m_Thread([this]() { Run(); }) {
+            }
+
+            ~LogWriter() {
+                m_Stopping = true;
+                // An empty batch wakes the writer up so it sees it's stopping.
+                Push({});
+                m_Thread.join();
+            }
+
+            void Push(std::vector<LogRecord>&& records) {
+                LogBatch* batch = new LogBatch { nullptr, std::move(records) };
+                m_Pushed.fetch_add(1, std::memory_order_relaxed);
+
+                LogBatch* head = m_Head.load(std::memory_order_relaxed);
+                do {
+                    batch->Next = head;
+                } while(!m_Head.compare_exchange_weak(head, batch, std::memory_order_release, std::memory_order_relaxed));
+
+                if(head == nullptr) {
+                    // The writer only waits once it has emptied the list. Locking makes sure it isn't between
+                    // seeing an empty list and going to sleep, where it would miss the notify.
+                    std::lock_guard<std::mutex> lock(m_Mutex);
+                    m_BatchPushed.notify_one();
+                }
+            }
+
+            void Flush() {
+                uint64_t const pushed = m_Pushed.load(std::memory_order_relaxed);
+                std::unique_lock<std::mutex> lock(m_Mutex);
+                m_BatchesWritten.wait(lock, [this, pushed]() { return m_Written >= pushed; });
+            }
+
+        private:
+            void Run() {
+                while(true) {
+                    {
+                        std::unique_lock<std::mutex> lock(m_Mutex);
+                        m_BatchPushed.wait(lock, [this]() { return m_Head.load(std::memory_order_acquire) != nullptr; });
+                    }
+                    LogBatch* batch = m_Head.exchange(nullptr, std::memory_order_acquire);
+
+                    // The list is newest first.
+                    LogBatch* oldest = nullptr;
+                    uint64_t count = 0;
+                    while(batch != nullptr) {
+                        LogBatch* next = batch->Next;
+                        batch->Next = oldest;
+                        oldest = batch;
+                        batch = next;
+                        ++count;
+                    }
+
+                    for(batch = oldest; batch != nullptr; ) {
+                        WriteRecords(batch->Records);
+                        LogBatch* next = batch->Next;
+                        delete batch;
+                        batch = next;
+                    }
+                    fflush(stdout);
+
+                    {
+                        std::lock_guard<std::mutex> lock(m_Mutex);
+                        m_Written += count;
+                    }
+                    m_BatchesWritten.notify_all();
+
+                    if(m_Stopping && m_Head.load(std::memory_order_acquire) == nullptr) {
+                        return;
+                    }
+                }
+            }
+
+            std::atomic<LogBatch*> m_Head = nullptr;
+            std::atomic<uint64_t> m_Pushed = 0;
+            std::atomic<bool> m_Stopping = false;
+
+            std::mutex m_Mutex;
+            std::condition_variable m_BatchPushed;
+            std::condition_variable m_BatchesWritten;
+            // Guarded by m_Mutex.
+            uint64_t m_Written = 0;
+            std::thread m_Thread;
+        };
+
+        LogWriter& GetWriter() {
+            // Destroyed when esd exits, after printing whatever is left.
+            static LogWriter s_Writer;
+            return s_Writer;
+        }
+
+        // When a GroupScope is active on this thread logs are collected here instead of printed.
+        thread_local std::vector<LogRecord>* s_Group = nullptr;
+
+        std::string FormatV(char const* format, va_list args) {
+            va_list argsCopy;
+            va_copy(argsCopy, args);
+            int const length = vsnprintf(nullptr, 0, format, argsCopy);
+            va_end(argsCopy);
+
+            if(length <= 0) {
+                return {};
+            }
+            std::string text(static_cast<size_t>(length), '\0');
+            vsnprintf(text.data(), text.size() + 1, format, args);
+            return text;
+        }
+
+        void Queue(LogRecord&& record) {
+            if(s_Group != nullptr) {
+                s_Group->push_back(std::move(record));
+                return;
+            }
+            std::vector<LogRecord> records;
+            records.push_back(std::move(record));
+            GetWriter().Push(std::move(records));
+        }
+
+        void Emit(ConsoleColor color, char const* prefix, char const* format, va_list args) {
+            Queue({ color, GetIndentation() + prefix + FormatV(format, args) });
+        }
+    }
+
+    bool TryParseLogLevel(char const* text, LogLevel& level) {
+        if(std::strcmp(text, "quiet") == 0) {
+            level = LogLevel::Quiet;
+        } else if(std::strcmp(text, "summary") == 0) {
+            level = LogLevel::Summary;
+        } else if(std::strcmp(text, "normal") == 0) {
+            level = LogLevel::Normal;
+        } else if(std::strcmp(text, "verbose") == 0) {
+            level = LogLevel::Verbose;
+        } else {
+            return false;
+        }
+        return true;
     }
 
     void AppendFileDetails(std::ostream& os, std::filesystem::path const& path)
@@ -80,52 +272,56 @@ namespace Logging {
     }
 
     void LogWork(char const* format, ...) {
-        std::cout << GetIndentation();
-        va_list args;
-        va_start(args, format);
-        vprintf(format, args);
-        va_end(args);
-        std::cout << std::endl;
+        if(IsEnabled(LogLevel::Normal)) {
+            va_list args;
+            va_start(args, format);
+            Emit(ConsoleColor::Normal, "", format, args);
+            va_end(args);
+        }
     }
 
     void LogWarning(char const* format, ...) {
-        SetConsoleColor(ConsoleColor::Yellow);
-        std::cout << GetIndentation() << "Warning: ";
-        va_list args;
-        va_start(args, format);
-        vprintf(format, args);
-        va_end(args);
-        std::cout << std::endl;
-        SetConsoleColor(ConsoleColor::Normal);
+        if(IsEnabled(LogLevel::Summary)) {
+            va_list args;
+            va_start(args, format);
+            Emit(ConsoleColor::Yellow, "Warning: ", format, args);
+            va_end(args);
+        }
     }
 
     void LogError(char const* format, ...) {
-        SetConsoleColor(ConsoleColor::Red);
-        std::cout << GetIndentation() << "Error: ";
         va_list args;
         va_start(args, format);
-        vprintf(format, args);
+        Emit(ConsoleColor::Red, "Error: ", format, args);
         va_end(args);
-        std::cout << std::endl;
-        SetConsoleColor(ConsoleColor::Normal);
     }
 
     void LogWorkVerbose(char const* format, ...) {
-        if(g_Verbose) {
-            SetConsoleColor(ConsoleColor::Cyan);
-            std::cout << GetIndentation();
+        if(IsEnabled(LogLevel::Verbose)) {
             va_list args;
             va_start(args, format);
-            vprintf(format, args);
+            Emit(ConsoleColor::Cyan, "", format, args);
             va_end(args);
-            std::cout << std::endl;
-            SetConsoleColor(ConsoleColor::Normal);
         }
     }
 
-    JobScope::JobScope(char const* jobName) {
-        if(s_Indentation == 0) {
-            std::cout << "============================== " << jobName << std::endl;
+    void LogSummary(char const* format, ...) {
+        if(IsEnabled(LogLevel::Summary)) {
+            va_list args;
+            va_start(args, format);
+            Emit(ConsoleColor::Normal, "", format, args);
+            va_end(args);
+        }
+    }
+
+    void Flush() {
+        GetWriter().Flush();
+    }
+
+    JobScope::JobScope(char const* jobName)
+    : m_Span(jobName, "job") {
+        if(s_Indentation == 0 && IsEnabled(LogLevel::Normal)) {
+            Queue({ ConsoleColor::Normal, std::string("============================== ") + jobName });
         }
         ++s_Indentation;
     }
@@ -134,4 +330,54 @@ namespace Logging {
         --s_Indentation;
     
     }
+
+    void JobScope::SetBytes(uint64_t bytes) {
+        m_Span.SetBytes(bytes);
+    }
+
+    size_t GetIndentationLevel() {
+        return s_Indentation;
+    }
+
+    LogBuffer::LogBuffer() = default;
+    LogBuffer::~LogBuffer() = default;
+    LogBuffer::LogBuffer(LogBuffer&& other) noexcept = default;
+    LogBuffer& LogBuffer::operator=(LogBuffer&& other) noexcept = default;
+
+    void LogBuffer::Print() {
+        if(!m_Records.empty()) {
+            GetWriter().Push(std::move(m_Records));
+            m_Records.clear();
+        }
+    }
+
+    GroupScope::GroupScope(size_t indentationLevel)
+    : m_PreviousIndentation(s_Indentation)
+    , m_PreviousGroup(s_Group) {
+        s_Indentation = indentationLevel;
+        s_Group = &m_Records;
+    }
+
+    GroupScope::GroupScope(size_t indentationLevel, LogBuffer& buffer)
+    : m_PreviousIndentation(s_Indentation)
+    , m_PreviousGroup(s_Group)
+    , m_Buffer(&buffer) {
+        s_Indentation = indentationLevel;
+        s_Group = &buffer.m_Records;
+    }
+
+    GroupScope::~GroupScope() {
+        s_Indentation = m_PreviousIndentation;
+        s_Group = m_PreviousGroup;
+
+        if(m_Buffer != nullptr || m_Records.empty()) {
+            return;
+        }
+        if(s_Group != nullptr) {
+            // Nested groups simply fold into the outer group.
+            s_Group->insert(s_Group->end(), std::make_move_iterator(m_Records.begin()), std::make_move_iterator(m_Records.end()));
+            return;
+        }
+        GetWriter().Push(std::move(m_Records));
+    }
 }
@@ -1,12 +1,45 @@
 #pragma once
 
+#include "Profiler.h"
+
 #include <filesystem>
 #include <ostream>
+#include <vector>
+
+/**************************************************************************************************
+Logging:
+    Logs are formatted on the thread that makes them and handed to a single writer thread, which
+    prints them in batches. Rendering never waits on the console.
+
+    Each thread queues its logs without locking. Logs made while a GroupScope is active are
+    queued as one batch when it ends, so a page's logs are always printed together even while
+    pages render concurrently.
 
-// Header for all logging and assertions
+    Logs are filtered by g_LogLevel before they're formatted:
+        Quiet:   errors only.
+        Summary: errors, warnings and the summary of each build.
+        Normal:  everything except verbose logs (the default).
+        Verbose: everything (-v).
+**************************************************************************************************/
 namespace Logging {
 
-    extern bool g_Verbose;
+    enum class LogLevel {
+        Quiet,
+        Summary,
+        Normal,
+        Verbose
+    };
+
+    // Set with -v or --log=<level> on the command line.
+    extern LogLevel g_LogLevel;
+
+    inline bool IsEnabled(LogLevel level) { return level <= g_LogLevel; }
+    inline bool IsVerbose() { return IsEnabled(LogLevel::Verbose); }
+
+    // Parses "quiet", "summary", "normal" or "verbose". Returns false for anything else.
+    bool TryParseLogLevel(char const* text, LogLevel& level);
+
+    struct LogRecord;
 
     // A logging helper to append details to a stringstream regarding a path. Example:
     // "\tCurrent working directory: /a/b/c\n"
@@ -20,10 +53,61 @@ namespace Logging {
 
     void LogWorkVerbose(char const* format, ...);
 
+    // The outcome of a build (pages rendered, time taken...). Printed at the summary level and above.
+    void LogSummary(char const* format, ...);
+
+    // Blocks until everything logged so far (by any thread) has been printed.
+    void Flush();
+
     // Writes a high visibility log regarding a job starting and stopping, controlled by the scope of the JobScope.
     // Will increase indentation for other logs.
+    // When profiling the job is recorded as a span, see Profiler.h.
     struct JobScope {
         JobScope(char const* jobName);
         ~JobScope();
+
+        // The number of bytes the job worked on, recorded with its span.
+        void SetBytes(uint64_t bytes);
+
+    private:
+        Profiler::Span m_Span;
+    };
+
+    // The current thread's indentation, so work handed to another thread can log at the same depth.
+    size_t GetIndentationLevel();
+
+    // Logs for one piece of work that moves between threads (ie: a page going through the render pipeline).
+    // Each thread collects into it with a GroupScope, Print() prints everything collected as one block.
+    class LogBuffer {
+    public:
+        LogBuffer();
+        ~LogBuffer();
+
+        LogBuffer(LogBuffer&& other) noexcept;
+        LogBuffer& operator=(LogBuffer&& other) noexcept;
+
+        void Print();
+
+    private:
+        friend struct GroupScope;
+        std::vector<LogRecord> m_Records;
+    };
+
+    // Collects every log made on the current thread while in scope and prints them as one uninterrupted
+    // block when the scope ends. Used to keep each page's logs together while pages render concurrently.
+    // Given a LogBuffer the logs are collected into it instead and left for LogBuffer::Print().
+    struct GroupScope {
+        GroupScope(size_t indentationLevel);
+        GroupScope(size_t indentationLevel, LogBuffer& buffer);
+        ~GroupScope();
+
+        GroupScope(GroupScope const&)            = delete;
+        GroupScope& operator=(GroupScope const&) = delete;
+
+    private:
+        size_t m_PreviousIndentation;
+        std::vector<LogRecord>* m_PreviousGroup;
+        std::vector<LogRecord> m_Records;
+        LogBuffer* m_Buffer = nullptr;
     };
 }
@@ -0,0 +1,244 @@
+#include "PageProgram.h"
+
+#include "BinaryFile.h"
+#include "Hash.h"
+#include "Logging.h"
+#include "Paths.h"
+#include "Profiler.h"
+#include "RenderStages.h"
+#include "VarsCollection.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string_view>
+
+PageProgramOptions g_PageProgramOptions;
+
+namespace {
+    constexpr char k_ProgramMagic[8] = { 'E', 'S', 'D', 'P', 'A', 'G', 'E', '1' };
+    // Reads back differently on a machine with the other byte order.
+    constexpr uint32_t k_ByteOrderMark = 0x01020304;
+
+    struct Header {
+        char Magic[8];
+        uint32_t ByteOrder;
+        int32_t IncludesProcessed;
+        // The stamp of the page's source.
+        int64_t Time;
+        int64_t Size;
+        uint64_t BytesIn;
+        int32_t VariablesDeclared;
+        int32_t InlineSubstitutions;
+        uint64_t ComponentCount;
+        uint64_t ErrorCount;
+        uint64_t InvalidCount;
+        uint64_t SegmentCount;
+        uint64_t TextSize;
+    };
+
+    struct Stamp {
+        int64_t Time;
+        int64_t Size;
+    };
+
+    struct Segment {
+        uint64_t Size;
+        uint32_t Type;
+        uint32_t Padding;
+    };
+
+    // Reads count strings into strings. Returns false if they don't fit.
+    bool ReadStrings(BinaryFile::Reader& reader, uint64_t count, std::vector<std::string>& strings) {
+        for(uint64_t i = 0; i < count; ++i) {
+            std::string text;
+            if(!reader.ReadString(text)) {
+                return false;
+            }
+            strings.push_back(std::move(text));
+        }
+        return true;
+    }
+}
+
+namespace PagePrograms {
+    std::filesystem::path GetPath(std::filesystem::path const& sitePathRelative) {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.esdpage", static_cast<unsigned long long>(HashBytes(sitePathRelative.generic_string())));
+        return GetPageProgramPath() / name;
+    }
+
+    void Compile(std::vector<Token> const& tokens, VarsCollection const& inlineVariables, PageProgram& program) {
+        // Inline variables are the innermost scope, whatever they hold wins over Vars.txt, so they're substituted now.
+        std::vector<Token> segments;
+        segments.reserve(tokens.size());
+        for(Token const& token : tokens) {
+            switch(token.TokenType) {
+                case Token::Type::Literal:
+                    segments.push_back(token);
+                    break;
+                case Token::Type::Declaration:
+                    if(token.Center.find_first_of('=') == std::string_view::npos) {
+                        program.InvalidDeclarations.emplace_back(token.Center);
+                    }
+                    break;
+                case Token::Type::Substitution: {
+                    std::optional<std::string_view> const value = token.Symbol != k_NoSymbol
+                        ? inlineVariables.TryGetVariable(token.Symbol)
+                        : inlineVariables.TryGetVariable(token.Center);
+                    if(value.has_value()) {
+                        segments.push_back({Token::Type::Literal, value.value(), {}});
+                        ++program.InlineSubstitutions;
+                    } else {
+                        segments.push_back({Token::Type::Substitution, token.Center, token.Center, token.Symbol});
+                    }
+                    break;
+                }
+                default:
+                    // Includes were already expanded.
+                    break;
+            }
+        }
+
+        size_t size = 0;
+        for(Token const& segment : segments) {
+            size += segment.Text.size();
+        }
+
+        // Copy everything together, joining literals.
+        std::unique_ptr<char[]> buffer(new char[size]);
+        size_t offset = 0;
+        program.Segments.reserve(segments.size());
+        for(Token const& segment : segments) {
+            if(segment.Text.empty() && segment.TokenType == Token::Type::Literal) {
+                continue;
+            }
+            std::memcpy(buffer.get() + offset, segment.Text.data(), segment.Text.size());
+            std::string_view const text(buffer.get() + offset, segment.Text.size());
+            offset += text.size();
+
+            if(segment.TokenType == Token::Type::Literal && !program.Segments.empty() && program.Segments.back().TokenType == Token::Type::Literal) {
+                Token& previous = program.Segments.back();
+                previous.Text = std::string_view(previous.Text.data(), previous.Text.size() + text.size());
+                continue;
+            }
+            program.Segments.push_back({segment.TokenType, text, segment.TokenType == Token::Type::Substitution ? text : std::string_view(), segment.Symbol});
+        }
+        program.Text.Adopt(std::move(buffer), size);
+    }
+
+    std::string Serialize(PageProgram const& program, std::filesystem::path const& sitePathRelative, FileStamp const& sourceStamp, StampFunction const& getStamp) {
+        std::string_view const text = program.Text.GetText();
+
+        Header header {};
+        std::memcpy(header.Magic, k_ProgramMagic, sizeof(k_ProgramMagic));
+        header.ByteOrder = k_ByteOrderMark;
+        header.IncludesProcessed = program.IncludesProcessed;
+        header.Time = sourceStamp.Time;
+        header.Size = sourceStamp.Size;
+        header.BytesIn = program.BytesIn;
+        header.VariablesDeclared = program.VariablesDeclared;
+        header.InlineSubstitutions = program.InlineSubstitutions;
+        header.ComponentCount = program.Components.size();
+        header.ErrorCount = program.IncludeErrors.size();
+        header.InvalidCount = program.InvalidDeclarations.size();
+        header.SegmentCount = program.Segments.size();
+        header.TextSize = text.size();
+
+        std::string data;
+        data.reserve(sizeof(Header) + program.Segments.size() * sizeof(Segment) + text.size() + 256);
+        BinaryFile::Append(data, header);
+        BinaryFile::AppendString(data, sitePathRelative.generic_string());
+        for(std::filesystem::path const& component : program.Components) {
+            FileStamp const stamp = getStamp(component);
+            BinaryFile::Append(data, Stamp { stamp.Time, stamp.Size });
+            BinaryFile::AppendString(data, component.generic_string());
+        }
+        for(std::string const& error : program.IncludeErrors) {
+            BinaryFile::AppendString(data, error);
+        }
+        for(std::string const& declaration : program.InvalidDeclarations) {
+            BinaryFile::AppendString(data, declaration);
+        }
+        for(Token const& token : program.Segments) {
+            BinaryFile::Append(data, Segment { token.Text.size(), static_cast<uint32_t>(token.TokenType), 0 });
+        }
+        data.append(text);
+        return data;
+    }
+
+    std::unique_ptr<PageProgram const> TryOpen(MappedFile file, std::filesystem::path const& sitePathRelative, FileStamp const& sourceStamp, StampFunction const& getStamp) {
+        auto span = Profiler::Span("Open Page Program", "page");
+        span.SetPath(sitePathRelative);
+
+        auto program = std::make_unique<PageProgram>();
+        program->Text = std::move(file);
+        std::string_view const data = program->Text.GetText();
+
+        BinaryFile::Reader reader(data);
+        Header header {};
+        if(!reader.Read(header) || std::memcmp(header.Magic, k_ProgramMagic, sizeof(k_ProgramMagic)) != 0 || header.ByteOrder != k_ByteOrderMark) {
+            return nullptr;
+        }
+        std::string storedPath;
+        if(!reader.ReadString(storedPath) || storedPath != sitePathRelative.generic_string()) {
+            // Another page with the same hash.
+            return nullptr;
+        }
+        if(sourceStamp != FileStamp { header.Time, header.Size }) {
+            return nullptr;
+        }
+
+        // Stamps are checked as they're read, so an out of date program stops at the first component that changed.
+        for(uint64_t i = 0; i < header.ComponentCount; ++i) {
+            Stamp stamp {};
+            std::string component;
+            if(!reader.Read(stamp) || !reader.ReadString(component)) {
+                Logging::LogWarning("Ignoring the program of %s, it's malformed.", sitePathRelative.string().c_str());
+                return nullptr;
+            }
+            std::filesystem::path componentPath = std::filesystem::path(component).make_preferred();
+            if(getStamp(componentPath) != FileStamp { stamp.Time, stamp.Size }) {
+                return nullptr;
+            }
+            program->Components.push_back(std::move(componentPath));
+        }
+
+        std::vector<Segment> segments;
+        bool fits = ReadStrings(reader, header.ErrorCount, program->IncludeErrors)
+            && ReadStrings(reader, header.InvalidCount, program->InvalidDeclarations)
+            && header.SegmentCount <= reader.GetRemainder().size() / sizeof(Segment);
+        if(fits) {
+            segments.resize(static_cast<size_t>(header.SegmentCount));
+            for(Segment& segment : segments) {
+                reader.Read(segment);
+            }
+        }
+
+        // The segments have to cover the text exactly.
+        std::string_view const text = reader.GetRemainder();
+        size_t offset = 0;
+        program->Segments.reserve(segments.size());
+        for(size_t i = 0; fits && i < segments.size(); ++i) {
+            Segment const& segment = segments[i];
+            Token::Type const type = static_cast<Token::Type>(segment.Type);
+            fits = (type == Token::Type::Literal || type == Token::Type::Substitution) && segment.Size <= text.size() - offset;
+            if(fits) {
+                std::string_view const segmentText = text.substr(offset, static_cast<size_t>(segment.Size));
+                program->Segments.push_back({type, segmentText, type == Token::Type::Substitution ? segmentText : std::string_view()});
+                offset += segmentText.size();
+            }
+        }
+        if(!fits || offset != text.size() || header.TextSize != text.size()) {
+            Logging::LogWarning("Ignoring the program of %s, it's malformed.", sitePathRelative.string().c_str());
+            return nullptr;
+        }
+
+        RenderStages::ResolveSymbols(program->Segments);
+        program->BytesIn = header.BytesIn;
+        program->IncludesProcessed = header.IncludesProcessed;
+        program->VariablesDeclared = header.VariablesDeclared;
+        program->InlineSubstitutions = header.InlineSubstitutions;
+        span.SetBytes(data.size());
+        return program;
+    }
+}
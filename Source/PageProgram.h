@@ -0,0 +1,83 @@
+#pragma once
+
+#include "BuildManifest.h"
+#include "FileIO.h"
+#include "Scanner.h"
+
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+class VarsCollection;
+
+/**************************************************************************************************
+Page Programs:
+    A page compiled down to what rendering it again takes when only Vars.txt changed: its text
+    with every include expanded and every substitution of an inline variable already made,
+    split into literals and the substitutions still left to Vars.txt. Rendering a program is
+    one pass of SubstituteVariables (see RenderPageProgram in Render.h), nothing is scanned and
+    no components are loaded.
+
+    Programs are kept in .esd/pages, one per page that reads Vars.txt (pages that don't are only
+    rendered again when their source or components change). A program records the stamps of the
+    page's source and of every component it included and is only used while they all match.
+
+    File layout (native byte order, the header records it):
+        Header
+        uint64 + char[]                         the page, relative to Private/Site
+        Stamp + uint64 + char[]  [Components]   every component the page included (missing ones too)
+        uint64 + char[]          [Errors]       include errors, logged again when rendered
+        uint64 + char[]          [Invalid]      invalid inline declarations, warned about again
+        Segment[Segments]
+        char[]                                  the text of every segment in order. For substitutions
+                                                it's the variable's name.
+**************************************************************************************************/
+struct PageProgram {
+    // Literals (neighbouring ones merged) and substitutions of variables the page doesn't declare. They point into Text.
+    std::vector<Token> Segments;
+    // The text of every segment, copied together (or the program's file).
+    MappedFile Text;
+    std::vector<std::filesystem::path> Components;
+    // Errors found while expanding the page's includes.
+    std::vector<std::string> IncludeErrors;
+    // The centers of inline declarations without a value.
+    std::vector<std::string> InvalidDeclarations;
+    // Size of the page's source.
+    uint64_t BytesIn = 0;
+    int IncludesProcessed = 0;
+    int VariablesDeclared = 0;
+    // Substitutions of inline variables, made when the page was compiled.
+    int InlineSubstitutions = 0;
+};
+
+struct PageProgramOptions {
+    // Pages that read Vars.txt are compiled while they're rendered and their programs saved.
+    bool Save = false;
+    // Pages with an up to date program are rendered from it instead of their source.
+    bool Load = false;
+};
+
+// Set by esd (--rebuild turns Load off). Both are off by default, so nothing else writes to .esd.
+extern PageProgramOptions g_PageProgramOptions;
+
+namespace PagePrograms {
+    // Returns the current stamp of a component file.
+    using StampFunction = std::function<FileStamp(std::filesystem::path const&)>;
+
+    // Where the program of a page (relative to Private/Site) is kept.
+    std::filesystem::path GetPath(std::filesystem::path const& sitePathRelative);
+
+    // Compiles the tokens of a page whose includes were expanded and whose inline variables are inlineVariables into
+    // program. Fills in Segments, Text, InlineSubstitutions and InvalidDeclarations, the rest is up to the caller.
+    void Compile(std::vector<Token> const& tokens, VarsCollection const& inlineVariables, PageProgram& program);
+
+    // The program of a page (relative to Private/Site) as it's saved, stamped with sourceStamp and the stamp getStamp
+    // gives each component.
+    std::string Serialize(PageProgram const& program, std::filesystem::path const& sitePathRelative, FileStamp const& sourceStamp, StampFunction const& getStamp);
+
+    // Reads a saved program (the contents of file) if this version of esd saved it for the page, its source still
+    // matches sourceStamp and every component still matches getStamp. Returns nullptr otherwise.
+    std::unique_ptr<PageProgram const> TryOpen(MappedFile file, std::filesystem::path const& sitePathRelative, FileStamp const& sourceStamp, StampFunction const& getStamp);
+}
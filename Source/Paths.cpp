@@ -6,6 +6,12 @@ static std::filesystem::path s_PrivatePath("./Private");
 static std::filesystem::path s_SitePath("./Private/Site");
 static std::filesystem::path s_ComponentPath("./Private/Components");
 static std::filesystem::path s_VarsPath("./Vars.txt");
+static std::filesystem::path s_CachePath("./.esd");
+static std::filesystem::path s_ManifestPath("./.esd/manifest.txt");
+static std::filesystem::path s_VarsSnapshotPath("./.esd/Vars.esdvars");
+static std::filesystem::path s_ComponentSnapshotPath("./.esd/components");
+static std::filesystem::path s_PageProgramPath("./.esd/pages");
+static std::filesystem::path s_VariantCachePath("./.esd/variants");
 
 std::filesystem::path const& GetPublicPath() {
     return s_PublicPath.make_preferred();
@@ -26,3 +32,31 @@ std::filesystem::path const& GetComponentPath() {
 std::filesystem::path const& GetVarsPath() {
     return s_VarsPath.make_preferred();
 }
+
+std::filesystem::path const& GetCachePath() {
+    return s_CachePath.make_preferred();
+}
+
+std::filesystem::path const& GetManifestPath() {
+    return s_ManifestPath.make_preferred();
+}
+
+std::filesystem::path const& GetVarsSnapshotPath() {
+    return s_VarsSnapshotPath.make_preferred();
+}
+
+std::filesystem::path const& GetComponentSnapshotPath() {
+    return s_ComponentSnapshotPath.make_preferred();
+}
+
+std::filesystem::path const& GetPageProgramPath() {
+    return s_PageProgramPath.make_preferred();
+}
+
+std::filesystem::path GetVariantManifestPath(std::string const& name) {
+    return s_VariantCachePath.make_preferred() / name / "manifest.txt";
+}
+
+std::filesystem::path GetVariantVarsSnapshotPath(std::string const& name) {
+    return s_VariantCachePath.make_preferred() / name / "Vars.esdvars";
+}
\ No newline at end of file
@@ -1,9 +1,22 @@
 #pragma once
 
 #include <filesystem>
+#include <string>
 
 std::filesystem::path const& GetPublicPath();
 std::filesystem::path const& GetPrivatePath();
 std::filesystem::path const& GetSitePath();
 std::filesystem::path const& GetComponentPath();
-std::filesystem::path const& GetVarsPath();
\ No newline at end of file
+std::filesystem::path const& GetVarsPath();
+// Where esd keeps data between runs (such as the build manifest). Never published.
+std::filesystem::path const& GetCachePath();
+std::filesystem::path const& GetManifestPath();
+// The compiled copy of Vars.txt, see VarsSnapshot.h.
+std::filesystem::path const& GetVarsSnapshotPath();
+// Where expanded components are kept, see ComponentSnapshot.h.
+std::filesystem::path const& GetComponentSnapshotPath();
+// Where compiled pages are kept, see PageProgram.h.
+std::filesystem::path const& GetPageProgramPath();
+// The manifest and compiled vars of the named variant of a variant build, see Variants.h.
+std::filesystem::path GetVariantManifestPath(std::string const& name);
+std::filesystem::path GetVariantVarsSnapshotPath(std::string const& name);
\ No newline at end of file
@@ -0,0 +1,197 @@
+#include "Profiler.h"
+
+#include "Json.h"
+#include "Logging.h"
+
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace Profiler {
+    namespace {
+        struct Event {
+            char const* Name;
+            char const* Category;
+            // Microseconds since Start().
+            double Start;
+            double Duration;
+            std::string Path;
+            std::string Page;
+            int64_t Bytes;
+            uint64_t Syscalls;
+        };
+
+        // Each thread records into its own list so spans on different threads never contend.
+        struct ThreadEvents {
+            uint32_t ThreadId = 0;
+            std::mutex Mutex;
+            std::vector<Event> Events;
+        };
+
+        bool s_Enabled = false;
+        std::filesystem::path s_OutputPath;
+        std::chrono::steady_clock::time_point s_Epoch;
+
+        std::mutex s_ThreadsMutex;
+        std::vector<std::unique_ptr<ThreadEvents>> s_Threads;
+
+        thread_local ThreadEvents* s_ThreadEvents = nullptr;
+        thread_local std::string const* s_Page = nullptr;
+        thread_local uint64_t s_Syscalls = 0;
+
+        ThreadEvents& GetThreadEvents() {
+            if(s_ThreadEvents == nullptr) {
+                std::lock_guard<std::mutex> lock(s_ThreadsMutex);
+                s_Threads.push_back(std::make_unique<ThreadEvents>());
+                s_Threads.back()->ThreadId = static_cast<uint32_t>(s_Threads.size() - 1);
+                s_ThreadEvents = s_Threads.back().get();
+            }
+            return *s_ThreadEvents;
+        }
+
+        double MicrosecondsSinceStart(std::chrono::steady_clock::time_point time) {
+            return std::chrono::duration<double, std::micro>(time - s_Epoch).count();
+        }
+    }
+
+    void Start(std::filesystem::path const& outputPath) {
+        s_OutputPath = outputPath;
+        s_Epoch = std::chrono::steady_clock::now();
+        s_Enabled = true;
+        // The thread that starts profiling is the main thread, make sure it's listed first.
+        GetThreadEvents();
+    }
+
+    bool IsEnabled() {
+        return s_Enabled;
+    }
+
+    void Save() {
+        if(!s_Enabled) {
+            return;
+        }
+
+        std::ofstream file(s_OutputPath, std::ios::out | std::ios::binary | std::ios::trunc);
+        if(!file.is_open()) {
+            Logging::LogError("Could not open profile output for writing: %s", s_OutputPath.string().c_str());
+            return;
+        }
+
+        file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        bool first = true;
+
+        std::lock_guard<std::mutex> threadsLock(s_ThreadsMutex);
+        for(std::unique_ptr<ThreadEvents> const& thread : s_Threads) {
+            std::lock_guard<std::mutex> lock(thread->Mutex);
+
+            file << (first ? "" : ",\n");
+            first = false;
+            std::string const threadName = thread->ThreadId == 0 ? "Main" : "Thread " + std::to_string(thread->ThreadId);
+            file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread->ThreadId << ",\"args\":{\"name\":";
+            Json::WriteString(file, threadName);
+            file << "}}";
+
+            for(Event const& event : thread->Events) {
+                file << ",\n{\"name\":";
+                Json::WriteString(file, event.Name);
+                file << ",\"cat\":";
+                Json::WriteString(file, event.Category);
+                file << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread->ThreadId
+                    << ",\"ts\":" << event.Start << ",\"dur\":" << event.Duration << ",\"args\":{";
+
+                char const* separator = "";
+                if(!event.Page.empty()) {
+                    file << separator << "\"page\":";
+                    Json::WriteString(file, event.Page);
+                    separator = ",";
+                }
+                if(!event.Path.empty()) {
+                    file << separator << "\"path\":";
+                    Json::WriteString(file, event.Path);
+                    separator = ",";
+                }
+                if(event.Bytes >= 0) {
+                    file << separator << "\"bytes\":" << event.Bytes;
+                    separator = ",";
+                }
+                if(event.Syscalls > 0) {
+                    file << separator << "\"syscalls\":" << event.Syscalls;
+                }
+                file << "}}";
+            }
+        }
+        file << "\n]}\n";
+
+        if(!file) {
+            Logging::LogError("Could not write profile output: %s", s_OutputPath.string().c_str());
+        }
+    }
+
+    void CountSyscalls(uint64_t count) {
+        s_Syscalls += count;
+    }
+
+    uint64_t GetSyscallCount() {
+        return s_Syscalls;
+    }
+
+    Span::Span(char const* name, char const* category)
+    : Span(name, category, std::chrono::steady_clock::now()) {
+    }
+
+    Span::Span(char const* name, char const* category, std::chrono::steady_clock::time_point start) {
+        if(s_Enabled) {
+            m_Name = name;
+            m_Category = category;
+            m_Start = start;
+            m_StartSyscalls = s_Syscalls;
+        }
+    }
+
+    Span::~Span() {
+        if(m_Name == nullptr) {
+            return;
+        }
+
+        auto const end = std::chrono::steady_clock::now();
+        ThreadEvents& events = GetThreadEvents();
+        std::lock_guard<std::mutex> lock(events.Mutex);
+        events.Events.push_back({
+            m_Name,
+            m_Category,
+            MicrosecondsSinceStart(m_Start),
+            std::chrono::duration<double, std::micro>(end - m_Start).count(),
+            std::move(m_Path),
+            s_Page != nullptr ? *s_Page : std::string(),
+            m_Bytes,
+            m_Syscalls >= 0 ? static_cast<uint64_t>(m_Syscalls) : s_Syscalls - m_StartSyscalls
+        });
+    }
+
+    void Span::SetPath(std::filesystem::path const& path) {
+        if(m_Name != nullptr) {
+            m_Path = path.generic_string();
+        }
+    }
+
+    void Span::SetBytes(uint64_t bytes) {
+        m_Bytes = static_cast<int64_t>(bytes);
+    }
+
+    void Span::SetSyscalls(uint64_t syscalls) {
+        m_Syscalls = static_cast<int64_t>(syscalls);
+    }
+
+    PageScope::PageScope(std::filesystem::path const& page)
+    : m_PreviousPage(s_Page) {
+        if(s_Enabled) {
+            m_Page = page.generic_string();
+            s_Page = &m_Page;
+        }
+    }
+
+    PageScope::~PageScope() {
+        s_Page = m_PreviousPage;
+    }
+}
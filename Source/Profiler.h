@@ -0,0 +1,82 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+/**************************************************************************************************
+Profiler:
+    Records timed spans and writes them as a Chrome trace (--profile out.json), which can be
+    loaded in Perfetto (https://ui.perfetto.dev) or chrome://tracing.
+
+    Every JobScope is a span. File reads and writes, component loads, asset copies and directory
+    walks add their own spans with the path and byte count they worked on. Spans recorded while
+    a PageScope is active also carry the page being rendered, so time spent in a shared
+    component can be traced back to the pages that included it.
+
+    Syscalls made by esd's own file handling are counted per thread (see CountSyscalls), every
+    span records how many were made on its thread while it was open. Each page gets a "Page"
+    span covering its whole trip through the render pipeline with the syscalls spent on it,
+    including its share of the batches it was read and written in.
+
+    Spans are kept in memory per thread and only written out by Save(). While profiling is off
+    a span costs a single branch.
+**************************************************************************************************/
+namespace Profiler {
+
+    // Turns profiling on. Save() will write everything recorded from here on to outputPath.
+    void Start(std::filesystem::path const& outputPath);
+
+    bool IsEnabled();
+
+    // Writes every span recorded so far to the path given to Start(). Safe to call more than once
+    // (each call rewrites the whole file) and while other threads are recording.
+    void Save();
+
+    // Adds count syscalls to the current thread's total. Called wherever esd makes them (opening, reading, writing,
+    // stat'ing, ...), always, so the count is right from the moment profiling starts.
+    void CountSyscalls(uint64_t count = 1);
+
+    // Every syscall counted on the current thread so far.
+    uint64_t GetSyscallCount();
+
+    // Times the enclosing scope.
+    struct Span {
+        // name and category must outlive the span (string literals).
+        Span(char const* name, char const* category);
+        // A span that started earlier, for work that wasn't one scope (ie: a page going through the pipeline).
+        Span(char const* name, char const* category, std::chrono::steady_clock::time_point start);
+        ~Span();
+
+        Span(Span const&)            = delete;
+        Span& operator=(Span const&) = delete;
+
+        void SetPath(std::filesystem::path const& path);
+        void SetBytes(uint64_t bytes);
+        // Replaces the count of syscalls made on this thread while the span was open.
+        void SetSyscalls(uint64_t syscalls);
+
+    private:
+        char const* m_Name = nullptr;
+        char const* m_Category = nullptr;
+        std::chrono::steady_clock::time_point m_Start;
+        std::string m_Path;
+        int64_t m_Bytes = -1;
+        uint64_t m_StartSyscalls = 0;
+        int64_t m_Syscalls = -1;
+    };
+
+    // Marks every span recorded on the current thread while in scope as work for page.
+    struct PageScope {
+        PageScope(std::filesystem::path const& page);
+        ~PageScope();
+
+        PageScope(PageScope const&)            = delete;
+        PageScope& operator=(PageScope const&) = delete;
+
+    private:
+        std::string const* m_PreviousPage;
+        std::string m_Page;
+    };
+}
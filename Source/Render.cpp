@@ -1,620 +1,535 @@
 #include "Render.h"
 
-#include <array>
-#include <istream>
-#include <functional>
+#include <algorithm>
+#include <cstring>
 #include <fstream>
+#include <memory>
 #include <set>
 #include <sstream>
 #include <vector>
 
+#include "BuildReport.h"
+#include "FileIO.h"
+#include "Hash.h"
+#include "PageProgram.h"
 #include "VarsCollection.h"
 #include "Paths.h"
+#include "Profiler.h"
 #include "Logging.h"
+#include "RenderStages.h"
+#include "Scanner.h"
 
 namespace {
-    using namespace std::string_view_literals;
-
-    constexpr std::string_view k_IncludeIndicator = "{include:"sv;
-    constexpr std::string_view k_VarDeclarationIndicator = "{variable:"sv;
-    constexpr std::string_view k_VarSubstitutionIndicator = "{$"sv;
+    // Tokenizes source and recursively expands every include statement in it.
+    // The page is left as tokens in expansion (literals, declarations and substitutions) pointing into source and components.
+    void RenderIncludes(std::string_view source, RenderStages::IncludeExpansion& expansion, PageRenderMetrics& metrics) {
+        auto job = Logging::JobScope("Render Includes");
 
-    constexpr std::string_view k_CapChar = "}"sv;
+        job.SetBytes(source.size());
+        metrics.BytesIn = source.size();
+        if(source.empty()) {
+            Logging::LogWarning("File appears empty.");
+        }
 
-    struct CappedSearchResult {
-        // Where does the indicator begin (example: first open curly brace character)
-        std::streamsize ResultStart = static_cast<std::streamsize>(-1);
-        // The length of the statement
-        size_t ResultSize = std::string::npos;
-        // The string between the search indicator and it's end.
-        std::string ResultCenter;
-    };
+        // The page and every component are tokenized once and includes are expanded on the tokens,
+        // so rendering costs the same no matter how deeply includes are nested.
+        std::vector<Token> tokens = Tokenize(source);
+        RenderStages::ResolveSymbols(tokens);
+        RenderStages::ExpandIncludes(tokens, expansion);
 
-    // Searches a stream for an indication (ie: "{include:"sv) and the assumed-to-be-present cap (ie: "}"sv).
-    // It's presumed that the entire statement will exist and no caps will be stranded.
-    std::vector<CappedSearchResult> FindIndicatorsWithCaps(std::istream& stream, std::string_view indicator, std::string_view cap) {
+        metrics.IncludesProcessed = expansion.IncludesProcessed;
+        Logging::LogWork("%d include%s processed", expansion.IncludesProcessed, expansion.IncludesProcessed==1?"":"s");
+    }
 
-        if(stream.fail())
-        {
-            Logging::LogError("FindIndicatorsWithCaps failed to open input stream. This is an unexpected internal error.");
-            return {};
-        }
+    std::optional<VarsCollection> ParseInlineVariables(std::vector<Token> const& tokens, PageRenderMetrics& metrics) {
+        auto job = Logging::JobScope("Variable Declaration");
 
-        if(stream.tellg() != 0)
-        {
-            Logging::LogError("FindIndicatorsWithCaps is operating with a used stream. This is an unexpected internal error.");
-            return {};
-        }
+        int& variablesDeclared = metrics.VariablesDeclared;
+        std::optional<VarsCollection> collection = RenderStages::ParseInlineVariables(tokens, variablesDeclared);
 
-        // Once C++ 20 support improves comparisons between string view and string will improve.
-        std::string const indicatorString(indicator);
-        std::string const capString(cap);
+        Logging::LogWork("%d inline variable%s declared", variablesDeclared, variablesDeclared == 1 ? "" : "s");
+        return collection;
+    }
 
-        std::vector<CappedSearchResult> results;
+    void LogSubstitutions(RenderStages::SubstitutionStats const& stats, PageRenderMetrics& metrics) {
+        metrics.VariablesSubstituted = stats.VariablesSubstituted;
+        metrics.FailedSubstitutions = stats.FailedSubstitutions;
 
-        enum class ParseState
-        {
-            SeekingIndicator,
-            SeekingCap
-        };
-
-        // How the current parsing should be interpreted.
-        ParseState state = ParseState::SeekingIndicator;
-
-        // Current char being read
-        char ch = '\0';
-
-        // How many sequential characters match the pattern we're looking for (indicator/cap)
-        size_t match = 0;
-        // Current index in the file we're evaluating
-        std::streamsize i = 0;
-        // Once we've found an indicator or a cap we track that position. This will help with replacing the entire found statement later
-        std::streamsize indicatorStart = 0;
-        std::streamsize capStart = 0;
-        // The value between the start indicator and the cap. Ie: "{example}" would store example if the indicator was '{' and the cap was '}'
-        std::string midValue;
-        size_t charsRead = 0;
-        while(stream.get(ch)) {
-            ++charsRead;
-            switch(state) {
-                case ParseState::SeekingIndicator:
-                    if(ch == indicatorString[match]) {
-                        if(match == 0) {
-                            indicatorStart = i;
-                        }
-                        match++;
-                    } else {
-                        match = 0;
-                    }
-                    if(indicatorString.size() == match) {
-                        state = ParseState::SeekingCap;
-                        match = 0;
-                    }
-                break;
-                case ParseState::SeekingCap:
-                    midValue += ch;
-                    if(ch == capString[match]) {
-                        if(match == 0) {
-                            capStart = i;
-                        }
-                        match++;
-                    } else {
-                        match = 0;
-                    }
-
-                    if(capString.size() == match) {
-                        midValue.resize(midValue.size() - cap.size());
-
-                        results.push_back({
-                            indicatorStart,
-                            static_cast<size_t>(capStart - indicatorStart)+1,
-                            midValue
-                        });
-
-                        // reset everything
-                        state = ParseState::SeekingIndicator;
-                        match = 0;
-                        indicatorStart = 0;
-                        capStart = 0;
-
-                        midValue.clear();
-                    }
-                break;
+        Logging::LogWork("%d variable%s substituted", stats.VariablesSubstituted, stats.VariablesSubstituted == 1 ? "" : "s");
+        if (stats.FailedSubstitutions > 0) {
+            std::stringstream ss;
+            for (std::string const& name : stats.FailedSubstitutionNames) {
+                ss << "'" << name << "' ";
             }
-            i++;
+            Logging::LogWarning("Variable substitution failed %d times with these variables: %s", stats.FailedSubstitutions, ss.str().c_str());
         }
+    }
 
-        if(charsRead == 0) {
-            Logging::LogWarning("File appears empty.");
-        }
+    // Returns true if any lookup had to go past the innermost scope.
+    // inlineSubstitutions (made when a page was compiled, see PageProgram.h) are counted with the rest.
+    bool SubstituteVariables(std::vector<Token> const& tokens, std::string& page, VarsScope const& scope, PageRenderMetrics& metrics, int inlineSubstitutions = 0) {
+        auto job = Logging::JobScope("Variable Substitution");
 
-        return results;
+        // Which variables came from Vars.txt is only needed for the build report.
+        std::vector<SymbolId>* const outerSymbols = BuildReport::IsEnabled() ? &metrics.OuterSymbols : nullptr;
+        RenderStages::SubstitutionStats stats = RenderStages::SubstituteVariables(tokens, page, scope, outerSymbols);
+        stats.VariablesSubstituted += inlineSubstitutions;
+        job.SetBytes(page.size());
+        LogSubstitutions(stats, metrics);
+        return stats.ReadPastFirstCollection;
     }
 
-    bool ReplaceIncludesWhileCopying(std::istream& inputStream, std::ostream& outputStream, std::vector<CappedSearchResult> const& includes, int depth) {
-        if(includes.size() == 0) {
-            return true;
-        }
-        if(inputStream.fail()) {
-            Logging::LogError("ReplaceIncludesWhileCopying failed to open input stream. This is an unexpected internal error.");
-            return false;
-        }
-        if(inputStream.tellg() != 0) {
-            Logging::LogError("ReplaceIncludesWhileCopying operating with a used input stream. This is an unexpected internal error.");
-            return false;
-        }
-        if(outputStream.fail()) {
-            Logging::LogError("ReplaceIncludesWhileCopying failed to open output stream. This is an unexpected internal error.");
-            return false;
-        }
-        if(outputStream.tellp() != 0) {
-            Logging::LogError("ReplaceIncludesWhileCopying operating with a used output stream. This is an unexpected internal error.");
-            return false;
+    // Writes the rendered page to outputPath in one go, replacing whatever was there before.
+    void WritePage(std::filesystem::path const& outputPath, std::string_view page) {
+        auto span = Profiler::Span("Write File", "io");
+        span.SetPath(outputPath);
+        span.SetBytes(page.size());
+
+        std::ofstream outputFile(outputPath, std::ios::out | std::ios::binary | std::ios::trunc);
+        if(!outputFile.is_open() || !outputFile.write(page.data(), static_cast<std::streamsize>(page.size()))) {
+            Logging::LogError("Could not open output file for writing: %s", outputPath.string().c_str());
+            throw std::runtime_error("Could not open output file for writing.");
         }
+    }
 
-        if(includes.size() != 0) {
-            // This position indicates where we are in the source file. We use this and the
-            // CappedSearchResult indicies to advance through the source file and print to the output file.
-            std::streamsize position = 0;
-            for(CappedSearchResult const& include : includes) {
-
-                // Collect all (non-include) file content from the source file.
-                for(std::streamsize i = position; i < include.ResultStart; ++i, ++position) {
-                    char ch = '\0';
-                    inputStream.get(ch);
-                    outputStream << ch;
-                }
+    // Reads a streamed page's source a chunk at a time and tokenizes it. Only the current chunk (and the start of a
+    // statement carried over from the one before) is ever in memory.
+    class ChunkedSource
+    {
+    public:
+        explicit ChunkedSource(std::filesystem::path const& path)
+        : m_Path(path)
+        , m_File(path, std::ios::in | std::ios::binary)
+        // A chunk, after at most a chunk carried over from the last one.
+        , m_Buffer(new char[k_StreamChunkSize * 2]) {
+            Profiler::CountSyscalls();
+        }
 
-                // print the entire included file to the output file.
-                auto const includePath = GetComponentPath() / include.ResultCenter;
-                
-                Logging::LogWorkVerbose("Including file: %s", includePath.string().c_str());
-
-                std::ifstream includedFile(includePath.c_str());
-                if(includedFile.is_open()) {
-                    char ch = '\0';
-                    while(includedFile.get(ch)) {
-                        outputStream << ch;
-                    }
-                } else {
-                    Logging::LogError("Include file not found: %s", includePath.string().c_str());
-                }
+        bool IsOpen() const {
+            return m_File.is_open();
+        }
 
-                // skip over the include statement itself so we don't print it in subsequent iterations.
-                // Advance position so our relative source file position is correct
-                position += include.ResultSize;
-                // Then advance the input file itself so we skil the include statement.
-                inputStream.seekg(inputStream.tellg() + static_cast<std::streampos>(include.ResultSize));
+        // Replaces tokens with those of the next chunk, which point into this until the next call.
+        // Returns false once the whole file was read, or reading it failed (see HasFailed).
+        bool Next(std::vector<Token>& tokens) {
+            tokens.clear();
+            if(m_Done) {
+                return false;
             }
 
-            // Copy the remainder of the file.
-            char ch = '\0';
-            while(inputStream.get(ch)) {
-                outputStream << ch;
+            std::memmove(m_Buffer.get(), m_Buffer.get() + m_CarriedStart, m_Carried);
+            m_File.read(m_Buffer.get() + m_Carried, static_cast<std::streamsize>(k_StreamChunkSize));
+            Profiler::CountSyscalls();
+            if(m_File.bad()) {
+                m_Done = true;
+                return false;
             }
-        }
-        else
-        {
-            Logging::LogWarning("ReplaceIncludesWhileCopying being called with no includes. This is easily handled but is an unexpected internal issue.");
-
-            // Copy with the streams rather than filesystem::copy so we don't have to close the open streams.
-            char ch = '\0';
-            while(inputStream.get(ch)) {
-                outputStream << ch;
+            size_t const read = static_cast<size_t>(m_File.gcount());
+            m_BytesRead += read;
+            m_Done = read < k_StreamChunkSize;
+
+            std::string_view const text(m_Buffer.get(), m_Carried + read);
+            size_t const tokenized = m_Tokenizer.Tokenize(text, m_Done, tokens);
+            m_CarriedStart = tokenized;
+            m_Carried = text.size() - tokenized;
+            if(m_Carried > k_StreamChunkSize) {
+                // Whatever is carried over is an unclosed statement, there's no room to wait any longer for its cap.
+                Logging::LogWarning("A statement in %s is longer than %d bytes, it's left as it is.", m_Path.string().c_str(), static_cast<int>(k_StreamChunkSize));
+                m_Tokenizer.Tokenize(text.substr(tokenized), true, tokens);
+                m_Carried = 0;
             }
+            return true;
         }
-        return true;
-    }
-
-    void RenderIncludes(std::filesystem::path const& sourcePath, std::filesystem::path const& outputPath) {
-        auto job = Logging::JobScope("Render Includes");
-        std::filesystem::path const sitePathRelative = std::filesystem::relative(sourcePath, GetSitePath());
 
-        if(std::filesystem::exists(outputPath)) {
-            Logging::LogWorkVerbose("Deleting %s", outputPath.string().c_str());
-            if(!std::filesystem::remove(outputPath)) {
-                Logging::LogError("Could not delete %s. We will attempt to continue but rendering this page is unlikely to succeed.", outputPath.string().c_str());
-            }
+        bool HasFailed() const {
+            return m_File.bad();
         }
 
-        std::fstream sourceFile(sourcePath.c_str(), std::ios::in);
-
-        if(sourceFile.fail()) {
-            Logging::LogError("Could not open the source file for reading: %s", sourcePath.string().c_str());
-            return;
+        uint64_t GetBytesRead() const {
+            return m_BytesRead;
         }
 
+    private:
+        std::filesystem::path const& m_Path;
+        std::ifstream m_File;
+        std::unique_ptr<char[]> m_Buffer;
+        size_t m_CarriedStart = 0;
+        size_t m_Carried = 0;
+        uint64_t m_BytesRead = 0;
+        bool m_Done = false;
+        StreamTokenizer m_Tokenizer;
+    };
 
-        std::vector<CappedSearchResult> results;
-
-        results = FindIndicatorsWithCaps(sourceFile, k_IncludeIndicator, k_CapChar);
-        sourceFile.clear();
-        sourceFile.seekg(0);
-
-        std::string buffer;
-        int  depth = 0;
-
-        // HACK: The way I've designed includes to work doesn't allow us to easily determine where a particular include
-        // file came from (ie: what file caused this include declaration to exist). Because of that we are limiting 
-        // the max include depth to something high that is unlikely to be hit under normal circumstances.
-        // Ideally we should just do a pre-processing pass where we create an include tree to find circular dependencies first
-        // or change the renderer design to more easily collect a stack of work it's doing.
-        constexpr int k_maxIncludeDepth = 30;
-
-        //continue to count the number of includes proccessed (to log later)
-        int includesProcessed = static_cast<int>(results.size());
-
-
-        // Only process includes if there are any, otherwise we can skip a temporary file and copy directly to output.
-        if(results.size() > 0) {
-            // we keep two temporary paths so we can ping-pong between temporary files as we process includes
-            size_t tempFileOutIndex = 0;
-            std::array<std::filesystem::path, 2> const tempPaths = {
-                std::filesystem::temp_directory_path() / sitePathRelative.parent_path() / (std::filesystem::path("0_") += (sitePathRelative.filename())),
-                std::filesystem::temp_directory_path() / sitePathRelative.parent_path() / (std::filesystem::path("1_") += (sitePathRelative.filename()))
-            };
+    // Takes a streamed page's output as it's rendered. While it matches the existing output it's only compared, so an
+    // unchanged page writes nothing. From the first difference on it goes to a temporary file next to the output
+    // (starting with the part that matched), which replaces the output once the page is done.
+    class StreamedOutput
+    {
+    public:
+        explicit StreamedOutput(std::filesystem::path const& outputPath)
+        : m_OutputPath(outputPath)
+        , m_TemporaryPath(std::filesystem::path(outputPath) += ".esd-partial")
+        , m_Existing(outputPath, std::ios::in | std::ios::binary) {
+            Profiler::CountSyscalls();
+            m_Matching = m_Existing.is_open();
+        }
 
-            for(auto const& p : tempPaths) {
-                if(std::filesystem::exists(p)) {
-                    Logging::LogWorkVerbose("Deleting %s", p.string().c_str());
-                    if(!std::filesystem::remove(p)) {
-                        Logging::LogError("Could not delete %s. We will attempt to continue but rendering this page is unlikely to succeed.", p.string().c_str());
-                    }
-                }
-                std::filesystem::create_directories(p.parent_path());
+        ~StreamedOutput() {
+            // Only left over if the page failed part way.
+            if(m_Temporary.is_open()) {
+                m_Temporary.close();
+                std::error_code error;
+                std::filesystem::remove(m_TemporaryPath, error);
             }
+        }
 
-            std::array<std::fstream, 2> tempFiles = { std::fstream(tempPaths[0], std::ios::in | std::ios::out | std::ios::trunc), std::fstream(tempPaths[1], std::ios::in | std::ios::out | std::ios::trunc) };
-
-            std::fstream* currentSourceFile = &sourceFile;
-            std::fstream* currentOutputFile = &tempFiles[tempFileOutIndex];
+        StreamedOutput(StreamedOutput const&)            = delete;
+        StreamedOutput& operator=(StreamedOutput const&) = delete;
 
-            if(currentOutputFile->fail()) {
-                Logging::LogError("Could not open temp file for writing: %s", tempPaths[tempFileOutIndex].string().c_str());
-                
-                throw std::runtime_error("Could not open temp file for writing.");
+        void Append(std::string_view text) {
+            if(m_Matching && Matches(text)) {
+                m_Matched += text.size();
+                return;
             }
+            Write(text);
+        }
 
-            // repeatedly go over the file until no includes remain
-            // (this is how we recursively collect includes)
-            while(results.size() > 0) {
-                if(!ReplaceIncludesWhileCopying(*currentSourceFile, *currentOutputFile, results, depth)) {
-                    // returning false indicates an unexpected error, stop processing.
-                    // That error should already be logged from ReplaceIncludesWhileCopying
-                    results.clear();
-                    break;
-                }
-
-                currentSourceFile->clear();
-                currentSourceFile->seekg(0);
-                currentOutputFile->clear();
-                currentOutputFile->seekp(0);
-                
-                // Begin the ping-pong between two temporary files 
-                // this also swaps between the initial source file and the first temporary file.
-                size_t const nextTempFileOutIndex = ((tempFileOutIndex + 1) % tempFiles.size());            
-                currentSourceFile = currentOutputFile;
-                currentOutputFile = &tempFiles[nextTempFileOutIndex];
-
-                // Look for more include processing to do in the new current source file 
-                // (the file we just wrote to) This allows us to recursively process includes.
-                results = FindIndicatorsWithCaps(*currentSourceFile, k_IncludeIndicator, k_CapChar);
-
-                includesProcessed += static_cast<int>(results.size());
-                
-                currentSourceFile->clear();
-                currentSourceFile->seekg(0);
-
-                // If we continue processing more results: advance the tempFileOutIndex.
-                // Otherwise we want to keep the index correct (current) for use outside this loop.
-                tempFileOutIndex = results.size() ? nextTempFileOutIndex : tempFileOutIndex;
-
-                // The include depth is to help us style/indicate include depth in the program output.
-                // Using it for the k_maxIncludeDepth is a hack. See k_maxIncludeDepth declaration.
-                if (++depth > k_maxIncludeDepth) {
-                    Logging::LogError("Max include depth of %d hit. This normally means includes are circular.", k_maxIncludeDepth);
-                    break;
-                }
+        // Returns true if the output was replaced, false if it already held exactly what was rendered.
+        bool Finish() {
+            if(m_Matching && m_Existing.peek() == std::ifstream::traits_type::eof()) {
+                return false;
             }
+            if(!m_Temporary.is_open()) {
+                StartTemporary();
+            }
+            m_Temporary.close();
+            Profiler::CountSyscalls();
+            if(!m_Temporary) {
+                Fail();
+            }
+            std::error_code error;
+            std::filesystem::rename(m_TemporaryPath, m_OutputPath, error);
+            Profiler::CountSyscalls();
+            if(error) {
+                std::filesystem::remove(m_TemporaryPath, error);
+                Fail();
+            }
+            return true;
+        }
 
-            std::filesystem::create_directories(outputPath.parent_path());
-
-            // intentionally not providing an error code param so we can handle copy errors with exceptions.
-            std::filesystem::copy(tempPaths[tempFileOutIndex], outputPath, std::filesystem::copy_options::overwrite_existing);
+    private:
+        bool Matches(std::string_view text) {
+            m_Compare.resize(text.size());
+            m_Existing.read(m_Compare.data(), static_cast<std::streamsize>(text.size()));
+            Profiler::CountSyscalls();
+            m_Matching = static_cast<size_t>(m_Existing.gcount()) == text.size() && std::string_view(m_Compare) == text;
+            return m_Matching;
+        }
 
-            for (auto& tempFile : tempFiles) {
-                tempFile.close();
+        void StartTemporary() {
+            m_Matching = false;
+            EnsureOutputDirectory(m_OutputPath.parent_path());
+            m_Temporary.open(m_TemporaryPath, std::ios::out | std::ios::binary | std::ios::trunc);
+            Profiler::CountSyscalls();
+            if(!m_Temporary.is_open()) {
+                Fail();
             }
 
-            for (std::filesystem::path const& p : tempPaths) {
-                Logging::LogWorkVerbose("Deleting %s", p.string().c_str());
-                if (!std::filesystem::remove(p)) {
-                    Logging::LogWarning("Could not delete %s.", p.string().c_str());
+            // The output so far is what the existing file starts with.
+            m_Existing.clear();
+            m_Existing.seekg(0);
+            for(uint64_t left = m_Matched; left > 0;) {
+                size_t const size = static_cast<size_t>(std::min<uint64_t>(left, k_StreamChunkSize));
+                m_Compare.resize(size);
+                m_Existing.read(m_Compare.data(), static_cast<std::streamsize>(size));
+                Profiler::CountSyscalls();
+                if(static_cast<size_t>(m_Existing.gcount()) != size) {
+                    Fail();
                 }
+                Write(m_Compare);
+                left -= size;
             }
-
-        } else {
-            std::filesystem::create_directories(outputPath.parent_path());
-            // skip making a temporary file, just copy directly to output.
-            std::filesystem::copy(sourcePath, outputPath, std::filesystem::copy_options::overwrite_existing);
+            m_Existing.close();
         }
 
-        Logging::LogWork("%d include%s processed", includesProcessed, includesProcessed==1?"":"s");
-    }
-
-    // Removes all instances of variable declarations (like: "${variable:name=value}") in the file at mutablePagePath.
-    // While doing so these variable declarations are parsed into the returned VarsCollection.
-    // If any failure occurs that can not be recovered from {} will be returned instead.
-    std::optional<VarsCollection> ParseInlineVariables(std::filesystem::path const& mutablePagePath) {
-        auto job = Logging::JobScope("Variable Declaration");
-
-        std::filesystem::path const publicPathRelative = std::filesystem::relative(mutablePagePath, GetPublicPath());
-
-        if (!std::filesystem::exists(mutablePagePath) || !std::filesystem::is_regular_file(mutablePagePath)) {
-            Logging::LogError("File not found: %s", mutablePagePath.string().c_str());
-            return {};
+        void Write(std::string_view text) {
+            if(!m_Temporary.is_open()) {
+                StartTemporary();
+            }
+            m_Temporary.write(text.data(), static_cast<std::streamsize>(text.size()));
+            Profiler::CountSyscalls();
+            if(!m_Temporary) {
+                Fail();
+            }
         }
 
-        std::fstream pageStream(mutablePagePath.c_str(), std::ios::in | std::ios::out);
-
-        if (pageStream.fail()) {
-            Logging::LogError("Could not open page file for reading: %s", mutablePagePath.string().c_str());
-            return {};
+        [[noreturn]] void Fail() {
+            Logging::LogError("Could not open output file for writing: %s", m_OutputPath.string().c_str());
+            throw std::runtime_error("Could not open output file for writing.");
         }
 
-        std::vector<CappedSearchResult> results;
-        VarsCollection collection;
-
-        results = FindIndicatorsWithCaps(pageStream, k_VarDeclarationIndicator, k_CapChar);
-        pageStream.clear();
-        pageStream.seekg(0);
-
-        int variablesDeclared = 0;
-
-        std::filesystem::path const tempPath = std::filesystem::temp_directory_path() / publicPathRelative.parent_path() / (std::filesystem::path("2_") += (publicPathRelative.filename()));
-        
-        if (results.size() > 0) {
-            if (std::filesystem::exists(tempPath)) {
-                Logging::LogWorkVerbose("Deleting %s", tempPath.string().c_str());
-                if (!std::filesystem::remove(tempPath)) {
-                    Logging::LogError("Could not delete %s. We will attempt to continue but rendering this page is unlikely to succeed.", tempPath.string().c_str());
-                }
-            }
-
-            std::filesystem::create_directories(tempPath.parent_path());
+        std::filesystem::path const& m_OutputPath;
+        std::filesystem::path const m_TemporaryPath;
+        std::ifstream m_Existing;
+        std::ofstream m_Temporary;
+        bool m_Matching = false;
+        // How much of the output matched the start of the existing file.
+        uint64_t m_Matched = 0;
+        std::string m_Compare;
+    };
+}
 
-            std::fstream tempFileStream = std::fstream(tempPath, std::ios::out | std::ios::trunc);
+uint64_t g_StreamThreshold = 64 * 1024 * 1024;
 
-            if (tempFileStream.fail()) {
-                Logging::LogError("Could not open temp file for writing: %s.", tempPath.string().c_str());
-                return {};
-            }
-
-            std::streamsize position = 0;
-            for (CappedSearchResult const& variableDeclaration : results) {
+bool ReadPageSource(std::filesystem::path const& sourcePath, std::filesystem::path const& outputPath, MappedFile& source) {
+    Logging::LogWork("Source File: %s", sourcePath.string().c_str());
+    Logging::LogWork("Output: %s", outputPath.string().c_str());
 
-                // Collect all (non-variable) file content from the source file.
-                for (std::streamsize i = position; i < variableDeclaration.ResultStart; ++i, ++position) {
-                    char ch = '\0';
-                    pageStream.get(ch);
-                    tempFileStream << ch;
-                }
+    if(!source.Open(sourcePath)) {
+        // Only a page that couldn't be read pays for finding out why.
+        std::error_code error;
+        if(!std::filesystem::is_regular_file(sourcePath, error)) {
+            Logging::LogError("File not found: %s", sourcePath.string().c_str());
+        } else {
+            Logging::LogError("Could not open the source file for reading: %s", sourcePath.string().c_str());
+        }
+        Logging::LogWork("");
+        return false;
+    }
+    source.Prefetch();
+    return true;
+}
 
-                size_t assignmentIndex = variableDeclaration.ResultCenter.find_first_of('=');
+void RenderPageOutput(std::string_view source, std::optional<VarsCollection> const& vars, std::string& output, PageRenderResult& result, PageProgram* program) {
+    RenderStages::IncludeExpansion expansion;
+    expansion.ComponentPaths = &result.Components;
+    expansion.Errors = program != nullptr ? &program->IncludeErrors : nullptr;
+    RenderIncludes(source, expansion, result.Metrics);
+
+    std::optional<VarsCollection> inlineVariables = ParseInlineVariables(expansion.Tokens, result.Metrics);
+
+    // inlineVariables are the innermost scope so they are read before the variables from Vars.txt
+    VarsScope const siteScope(vars.has_value() ? &vars.value() : nullptr);
+    VarsScope const pageScope(inlineVariables.has_value() ? &inlineVariables.value() : nullptr, &siteScope);
+
+    result.UsesVars = SubstituteVariables(expansion.Tokens, output, pageScope, result.Metrics);
+    result.Metrics.BytesOut = output.size();
+    result.OutputHash = HashBytes(output);
+    result.Rendered = true;
+
+    if(program != nullptr && result.UsesVars) {
+        PagePrograms::Compile(expansion.Tokens, inlineVariables.value(), *program);
+        program->Components.assign(result.Components.begin(), result.Components.end());
+        program->BytesIn = result.Metrics.BytesIn;
+        program->IncludesProcessed = result.Metrics.IncludesProcessed;
+        program->VariablesDeclared = result.Metrics.VariablesDeclared;
+    }
+}
 
-                if (assignmentIndex == std::string::npos) {
-                    Logging::LogWarning("Inline variable declaration is invalid: \"%s\"", variableDeclaration.ResultCenter.c_str());
-                }
-                else {
-                    std::string const key = variableDeclaration.ResultCenter.substr(0, assignmentIndex);
-                    std::string const value = variableDeclaration.ResultCenter.substr(assignmentIndex+1);
-                    collection.SetVariable(key, value);
-                    ++variablesDeclared;
-                }
+void RenderPageProgram(PageProgram const& program, std::optional<VarsCollection> const& vars, std::string& output, PageRenderResult& result, bool logCompiled) {
+    result.Metrics.BytesIn = program.BytesIn;
+    result.Metrics.IncludesProcessed = program.IncludesProcessed;
+    result.Metrics.VariablesDeclared = program.VariablesDeclared;
 
-                // Then advance the input file itself so we skip the variable declaration.
-                position += variableDeclaration.ResultSize;
-                pageStream.seekg(pageStream.tellg() + static_cast<std::streampos>(variableDeclaration.ResultSize));
+    // What the page's includes and declarations came to was worked out when it was compiled, only the logs are left.
+    if(logCompiled) {
+        Logging::LogWorkVerbose("Rendering the page's compiled program.");
+        {
+            auto job = Logging::JobScope("Render Includes");
+            job.SetBytes(program.BytesIn);
+            if(program.BytesIn == 0) {
+                Logging::LogWarning("File appears empty.");
             }
-
-            // Copy the remainder of the file.
-            char ch = '\0';
-            while (pageStream.get(ch)) {
-                tempFileStream << ch;
+            for(std::string const& error : program.IncludeErrors) {
+                Logging::LogError("%s", error.c_str());
             }
-
-            pageStream.close();
-            tempFileStream.close();
-
-            std::filesystem::copy(tempPath, mutablePagePath, std::filesystem::copy_options::overwrite_existing);
+            Logging::LogWork("%d include%s processed", program.IncludesProcessed, program.IncludesProcessed == 1 ? "" : "s");
         }
-
-        if (std::filesystem::exists(tempPath)) {
-            Logging::LogWorkVerbose("Deleting %s", tempPath.string().c_str());
-            if (!std::filesystem::remove(tempPath)) {
-                Logging::LogWarning("Could not delete %s.", tempPath.string().c_str());
+        {
+            auto job = Logging::JobScope("Variable Declaration");
+            for(std::string const& declaration : program.InvalidDeclarations) {
+                RenderStages::WarnInvalidDeclaration(declaration);
             }
+            Logging::LogWork("%d inline variable%s declared", program.VariablesDeclared, program.VariablesDeclared == 1 ? "" : "s");
         }
-
-        Logging::LogWork("%d inline variable%s declared", variablesDeclared, variablesDeclared == 1 ? "" : "s");
-        return { collection };
     }
+    result.Components.insert(program.Components.begin(), program.Components.end());
 
-    // Replaces instances of variables (like: "{$var_name}") in a file at mutablePagePath with variables from variableCollections
-    // If these variables do not exist the variable statement will be left in place to hopefully in many cases indicate clearly where a problem occured.
-    // "mutablePagePath" is named as such because the file at this path will be changed.
-    void SubstituteVariables(std::filesystem::path const& mutablePagePath, std::initializer_list<std::optional<VarsCollection>> variableCollections) {
-        auto job = Logging::JobScope("Variable Substitution");
-        std::filesystem::path const publicPathRelative = std::filesystem::relative(mutablePagePath, GetPublicPath());
-
-       if(!std::filesystem::exists(mutablePagePath) || !std::filesystem::is_regular_file(mutablePagePath)) {
-            Logging::LogError("File not found: %s", mutablePagePath.string().c_str());
-            return;
-        }
+    // The page's own variables were substituted when it was compiled. Their (now empty) layer is kept so lookups
+    // report the same layers as before.
+    VarsScope const siteScope(vars.has_value() ? &vars.value() : nullptr);
+    VarsScope const pageScope(nullptr, &siteScope);
 
-        std::fstream pageStream(mutablePagePath.c_str(), std::ios::in | std::ios::out);
+    result.UsesVars = SubstituteVariables(program.Segments, output, pageScope, result.Metrics, program.InlineSubstitutions);
+    result.Metrics.BytesOut = output.size();
+    result.OutputHash = HashBytes(output);
+    result.Rendered = true;
+}
 
-        if(pageStream.fail()) {
-            Logging::LogError("Could not open page file for reading: %s", mutablePagePath.string().c_str());
-            return;
-        }
+bool IsPageOutputUnchanged(std::filesystem::path const& outputPath, std::string_view output, uint64_t outputHash, std::optional<uint64_t> const& previousOutputHash) {
+    if(previousOutputHash.has_value()) {
+        return previousOutputHash.value() == outputHash;
+    }
 
-        std::vector<CappedSearchResult> results;
-        std::set<std::string> failedSubstitutionNames;
+    auto span = Profiler::Span("Compare Output", "io");
+    span.SetPath(outputPath);
 
-        results = FindIndicatorsWithCaps(pageStream, k_VarSubstitutionIndicator, k_CapChar);
-        pageStream.clear();
-        pageStream.seekg(0);
+    std::error_code error;
+    Profiler::CountSyscalls();
+    uintmax_t const size = std::filesystem::file_size(outputPath, error);
+    if(error || size != output.size()) {
+        return false;
+    }
+    MappedFile existing;
+    if(!existing.Open(outputPath)) {
+        return false;
+    }
+    span.SetBytes(size);
+    return existing.GetText() == output;
+}
 
-        int variablesSubstituted = 0;
-        int failedSubstitutions = 0;
+void WritePageOutput(std::filesystem::path const& outputPath, std::string_view output, std::optional<uint64_t> const& previousOutputHash, PageRenderResult& result) {
+    // Leaving identical output alone keeps its modification time, so syncing and caching see no change.
+    if(IsPageOutputUnchanged(outputPath, output, result.OutputHash, previousOutputHash)) {
+        Logging::LogWork("Output is unchanged. Skipping write step.");
+    } else {
+        EnsureOutputDirectory(outputPath.parent_path());
+        WritePage(outputPath, output);
+        result.Written = true;
+    }
+    Logging::LogWork("");
+}
 
-        std::filesystem::path const tempPath = std::filesystem::temp_directory_path() / publicPathRelative.parent_path() / (std::filesystem::path("3_") += (publicPathRelative.filename()));
+void RenderPageStreaming(std::filesystem::path const& sourcePath, std::filesystem::path const& outputPath, std::optional<VarsCollection> const& vars, PageRenderResult& result) {
+    Logging::LogWork("Rendering %d KiB at a time.", static_cast<int>(k_StreamChunkSize / 1024));
+    std::vector<Token> tokens;
 
-        // Only process includes if there are any, otherwise we can skip a temporary file and copy directly to output.
-        if(results.size() > 0) {
-            if(std::filesystem::exists(tempPath)) {
-                Logging::LogWorkVerbose("Deleting %s", tempPath.string().c_str());
-                if(!std::filesystem::remove(tempPath)) {
-                    Logging::LogError("Could not delete %s. We will attempt to continue but rendering this page is unlikely to succeed.", tempPath.string().c_str());
-                }
-            }
+    // First every declaration is collected, includes and all, since a variable can be used before it's declared.
+    // Problems with includes are logged here, the second pass finds the same ones.
+    VarsCollection inlineVariables;
+    {
+        auto job = Logging::JobScope("Variable Declaration");
 
-            std::filesystem::create_directories(tempPath.parent_path());
+        ChunkedSource source(sourcePath);
+        if(!source.IsOpen()) {
+            Logging::LogError("Could not open the source file for reading: %s", sourcePath.string().c_str());
+            return;
+        }
 
-            std::fstream tempFileStream = std::fstream(tempPath, std::ios::out | std::ios::trunc);
+        RenderStages::IncludeExpansion expansion;
+        expansion.ComponentPaths = &result.Components;
+        while(source.Next(tokens)) {
+            expansion.Tokens.clear();
+            expansion.Components.clear();
+            RenderStages::ExpandIncludes(tokens, expansion);
+            RenderStages::ParseInlineVariables(expansion.Tokens, inlineVariables, result.Metrics.VariablesDeclared);
+        }
+        if(source.HasFailed()) {
+            Logging::LogError("Could not read the source file: %s", sourcePath.string().c_str());
+            return;
+        }
 
-            if(tempFileStream.fail()) {
-                Logging::LogError("Could not open temp file for writing: %s.", tempPath.string().c_str());
-                return;
-            }
+        job.SetBytes(source.GetBytesRead());
+        result.Metrics.BytesIn = source.GetBytesRead();
+        result.Metrics.IncludesProcessed = expansion.IncludesProcessed;
+        if(source.GetBytesRead() == 0) {
+            Logging::LogWarning("File appears empty.");
+        }
+        Logging::LogWork("%d include%s processed", expansion.IncludesProcessed, expansion.IncludesProcessed == 1 ? "" : "s");
+        Logging::LogWork("%d inline variable%s declared", result.Metrics.VariablesDeclared, result.Metrics.VariablesDeclared == 1 ? "" : "s");
+    }
 
-            std::streamsize position = 0;
-            for(CappedSearchResult const& variableSubstitution : results) {
+    // Then the page is rendered and compared or written a chunk at a time.
+    {
+        auto job = Logging::JobScope("Variable Substitution");
 
-                // Collect all (non-variable) file content from the source file.
-                for(std::streamsize i = position; i < variableSubstitution.ResultStart; ++i, ++position) {
-                    char ch = '\0';
-                    pageStream.get(ch);
-                    tempFileStream << ch;
-                }
+        // inlineVariables are the innermost scope so they are read before the variables from Vars.txt
+        VarsScope const siteScope(vars.has_value() ? &vars.value() : nullptr);
+        VarsScope const pageScope(&inlineVariables, &siteScope);
+        // Which variables came from Vars.txt is only needed for the build report.
+        std::vector<SymbolId>* const outerSymbols = BuildReport::IsEnabled() ? &result.Metrics.OuterSymbols : nullptr;
 
-                std::string substitution;
-                bool valueSubstituted = false;
-                for(auto varCollection : variableCollections) {
-                    if(varCollection.has_value()) {
-                        auto var = varCollection.value().TryGetVariable(variableSubstitution.ResultCenter);
-                        if(var.has_value()) {
-                            substitution = var.value();
-                            valueSubstituted = true;
-                            // Don't continue looking at other collections once we've found a suitable variable substitution
-                            break;
-                        }
-                    }
-                }
+        ChunkedSource source(sourcePath);
+        if(!source.IsOpen()) {
+            Logging::LogError("Could not open the source file for reading: %s", sourcePath.string().c_str());
+            return;
+        }
 
-                if(valueSubstituted) {
-                    tempFileStream << substitution;
-                    variablesSubstituted++;
-                } else {
-                    tempFileStream << variableSubstitution.ResultCenter;
-                    failedSubstitutions++;
-                    failedSubstitutionNames.insert(variableSubstitution.ResultCenter);
+        StreamedOutput output(outputPath);
+        StreamHash hash;
+        RenderStages::SubstitutionStats stats;
+        RenderStages::IncludeExpansion expansion;
+        std::string chunk;
+        for(;;) {
+            {
+                // Anything logged here was logged by the first pass already.
+                Logging::LogBuffer repeated;
+                auto group = Logging::GroupScope(Logging::GetIndentationLevel(), repeated);
+                if(!source.Next(tokens)) {
+                    break;
                 }
-
-                // Then advance the input file itself so we skip to the end of the variable substitution
-                position += variableSubstitution.ResultSize;
-                pageStream.seekg(pageStream.tellg() + static_cast<std::streampos>(variableSubstitution.ResultSize));
+                RenderStages::ResolveSymbols(tokens);
+                expansion.Tokens.clear();
+                expansion.Components.clear();
+                RenderStages::ExpandIncludes(tokens, expansion);
             }
 
-            // Copy the remainder of the file.
-            char ch = '\0';
-            while(pageStream.get(ch)) {
-                tempFileStream << ch;
+            RenderStages::SubstitutionStats const chunkStats = RenderStages::SubstituteVariables(expansion.Tokens, chunk, pageScope, outerSymbols);
+            stats.VariablesSubstituted += chunkStats.VariablesSubstituted;
+            stats.FailedSubstitutions += chunkStats.FailedSubstitutions;
+            stats.FailedSubstitutionNames.insert(chunkStats.FailedSubstitutionNames.begin(), chunkStats.FailedSubstitutionNames.end());
+            stats.ReadPastFirstCollection |= chunkStats.ReadPastFirstCollection;
+            if(outerSymbols != nullptr) {
+                // Kept to one of each, a large page would otherwise collect one per substitution.
+                std::sort(outerSymbols->begin(), outerSymbols->end());
+                outerSymbols->erase(std::unique(outerSymbols->begin(), outerSymbols->end()), outerSymbols->end());
             }
 
-            pageStream.close();
-            tempFileStream.close();
-
-            std::filesystem::copy(tempPath, mutablePagePath, std::filesystem::copy_options::overwrite_existing);
+            hash.Update(chunk);
+            output.Append(chunk);
+            result.Metrics.BytesOut += chunk.size();
         }
-
-        if (std::filesystem::exists(tempPath)) {
-            Logging::LogWorkVerbose("Deleting %s", tempPath.string().c_str());
-            if (!std::filesystem::remove(tempPath)) {
-                Logging::LogWarning("Could not delete %s.", tempPath.string().c_str());
-            }
+        if(source.HasFailed()) {
+            Logging::LogError("Could not read the source file: %s", sourcePath.string().c_str());
+            return;
         }
 
-        Logging::LogWork("%d variable%s substituted", variablesSubstituted, variablesSubstituted == 1 ? "" : "s");
-        if (failedSubstitutions > 0) {
-            std::stringstream ss;
-            for (std::string const& name : failedSubstitutionNames) {
-                ss << "'" << name << "' ";
-            }
-            Logging::LogWarning("Variable substitution failed %d times with these variables: %s", failedSubstitutions, ss.str().c_str());
+        job.SetBytes(result.Metrics.BytesOut);
+        LogSubstitutions(stats, result.Metrics);
+        result.UsesVars = stats.ReadPastFirstCollection;
+        result.OutputHash = hash.GetHash();
+        result.Rendered = true;
+
+        // Leaving identical output alone keeps its modification time, so syncing and caching see no change.
+        result.Written = output.Finish();
+        if(!result.Written) {
+            Logging::LogWork("Output is unchanged. Skipping write step.");
         }
     }
 }
 
-void RenderPage(std::filesystem::path const& sourcePath, std::optional<VarsCollection> const& vars) {
+PageRenderResult RenderPage(std::filesystem::path const& sourcePath, std::optional<VarsCollection> const& vars, std::optional<uint64_t> const& previousOutputHash) {
+    PageRenderResult result;
 
-    std::filesystem::path const sitePathRelative = std::filesystem::relative(sourcePath, GetSitePath());
+    std::filesystem::path const sitePathRelative = sourcePath.lexically_relative(GetSitePath());
     std::filesystem::path const outputPath = GetPublicPath() / sitePathRelative;
 
-    Logging::LogWork("Source File: %s", sourcePath.string().c_str());
-    Logging::LogWork("Output: %s", outputPath.string().c_str());
-
-    if(!std::filesystem::exists(sourcePath) || !std::filesystem::is_regular_file(sourcePath)) {
-        Logging::LogError("File not found: %s", sourcePath.string().c_str());
-        return;
+    std::error_code error;
+    uintmax_t const size = std::filesystem::file_size(sourcePath, error);
+    if(!error && size > g_StreamThreshold) {
+        Logging::LogWork("Source File: %s", sourcePath.string().c_str());
+        Logging::LogWork("Output: %s", outputPath.string().c_str());
+        RenderPageStreaming(sourcePath, outputPath, vars, result);
+        Logging::LogWork("");
+        return result;
     }
 
-    {
-        auto const outParent = outputPath.parent_path();
-        if (!std::filesystem::exists(outParent)) {
-            std::filesystem::create_directories(outParent);
-        }
+    // The page is rendered entirely in memory and written to the output exactly once.
+    MappedFile source;
+    if(ReadPageSource(sourcePath, outputPath, source)) {
+        std::string output;
+        RenderPageOutput(source.GetText(), vars, output, result);
+        WritePageOutput(outputPath, output, previousOutputHash, result);
     }
-
-    // A total smattering of file types we know won't contain esd template information.
-    // If a file in public/site has one of these extensions it will be copied directly instead of looking for template information.
-    auto const knownBinaryExtensions = {
-        ".exe", ".zip", ".7z",
-        ".psd", ".xcf", ".ai",
-        ".svg", ".tiff", ".bmp", ".jpg", ".jpeg", ".gif", ".png", ".eps", ".raw",
-        ".woff", ".woff2", ".ttf", ".otf",
-        ".mp3", ".wav", ".m4a", ".flac", ".aac"
-        ".mp4", ".webm"
-    };
-
-    std::string extension = sourcePath.extension().string();
-    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return std::tolower(c); });
-
-    if (std::find(knownBinaryExtensions.begin(), knownBinaryExtensions.end(), extension) == knownBinaryExtensions.end()) {
-        RenderIncludes(sourcePath, outputPath);
-        std::optional<VarsCollection> inlineVariables = ParseInlineVariables(outputPath);
-
-        // pass inlineVariables first so they are read before the variables from Vars.txt
-        SubstituteVariables(outputPath, { inlineVariables, vars });
-    } else {
-        bool doCopy = true;
-        if (std::filesystem::exists(outputPath))
-        {
-            std::filesystem::file_time_type sourceWriteTime = std::filesystem::last_write_time(sourcePath);
-            std::filesystem::file_time_type outputWriteTime = std::filesystem::last_write_time(outputPath);
-            if (sourceWriteTime == outputWriteTime) {
-                Logging::LogWork("Asset is unchanged. Skipping copy step.", outputPath.string().c_str());
-                Logging::LogWorkVerbose("If skipping copy is a mistake you can force the copy by deleting the output file and trying again.");
-                doCopy = false;
-            }
-        }
-
-        if (doCopy) {
-            Logging::LogWork("Asset file being copied directly without using esd features.");
-            std::filesystem::copy(sourcePath, outputPath, std::filesystem::copy_options::overwrite_existing);
-        }
-    }
-
-    Logging::LogWork("");
+    return result;
 }
@@ -1,9 +1,19 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <filesystem>
 #include <optional>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
 
+#include "Symbols.h"
+
+class MappedFile;
 class VarsCollection;
+struct PageProgram;
 
 /**************************************************************************************************
     Include Files:
@@ -16,6 +26,10 @@ class VarsCollection;
 
         Include paths are recursive and importantly they occur before variables are processed.
 
+        A component can't include itself, directly or through other components. Such an include is
+        logged as an error along with the includes that lead back to it (ie: "a.html -> b.html ->
+        a.html") and left in the output as-is.
+
     Variable Declaration:
 
         example: {variable:red=#ff0000}
@@ -44,9 +58,88 @@ class VarsCollection;
             the esd process. For example, avoid javascript like {$(document).ready(()=>{});} which
             could be confused with a variable substitution due to the "{$" character.
         2) All statements are expected to be fully formed and are intolerant to errors or variations.
+        3) A statement must be entirely inside one file. A component that ends with "{$" will not
+            combine with text following the include statement to form a substitution, and
+            statements can not be nested inside each other.
+        4) Pages larger than g_StreamThreshold are streamed (see RenderPageStreaming), in which
+            case a single statement can't be longer than k_StreamChunkSize. A longer one is left
+            in the output as-is, with a warning.
 
 
 **************************************************************************************************/
 
 
-void RenderPage(std::filesystem::path const& path, std::optional<VarsCollection> const& vars);
\ No newline at end of file
+// Counts collected while rendering a page, for the build report (see BuildReport.h).
+struct PageRenderMetrics {
+    uint64_t BytesIn = 0;
+    uint64_t BytesOut = 0;
+    int IncludesProcessed = 0;
+    int VariablesDeclared = 0;
+    int VariablesSubstituted = 0;
+    int FailedSubstitutions = 0;
+    // Variables that were found past the page's inline variables (ie: in Vars.txt). Only collected while reporting.
+    std::vector<SymbolId> OuterSymbols;
+};
+
+// What RenderPage learned about a page while rendering it.
+struct PageRenderResult {
+    // False if the page couldn't be read (the reason is logged).
+    bool Rendered = false;
+    // Every component the page included, directly or through other components. Includes components that were missing.
+    std::set<std::filesystem::path> Components;
+    // True if any variable substitution had to look past the page's own inline variables (ie: into Vars.txt).
+    bool UsesVars = false;
+    // False if the output already held exactly what was rendered, in which case it wasn't touched.
+    bool Written = false;
+    // Hash (see Hash.h) of the rendered output.
+    uint64_t OutputHash = 0;
+    PageRenderMetrics Metrics;
+};
+
+// Pages whose source is larger than this many bytes are rendered with RenderPageStreaming instead of in memory.
+// Set with --stream-threshold=.
+extern uint64_t g_StreamThreshold;
+
+// How much of a streamed page is read (and rendered) at once.
+constexpr size_t k_StreamChunkSize = 1024 * 1024;
+
+// Rendering a page takes three steps, so each can run on its own thread while other pages go through the
+// others (see RenderPages in Site.h): reading the source, rendering it in memory and writing the output.
+// RenderPage below does all three in a row.
+
+// Opens the page's source and makes sure its contents are in memory. Returns false (and logs why) if it can't be read.
+bool ReadPageSource(std::filesystem::path const& sourcePath, std::filesystem::path const& outputPath, MappedFile& source);
+
+// Renders the page's source into output. Fills in everything in result but Written.
+// Safe to call for different pages from multiple threads at once as long as vars isn't modified while rendering.
+// If program is set and the page reads Vars.txt (result.UsesVars) the page is compiled into it too (see PageProgram.h).
+void RenderPageOutput(std::string_view source, std::optional<VarsCollection> const& vars, std::string& output, PageRenderResult& result, PageProgram* program = nullptr);
+
+// Renders a compiled page into output, the same as RenderPageOutput would render its source. Only its substitutions
+// of variables from Vars.txt are left to make. Fills in everything in result but Written.
+// What the page's includes and declarations came to is logged again unless logCompiled is false (ie: the page was
+// already rendered once for another variant).
+void RenderPageProgram(PageProgram const& program, std::optional<VarsCollection> const& vars, std::string& output, PageRenderResult& result, bool logCompiled = true);
+
+// True if the file at outputPath already holds exactly output (whose hash is outputHash). previousOutputHash is the hash
+// recorded by the manifest, when it's known the file hasn't changed since, which saves reading the file.
+bool IsPageOutputUnchanged(std::filesystem::path const& outputPath, std::string_view output, uint64_t outputHash, std::optional<uint64_t> const& previousOutputHash);
+
+// Writes output unless the file at outputPath already holds it, setting result.Written.
+// previousOutputHash is the hash of the existing output if it's known (see BuildManifest::GetOutputHash), otherwise
+// the existing output is read to compare against.
+void WritePageOutput(std::filesystem::path const& outputPath, std::string_view output, std::optional<uint64_t> const& previousOutputHash, PageRenderResult& result);
+
+// Renders a page a chunk at a time, straight from sourcePath to outputPath, so memory use stays the same no matter how
+// large the page is. Fills in result like RenderPageOutput and WritePageOutput together, the output is only written if
+// it changed. Nothing is rendered (result.Rendered stays false) if the source can't be read, the reason is logged.
+// Inline variables can be used before they're declared, so the source is read twice: once to find every declaration
+// and once to render it. Components are still loaded whole (see ComponentCache.h).
+// The output is compared to the existing one as it's rendered, and only from the first difference on is anything
+// written: to a temporary file next to the output (starting with the part that matched) which then replaces it.
+void RenderPageStreaming(std::filesystem::path const& sourcePath, std::filesystem::path const& outputPath, std::optional<VarsCollection> const& vars, PageRenderResult& result);
+
+// Renders a single page from Private/Site into Public. Safe to call for different pages from multiple threads
+// at once as long as vars isn't modified while rendering.
+// The output is only written if it changed, see WritePageOutput. Pages larger than g_StreamThreshold are streamed.
+PageRenderResult RenderPage(std::filesystem::path const& path, std::optional<VarsCollection> const& vars, std::optional<uint64_t> const& previousOutputHash = {});
\ No newline at end of file
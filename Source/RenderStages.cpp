@@ -0,0 +1,154 @@
+#include "RenderStages.h"
+
+#include "ComponentCache.h"
+#include "Logging.h"
+#include "Paths.h"
+#include "VarsCollection.h"
+
+namespace {
+    using RenderStages::IncludeExpansion;
+
+    // Logs error and keeps it with the expansion, so a compiled page can log it again when it's rendered from the program.
+    void LogIncludeError(std::string const& error, IncludeExpansion& expansion) {
+        Logging::LogError("%s", error.c_str());
+        if(expansion.Errors != nullptr) {
+            expansion.Errors->push_back(error);
+        }
+    }
+
+    // Replaces an include statement with the tokens of the component it names, with every include inside of it already
+    // expanded (see ComponentCache::FindExpanded). The statement is left in the output as-is if the component includes itself.
+    void ExpandInclude(Token const& include, IncludeExpansion& expansion) {
+        ++expansion.IncludesProcessed;
+
+        if(Logging::IsVerbose()) {
+            Logging::LogWorkVerbose("Including file: %s", (GetComponentPath() / include.Center).string().c_str());
+        }
+
+        std::shared_ptr<ExpandedComponent const> component = ComponentCache::Get().FindExpanded(include.Center);
+        if(expansion.ComponentPaths != nullptr) {
+            // Missing components are recorded too, so creating them later triggers a render.
+            expansion.ComponentPaths->insert(component->Path);
+            expansion.ComponentPaths->insert(component->Dependencies.begin(), component->Dependencies.end());
+        }
+        if(!component->Exists) {
+            LogIncludeError("Include file not found: " + (GetComponentPath() / include.Center).string(), expansion);
+            return;
+        }
+        if(!component->Cycle.empty()) {
+            LogIncludeError("Circular include: " + component->Cycle, expansion);
+            expansion.Tokens.push_back({Token::Type::Literal, include.Text, {}});
+            return;
+        }
+
+        if(Logging::IsVerbose()) {
+            for(std::filesystem::path const& dependency : component->Dependencies) {
+                Logging::LogWorkVerbose("Including file: %s", dependency.string().c_str());
+            }
+        }
+        for(std::string const& error : component->Errors) {
+            LogIncludeError(error, expansion);
+        }
+
+        expansion.IncludesProcessed += component->IncludesProcessed;
+        expansion.Tokens.insert(expansion.Tokens.end(), component->Tokens.begin(), component->Tokens.end());
+        expansion.Components.push_back(std::move(component));
+    }
+}
+
+namespace RenderStages {
+
+    void ResolveSymbols(std::vector<Token>& tokens) {
+        for(Token& token : tokens) {
+            if(token.TokenType == Token::Type::Substitution) {
+                token.Symbol = SymbolTable::Get().Intern(token.Center);
+            }
+        }
+    }
+
+    void ExpandIncludes(std::vector<Token> const& tokens, IncludeExpansion& expansion) {
+        for(Token const& token : tokens) {
+            if(token.TokenType == Token::Type::Include) {
+                ExpandInclude(token, expansion);
+            } else {
+                expansion.Tokens.push_back(token);
+            }
+        }
+    }
+
+    std::optional<VarsCollection> ParseInlineVariables(std::vector<Token> const& tokens, int& variablesDeclared) {
+        VarsCollection collection;
+
+        variablesDeclared = 0;
+        ParseInlineVariables(tokens, collection, variablesDeclared);
+
+        return { collection };
+    }
+
+    void ParseInlineVariables(std::vector<Token> const& tokens, VarsCollection& collection, int& variablesDeclared) {
+        for (Token const& token : tokens) {
+            if (token.TokenType != Token::Type::Declaration) {
+                continue;
+            }
+
+            size_t assignmentIndex = token.Center.find_first_of('=');
+
+            if (assignmentIndex == std::string::npos) {
+                WarnInvalidDeclaration(token.Center);
+            }
+            else {
+                collection.SetVariable(token.Center.substr(0, assignmentIndex), token.Center.substr(assignmentIndex+1));
+                ++variablesDeclared;
+            }
+        }
+    }
+
+    void WarnInvalidDeclaration(std::string_view center) {
+        Logging::LogWarning("Inline variable declaration is invalid: \"%s\"", std::string(center).c_str());
+    }
+
+    SubstitutionStats SubstituteVariables(std::vector<Token> const& tokens, std::string& page, VarsScope const& scope, std::vector<SymbolId>* outerSymbols) {
+        SubstitutionStats stats;
+
+        size_t estimatedSize = 0;
+        for(Token const& token : tokens) {
+            estimatedSize += token.Text.size();
+        }
+        page.clear();
+        page.reserve(estimatedSize);
+
+        for(Token const& token : tokens) {
+            switch(token.TokenType) {
+                case Token::Type::Literal:
+                    page.append(token.Text);
+                    break;
+                case Token::Type::Substitution: {
+                    size_t layersSearched = 0;
+                    std::optional<std::string_view> const var = token.Symbol != k_NoSymbol
+                        ? scope.TryGetVariable(token.Symbol, &layersSearched)
+                        : scope.TryGetVariable(token.Center, &layersSearched);
+                    stats.ReadPastFirstCollection |= layersSearched > 1;
+
+                    if(var.has_value()) {
+                        page.append(var.value());
+                        stats.VariablesSubstituted++;
+                        if(outerSymbols != nullptr && layersSearched > 1 && token.Symbol != k_NoSymbol) {
+                            outerSymbols->push_back(token.Symbol);
+                        }
+                    } else {
+                        page.append(token.Center);
+                        stats.FailedSubstitutions++;
+                        stats.FailedSubstitutionNames.insert(std::string(token.Center));
+                    }
+                    break;
+                }
+                default:
+                    // Declarations were already collected by ParseInlineVariables and aren't part of the output.
+                    // Includes were already expanded.
+                    break;
+            }
+        }
+
+        return stats;
+    }
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "Scanner.h"
+
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct ExpandedComponent;
+class VarsCollection;
+class VarsScope;
+
+/**************************************************************************************************
+    Render Stages:
+
+        The steps RenderPage takes to turn a page's tokens into its output, exposed so they can be
+        measured on their own (see Bench/). Stages don't log their progress, RenderPage does that
+        with the counts they return. Problems with the page itself (missing components, invalid
+        declarations) are still logged as they're found.
+
+        0) ResolveSymbols interns the variable names the tokens use.
+        1) ExpandIncludes replaces every include with the tokens of the component it names, which
+           are expanded once and shared by every page (see ComponentCache.h).
+        2) ParseInlineVariables collects the page's variable declarations.
+        3) SubstituteVariables writes the output, replacing variable substitutions.
+**************************************************************************************************/
+namespace RenderStages {
+
+    struct IncludeExpansion {
+        // The page with every include replaced by the tokens of the component it names.
+        std::vector<Token> Tokens;
+        // Keeps the components the tokens point into alive while the page renders.
+        std::vector<std::shared_ptr<ExpandedComponent const>> Components;
+        //count the number of includes proccessed (to log later)
+        int IncludesProcessed = 0;
+        // If set, every component that was included is added, so the build manifest knows what the page depends on.
+        std::set<std::filesystem::path>* ComponentPaths = nullptr;
+        // If set, every error that is logged (missing and circular includes) is added too.
+        std::vector<std::string>* Errors = nullptr;
+    };
+
+    // Interns the name of every substitution so it's looked up by id when substituting.
+    // Tokens that are kept around (ie: cached components) only pay for this once.
+    void ResolveSymbols(std::vector<Token>& tokens);
+
+    // Appends tokens to expansion.Tokens, recursively replacing includes with the tokens of the components they name.
+    void ExpandIncludes(std::vector<Token> const& tokens, IncludeExpansion& expansion);
+
+    // Parses all variable declarations (like: "{variable:name=value}") in the page into the returned VarsCollection.
+    // variablesDeclared is set to the number of valid declarations.
+    std::optional<VarsCollection> ParseInlineVariables(std::vector<Token> const& tokens, int& variablesDeclared);
+
+    // As above, adding to collection (ie: a page whose tokens come a piece at a time). variablesDeclared is added to.
+    void ParseInlineVariables(std::vector<Token> const& tokens, VarsCollection& collection, int& variablesDeclared);
+
+    // Logs the warning ParseInlineVariables gives a declaration (its center) without a value.
+    void WarnInvalidDeclaration(std::string_view center);
+
+    struct SubstitutionStats {
+        int VariablesSubstituted = 0;
+        int FailedSubstitutions = 0;
+        std::set<std::string> FailedSubstitutionNames;
+        // True if any lookup had to go past the innermost scope.
+        bool ReadPastFirstCollection = false;
+    };
+
+    // Writes the page's tokens to page, replacing instances of variables (like: "{$var_name}") with variables from scope.
+    // Variable declarations are left out of the page.
+    // If these variables do not exist the variable name will be left in place to hopefully in many cases indicate clearly where a problem occured.
+    // If outerSymbols is set the symbol of every variable found past the innermost scope is appended to it (duplicates included).
+    SubstitutionStats SubstituteVariables(std::vector<Token> const& tokens, std::string& page, VarsScope const& scope, std::vector<SymbolId>* outerSymbols = nullptr);
+}
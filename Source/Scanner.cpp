@@ -0,0 +1,410 @@
+#include "Scanner.h"
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define ESD_SCANNER_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang only let us use intrinsics in functions compiled for the matching instruction set.
+#if defined(ESD_SCANNER_X86) && (defined(__GNUC__) || defined(__clang__))
+#define ESD_TARGET(isa) __attribute__((target(isa)))
+#else
+#define ESD_TARGET(isa)
+#endif
+
+namespace {
+    std::vector<CappedSearchResult> FindIndicatorsWithCapsReference(std::string_view text, std::string_view indicator, std::string_view cap) {
+        std::vector<CappedSearchResult> results;
+
+        enum class ParseState
+        {
+            SeekingIndicator,
+            SeekingCap
+        };
+
+        // How the current parsing should be interpreted.
+        ParseState state = ParseState::SeekingIndicator;
+
+        // How many sequential characters match the pattern we're looking for (indicator/cap)
+        size_t match = 0;
+        // Once we've found an indicator or a cap we track that position. This will help with replacing the entire found statement later
+        size_t indicatorStart = 0;
+        size_t capStart = 0;
+        // Where the value between the start indicator and the cap begins. Ie: "{example}" would start at 'e' if the indicator was '{' and the cap was '}'
+        size_t midStart = 0;
+        for(size_t i = 0; i < text.size(); ++i) {
+            char const ch = text[i];
+            switch(state) {
+                case ParseState::SeekingIndicator:
+                    if(ch == indicator[match]) {
+                        if(match == 0) {
+                            indicatorStart = i;
+                        }
+                        match++;
+                    } else {
+                        match = 0;
+                    }
+                    if(indicator.size() == match) {
+                        state = ParseState::SeekingCap;
+                        match = 0;
+                        midStart = i + 1;
+                    }
+                break;
+                case ParseState::SeekingCap:
+                    if(ch == cap[match]) {
+                        if(match == 0) {
+                            capStart = i;
+                        }
+                        match++;
+                    } else {
+                        match = 0;
+                    }
+
+                    if(cap.size() == match) {
+                        results.push_back({
+                            indicatorStart,
+                            (capStart - indicatorStart)+1,
+                            text.substr(midStart, capStart - midStart)
+                        });
+
+                        // reset everything
+                        state = ParseState::SeekingIndicator;
+                        match = 0;
+                        indicatorStart = 0;
+                        capStart = 0;
+                    }
+                break;
+            }
+        }
+
+        return results;
+    }
+
+    char const* FindBytePortable(char const* it, char const* end, char c) {
+        void const* found = std::memchr(it, c, static_cast<size_t>(end - it));
+        return found != nullptr ? static_cast<char const*>(found) : end;
+    }
+
+#if defined(ESD_SCANNER_X86)
+    int CountTrailingZeros(unsigned int mask) {
+#if defined(_MSC_VER)
+        unsigned long index = 0;
+        _BitScanForward(&index, mask);
+        return static_cast<int>(index);
+#else
+        return __builtin_ctz(mask);
+#endif
+    }
+
+    ESD_TARGET("sse2")
+    char const* FindByteSSE2(char const* it, char const* end, char c) {
+        __m128i const needle = _mm_set1_epi8(c);
+        for(; end - it >= 16; it += 16) {
+            __m128i const block = _mm_loadu_si128(reinterpret_cast<__m128i const*>(it));
+            unsigned int const mask = static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, needle)));
+            if(mask != 0) {
+                return it + CountTrailingZeros(mask);
+            }
+        }
+        for(; it < end && *it != c; ++it) {}
+        return it;
+    }
+
+    ESD_TARGET("avx2")
+    char const* FindByteAVX2(char const* it, char const* end, char c) {
+        __m256i const needle = _mm256_set1_epi8(c);
+        for(; end - it >= 32; it += 32) {
+            __m256i const block = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(it));
+            unsigned int const mask = static_cast<unsigned int>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle)));
+            if(mask != 0) {
+                return it + CountTrailingZeros(mask);
+            }
+        }
+        return FindByteSSE2(it, end, c);
+    }
+
+    bool CpuSupportsSSE2() {
+#if defined(_M_X64) || defined(__x86_64__)
+        return true;
+#elif defined(_MSC_VER)
+        int info[4] = {};
+        __cpuid(info, 1);
+        return (info[3] & (1 << 26)) != 0;
+#else
+        return __builtin_cpu_supports("sse2");
+#endif
+    }
+
+    bool CpuSupportsAVX2() {
+#if defined(_MSC_VER)
+        int info[4] = {};
+        __cpuid(info, 0);
+        if(info[0] < 7) {
+            return false;
+        }
+        __cpuid(info, 1);
+        bool const osSavesYmm = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+        __cpuidex(info, 7, 0);
+        return osSavesYmm && (info[1] & (1 << 5)) != 0;
+#else
+        return __builtin_cpu_supports("avx2");
+#endif
+    }
+#endif
+
+    using FindByteFunction = char const* (*)(char const* it, char const* end, char c);
+
+    FindByteFunction GetFindByte(ScannerBackend backend) {
+        if(!IsScannerBackendSupported(backend)) {
+            return &FindBytePortable;
+        }
+        switch(backend) {
+#if defined(ESD_SCANNER_X86)
+            case ScannerBackend::SSE2:
+                return &FindByteSSE2;
+            case ScannerBackend::AVX2:
+                return &FindByteAVX2;
+#endif
+            default:
+                return &FindBytePortable;
+        }
+    }
+
+    // Jumps from candidate to candidate instead of feeding every character through the state machine.
+    // The results match FindIndicatorsWithCapsReference exactly, including its quirk of never starting a new
+    // indicator on the character that broke a partial match (so "{{$name}" is not a substitution).
+    std::vector<CappedSearchResult> FindIndicatorsWithCapsJumping(std::string_view text, std::string_view indicator, std::string_view cap, FindByteFunction findByte) {
+        std::vector<CappedSearchResult> results;
+
+        char const* const begin = text.data();
+        char const* const end = begin + text.size();
+        char const* it = begin;
+        while(it < end) {
+            char const* const candidate = findByte(it, end, indicator[0]);
+            if(candidate == end) {
+                break;
+            }
+
+            // How much of the indicator matches at the candidate.
+            size_t const available = static_cast<size_t>(end - candidate);
+            size_t match = 1;
+            while(match < indicator.size() && match < available && candidate[match] == indicator[match]) {
+                ++match;
+            }
+
+            if(match < indicator.size()) {
+                // The character that broke the match is skipped, just like the state machine does.
+                it = candidate + match + 1;
+                continue;
+            }
+
+            char const* const center = candidate + indicator.size();
+            char const* const capStart = findByte(center, end, cap[0]);
+            if(capStart == end) {
+                // The statement is never closed.
+                break;
+            }
+
+            results.push_back({
+                static_cast<size_t>(candidate - begin),
+                static_cast<size_t>(capStart - candidate) + 1,
+                std::string_view(center, static_cast<size_t>(capStart - center))
+            });
+            it = capStart + 1;
+        }
+
+        return results;
+    }
+
+    // Splits text into tokens, see Tokenize. blocked holds a bit per statement kind (in the order of kinds below) that
+    // can't start at the first character of text, because the character before it broke a partial match.
+    // When Partial is set text is followed by more that hasn't been read yet: tokenizing stops at a statement that
+    // might continue past the end of text instead of leaving it as a literal. Returns where it stopped, with blocked
+    // set for that position.
+    template<bool Partial>
+    size_t TokenizeText(std::string_view text, FindByteFunction findByte, uint8_t& blocked, std::vector<Token>& tokens) {
+        using namespace Indicators;
+
+        // Every indicator starts with the same character, so there's only ever one thing to jump to.
+        static_assert(k_Include[0] == '{' && k_VarDeclaration[0] == '{' && k_VarSubstitution[0] == '{', "Tokenize expects all indicators to start with '{'");
+        static_assert(k_Cap.size() == 1, "Tokenize expects a single character cap");
+
+        struct StatementKind {
+            Token::Type TokenType;
+            std::string_view Indicator;
+            // The character that broke this kind's last partial match. It can't start a statement of this kind.
+            char const* BlockedAt;
+        };
+
+        char const* const begin = text.data();
+        char const* const end = begin + text.size();
+        std::array<StatementKind, 3> kinds = {{
+            {Token::Type::Include, k_Include, (blocked & 1) != 0 ? begin : nullptr},
+            {Token::Type::Declaration, k_VarDeclaration, (blocked & 2) != 0 ? begin : nullptr},
+            {Token::Type::Substitution, k_VarSubstitution, (blocked & 4) != 0 ? begin : nullptr}
+        }};
+
+        // Where the current literal started.
+        char const* literal = begin;
+        char const* it = begin;
+        // Where tokenizing stopped, the end unless a statement might carry on past it.
+        char const* stop = end;
+        while(it < end) {
+            char const* const candidate = findByte(it, end, '{');
+            if(candidate == end) {
+                break;
+            }
+
+            size_t const available = static_cast<size_t>(end - candidate);
+            StatementKind const* matched = nullptr;
+            bool unfinished = false;
+            for(StatementKind& kind : kinds) {
+                if(kind.BlockedAt == candidate) {
+                    continue;
+                }
+                size_t match = 1;
+                while(match < kind.Indicator.size() && match < available && candidate[match] == kind.Indicator[match]) {
+                    ++match;
+                }
+                if(match == kind.Indicator.size()) {
+                    matched = &kind;
+                    break;
+                }
+                // Ran out of text in the middle of the indicator.
+                unfinished |= match == available;
+                kind.BlockedAt = candidate + match;
+            }
+
+            if constexpr (Partial) {
+                if(matched == nullptr && unfinished) {
+                    stop = candidate;
+                    break;
+                }
+            }
+            if(matched == nullptr) {
+                it = candidate + 1;
+                continue;
+            }
+
+            Token statement;
+            statement.TokenType = matched->TokenType;
+            std::string_view const indicator = matched->Indicator;
+
+            char const* const center = candidate + indicator.size();
+            char const* const capStart = findByte(center, end, k_Cap[0]);
+            if(capStart == end) {
+                if constexpr (Partial) {
+                    // The cap may be in what comes next.
+                    stop = candidate;
+                }
+                // The statement is never closed, so neither is anything after it.
+                break;
+            }
+
+            if(candidate != literal) {
+                tokens.push_back({Token::Type::Literal, std::string_view(literal, static_cast<size_t>(candidate - literal)), {}});
+            }
+            statement.Text = std::string_view(candidate, static_cast<size_t>(capStart - candidate) + 1);
+            statement.Center = std::string_view(center, static_cast<size_t>(capStart - center));
+            tokens.push_back(statement);
+
+            it = literal = capStart + 1;
+        }
+
+        if(literal < stop) {
+            tokens.push_back({Token::Type::Literal, std::string_view(literal, static_cast<size_t>(stop - literal)), {}});
+        }
+        blocked = 0;
+        for(size_t kind = 0; kind < kinds.size(); ++kind) {
+            if(kinds[kind].BlockedAt == stop && stop != end) {
+                blocked |= static_cast<uint8_t>(1u << kind);
+            }
+        }
+        return static_cast<size_t>(stop - begin);
+    }
+}
+
+char const* GetScannerBackendName(ScannerBackend backend) {
+    switch(backend) {
+        case ScannerBackend::Reference: return "reference";
+        case ScannerBackend::Portable:  return "portable";
+        case ScannerBackend::SSE2:      return "sse2";
+        case ScannerBackend::AVX2:      return "avx2";
+    }
+    return "unknown";
+}
+
+ScannerBackend GetBestScannerBackend() {
+    static ScannerBackend const s_Best = []() {
+        if(IsScannerBackendSupported(ScannerBackend::AVX2)) {
+            return ScannerBackend::AVX2;
+        }
+        if(IsScannerBackendSupported(ScannerBackend::SSE2)) {
+            return ScannerBackend::SSE2;
+        }
+        return ScannerBackend::Portable;
+    }();
+    return s_Best;
+}
+
+bool IsScannerBackendSupported(ScannerBackend backend) {
+    switch(backend) {
+        case ScannerBackend::Reference:
+        case ScannerBackend::Portable:
+            return true;
+#if defined(ESD_SCANNER_X86)
+        case ScannerBackend::SSE2: {
+            static bool const s_Supported = CpuSupportsSSE2();
+            return s_Supported;
+        }
+        case ScannerBackend::AVX2: {
+            static bool const s_Supported = CpuSupportsAVX2();
+            return s_Supported;
+        }
+#endif
+        default:
+            return false;
+    }
+}
+
+std::vector<CappedSearchResult> FindIndicatorsWithCaps(std::string_view text, std::string_view indicator, std::string_view cap) {
+    return FindIndicatorsWithCaps(text, indicator, cap, GetBestScannerBackend());
+}
+
+std::vector<CappedSearchResult> FindIndicatorsWithCaps(std::string_view text, std::string_view indicator, std::string_view cap, ScannerBackend backend) {
+    // Jumping relies on a single character cap and on the indicator's first character not repeating inside it
+    // (true of every indicator esd uses). Anything else goes through the state machine.
+    bool const canJump = !indicator.empty() && cap.size() == 1 && indicator.find(indicator[0], 1) == std::string_view::npos;
+    if(backend == ScannerBackend::Reference || !canJump) {
+        return FindIndicatorsWithCapsReference(text, indicator, cap);
+    }
+    return FindIndicatorsWithCapsJumping(text, indicator, cap, GetFindByte(backend));
+}
+
+std::vector<Token> Tokenize(std::string_view text) {
+    return Tokenize(text, GetBestScannerBackend());
+}
+
+std::vector<Token> Tokenize(std::string_view text, ScannerBackend backend) {
+    std::vector<Token> tokens;
+    uint8_t blocked = 0;
+    TokenizeText<false>(text, GetFindByte(backend), blocked, tokens);
+    return tokens;
+}
+
+size_t StreamTokenizer::Tokenize(std::string_view text, bool last, std::vector<Token>& tokens) {
+    FindByteFunction const findByte = GetFindByte(GetBestScannerBackend());
+    if(last) {
+        TokenizeText<false>(text, findByte, m_Blocked, tokens);
+        m_Blocked = 0;
+        return text.size();
+    }
+    return TokenizeText<true>(text, findByte, m_Blocked, tokens);
+}
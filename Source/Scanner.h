@@ -0,0 +1,109 @@
+#pragma once
+
+#include "Symbols.h"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// The special strings esd looks for in source files. See Render.h for what each of them does.
+namespace Indicators {
+    using namespace std::string_view_literals;
+
+    constexpr std::string_view k_Include = "{include:"sv;
+    constexpr std::string_view k_VarDeclaration = "{variable:"sv;
+    constexpr std::string_view k_VarSubstitution = "{$"sv;
+
+    constexpr std::string_view k_Cap = "}"sv;
+}
+
+struct CappedSearchResult {
+    // Where does the indicator begin (example: first open curly brace character)
+    size_t ResultStart = std::string::npos;
+    // The length of the statement
+    size_t ResultSize = std::string::npos;
+    // The string between the search indicator and it's end. Points into the searched text.
+    std::string_view ResultCenter;
+};
+
+/**************************************************************************************************
+    Scanner Backends:
+
+        Reference: Reads one character at a time through a small state machine. This is the
+        original scanner and defines the results every other backend must reproduce exactly.
+
+        Portable, SSE2, AVX2: Jump straight to the next candidate (the first character of the
+        indicator, then the cap) 16 or 32 bytes at a time, and only then compare the whole
+        indicator. Portable uses memchr and works everywhere.
+
+    The best backend the CPU supports is picked at runtime.
+**************************************************************************************************/
+enum class ScannerBackend {
+    Reference,
+    Portable,
+    SSE2,
+    AVX2
+};
+
+char const* GetScannerBackendName(ScannerBackend backend);
+
+// The fastest backend supported by this CPU.
+ScannerBackend GetBestScannerBackend();
+
+// Returns false if backend can't run on this CPU.
+bool IsScannerBackendSupported(ScannerBackend backend);
+
+// Searches text for an indication (ie: "{include:"sv) and the assumed-to-be-present cap (ie: "}"sv).
+// It's presumed that the entire statement will exist and no caps will be stranded.
+std::vector<CappedSearchResult> FindIndicatorsWithCaps(std::string_view text, std::string_view indicator, std::string_view cap);
+
+// As above with a specific backend. Unsupported backends fall back to Portable.
+std::vector<CappedSearchResult> FindIndicatorsWithCaps(std::string_view text, std::string_view indicator, std::string_view cap, ScannerBackend backend);
+
+struct Token {
+    enum class Type {
+        // Text that is copied to the output as-is.
+        Literal,
+        // {include:name}
+        Include,
+        // {variable:name=value}
+        Declaration,
+        // {$name}
+        Substitution
+    };
+
+    Type TokenType = Type::Literal;
+    // The text of the token. For statements this is the entire statement (ie: "{$name}").
+    std::string_view Text;
+    // For statements: the text between the indicator and the cap (ie: "name").
+    std::string_view Center;
+    // For substitutions: Center interned, once resolved by RenderStages::ResolveSymbols.
+    SymbolId Symbol = k_NoSymbol;
+};
+
+// Splits text into literals and statements of every kind in a single pass.
+// Tokens point into text, so text must outlive them.
+// Statements start exactly where FindIndicatorsWithCaps would find them, including its quirk: the character that
+// breaks a partial match never starts a statement of that kind (ie: "{{$name}" is not a substitution).
+std::vector<Token> Tokenize(std::string_view text);
+
+// As above with a specific backend. Reference and unsupported backends use Portable.
+std::vector<Token> Tokenize(std::string_view text, ScannerBackend backend);
+
+// Tokenizes text that is read a piece at a time (see RenderPageStreaming in Render.h), giving the same tokens as
+// Tokenize would for all of it at once. Statements may be split between pieces.
+class StreamTokenizer
+{
+public:
+    // Appends the tokens of text, which continues where the last call stopped, to tokens. Returns how much of text was
+    // tokenized. The rest may be the start of a statement that ends in what comes next, it must be passed again at
+    // the start of the next call with more text after it.
+    // When last is set text is the end of the file and all of it is tokenized (any unclosed statement is left as a
+    // literal, as Tokenize does).
+    size_t Tokenize(std::string_view text, bool last, std::vector<Token>& tokens);
+
+private:
+    // The statement kinds that can't start at the first character of the next call, see Tokenize.
+    uint8_t m_Blocked = 0;
+};
@@ -0,0 +1,896 @@
+#include "Site.h"
+
+#include "Assets.h"
+#include "BatchIO.h"
+#include "BuildManifest.h"
+#include "BoundedQueue.h"
+#include "BuildReport.h"
+#include "FileIO.h"
+#include "Hash.h"
+#include "Logging.h"
+#include "PageProgram.h"
+#include "Paths.h"
+#include "Profiler.h"
+#include "Render.h"
+#include "ThreadPool.h"
+#include "VarsCollection.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+std::optional<VarsCollection> LoadSiteVars() {
+    auto loadingVarsJob = Logging::JobScope("Loading Vars.txt");
+    return LoadVarsFile(GetVarsPath(), GetVarsSnapshotPath());
+}
+
+std::optional<VarsCollection> LoadVarsFile(std::filesystem::path const& varsPath, std::filesystem::path const& snapshotPath) {
+    std::optional<VarsCollection> vars;
+
+    std::string const name = varsPath.filename().string();
+    if(std::filesystem::exists(varsPath) && std::filesystem::is_regular_file(varsPath))
+    {
+        vars = VarsCollection::TryLoadVarsCollection(varsPath, snapshotPath);
+
+        if(vars.has_value()) {
+            Logging::LogWork("%d variables loaded.", static_cast<int>(vars.value().size()));
+
+            if(Logging::IsVerbose()) {
+                std::stringstream ss;
+                vars.value().ForeachKey([&ss](std::string_view key) -> void {
+                    ss << key << " ";
+                }); 
+                Logging::LogWorkVerbose("Variables: %s", ss.str().c_str());
+            }
+        } else {
+            Logging::LogWarning("%s couldn't be loaded. No variables loaded.", name.c_str());
+        }
+    }
+    else {
+        std::stringstream details;
+        Logging::AppendFileDetails(details, varsPath);
+        std::string detailsText = details.str();
+        detailsText.pop_back(); // the trailing newline
+        Logging::LogWork("%s", detailsText.c_str());
+
+        Logging::LogWarning("%s not found, no variables loaded.", name.c_str());
+        // A safe warning to ignore if you know what you're doing and don't need vars.txt
+        Logging::LogWorkVerbose("Warning: This is unexpected but can be ignored.");
+        
+    }
+    return vars;
+}
+
+namespace {
+#if defined(__linux__) || defined(__APPLE__)
+    // Reads the entries of an open directory, closing it when done.
+    class DirectoryReader
+    {
+    public:
+        explicit DirectoryReader(int fd)
+        : m_Fd(fd) {
+#if !defined(__linux__)
+            m_Directory = fdopendir(fd);
+#endif
+        }
+
+        ~DirectoryReader() {
+            Profiler::CountSyscalls();
+#if defined(__linux__)
+            close(m_Fd);
+#else
+            if(m_Directory != nullptr) {
+                closedir(m_Directory);
+            } else {
+                close(m_Fd);
+            }
+#endif
+        }
+
+        DirectoryReader(DirectoryReader const&)            = delete;
+        DirectoryReader& operator=(DirectoryReader const&) = delete;
+
+        int GetFd() const {
+            return m_Fd;
+        }
+
+        // Returns false once every entry has been read. name is valid until the next call.
+        bool Next(char const*& name, unsigned char& type) {
+#if defined(__linux__)
+            // getdents64 directly (rather than readdir) so every syscall the walk makes is counted.
+            while(m_Offset >= m_Size) {
+                Profiler::CountSyscalls();
+                long const bytes = syscall(SYS_getdents64, m_Fd, m_Buffer.data(), m_Buffer.size());
+                if(bytes <= 0) {
+                    return false;
+                }
+                m_Size = static_cast<size_t>(bytes);
+                m_Offset = 0;
+            }
+            dirent64 const* const entry = reinterpret_cast<dirent64 const*>(m_Buffer.data() + m_Offset);
+            m_Offset += entry->d_reclen;
+#else
+            if(m_Directory == nullptr) {
+                return false;
+            }
+            // Only an estimate, readdir reads many entries per syscall.
+            Profiler::CountSyscalls();
+            dirent const* const entry = readdir(m_Directory);
+            if(entry == nullptr) {
+                return false;
+            }
+#endif
+            name = entry->d_name;
+            type = entry->d_type;
+            return true;
+        }
+
+    private:
+        int m_Fd;
+#if defined(__linux__)
+        std::vector<char> m_Buffer = std::vector<char>(32 * 1024);
+        size_t m_Size = 0;
+        size_t m_Offset = 0;
+#else
+        DIR* m_Directory = nullptr;
+#endif
+    };
+
+    FileStamp GetStamp(struct stat const& status) {
+#if defined(__APPLE__)
+        return FileStamp::FromStat(status.st_size, status.st_mtimespec.tv_sec, status.st_mtimespec.tv_nsec);
+#else
+        return FileStamp::FromStat(status.st_size, status.st_mtim.tv_sec, status.st_mtim.tv_nsec);
+#endif
+    }
+
+    // Adds every regular file below the open directory fd (directory, relative to Private/Site) to pages.
+    void WalkSiteDirectory(int fd, std::filesystem::path const& directory, std::filesystem::path const& relative, std::vector<SitePage>& pages) {
+        DirectoryReader reader(fd);
+        char const* name = nullptr;
+        unsigned char type = DT_UNKNOWN;
+        while(reader.Next(name, type)) {
+            if(std::strcmp(name, ".") == 0 || std::strcmp(name, "..") == 0) {
+                continue;
+            }
+
+            struct stat status {};
+            bool statusKnown = false;
+            if(type == DT_UNKNOWN) {
+                // Some file systems don't say what an entry is, ask without following links.
+                Profiler::CountSyscalls();
+                if(fstatat(reader.GetFd(), name, &status, AT_SYMLINK_NOFOLLOW) != 0) {
+                    continue;
+                }
+                type = S_ISDIR(status.st_mode) ? DT_DIR : S_ISLNK(status.st_mode) ? DT_LNK : S_ISREG(status.st_mode) ? DT_REG : DT_UNKNOWN;
+                statusKnown = type == DT_REG;
+            }
+
+            if(type == DT_DIR) {
+                Profiler::CountSyscalls();
+                int const child = openat(reader.GetFd(), name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                if(child < 0) {
+                    Logging::LogWarning("Couldn't read the directory %s.", (directory / name).string().c_str());
+                    continue;
+                }
+                WalkSiteDirectory(child, directory / name, relative / name, pages);
+                continue;
+            }
+            if(type != DT_REG && type != DT_LNK) {
+                continue;
+            }
+
+            // Links are followed, a link to a file is a page like any other.
+            if(!statusKnown) {
+                Profiler::CountSyscalls();
+                if(fstatat(reader.GetFd(), name, &status, 0) != 0 || !S_ISREG(status.st_mode)) {
+                    continue;
+                }
+            }
+
+            SitePage page;
+            page.Path = directory / name;
+            page.SitePathRelative = relative / name;
+            page.OutputPath = GetPublicPath() / page.SitePathRelative;
+            page.Stamp = GetStamp(status);
+            pages.push_back(std::move(page));
+        }
+    }
+#endif
+}
+
+std::vector<SitePage> FindSitePages() {
+    auto span = Profiler::Span("Walk Site", "io");
+    span.SetPath(GetSitePath());
+
+    std::vector<SitePage> pages;
+#if defined(__linux__) || defined(__APPLE__)
+    Profiler::CountSyscalls();
+    int const fd = open(GetSitePath().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd < 0) {
+        throw std::filesystem::filesystem_error("Couldn't read the site directory", GetSitePath(), std::error_code(errno, std::generic_category()));
+    }
+    WalkSiteDirectory(fd, GetSitePath(), {}, pages);
+#else
+    for (const std::filesystem::directory_entry& entry : std::filesystem::recursive_directory_iterator(GetSitePath())) {
+        if(entry.is_regular_file()) {
+            pages.push_back(MakeSitePage(entry.path()));
+        }
+    }
+#endif
+    return pages;
+}
+
+SitePage MakeSitePage(std::filesystem::path const& path) {
+    SitePage page;
+    page.Path = path;
+    page.SitePathRelative = path.lexically_relative(GetSitePath());
+    page.OutputPath = GetPublicPath() / page.SitePathRelative;
+    return page;
+}
+
+namespace {
+    // Threads reading sources and writing outputs. They spend most of their time waiting on the disk.
+    constexpr size_t k_MaxIoThreads = 4;
+    // How many pages can wait between two stages, per render thread.
+    constexpr size_t k_QueuedPagesPerThread = 2;
+    // Most pages the read and write stages hand to BatchIO at once.
+    constexpr size_t k_IoBatchSize = 16;
+
+    double MillisecondsSince(std::chrono::steady_clock::time_point startTime) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+    }
+
+    // One of a page's outputs, for one target.
+    struct PageOutput {
+        SiteTarget const* Target = nullptr;
+        std::filesystem::path Path;
+        // The output's stamp from before the page was rendered, or from once it's written. Recorded in the manifest.
+        FileStamp Stamp;
+        std::optional<uint64_t> PreviousHash;
+        std::string Text;
+        PageRenderResult Result;
+    };
+
+    // A page on its way through the render pipeline.
+    struct PageWork {
+        SitePage const* Page = nullptr;
+        // The page's logs are collected by every stage and printed once it's done.
+        Logging::LogBuffer Logs;
+        // The source's stamp from before it was read, recorded in the manifest.
+        FileStamp SourceStamp;
+        MappedFile Source;
+        // Too large to hold in memory, the render stage streams it from the source to the output (see RenderPageStreaming).
+        bool Streamed = false;
+        // The page's compiled program when it's still up to date, rendered instead of Source (see PageProgram.h).
+        std::unique_ptr<PageProgram const> Program;
+        // An output for every target the page isn't up to date in.
+        std::vector<PageOutput> Outputs;
+        // The program compiled while rendering, saved by the write stage.
+        std::string ProgramData;
+        // The program an earlier run saved, when it's only read to be compared with ProgramData (--rebuild).
+        MappedFile SavedProgram;
+        // Time spent on the page in every stage, not counting time waiting in queues.
+        double Milliseconds = 0.0;
+        // Syscalls made for the page, including its share of the batches it was read and written in.
+        double Syscalls = 0.0;
+        // When the read stage took the page.
+        std::chrono::steady_clock::time_point Start;
+    };
+
+    // Records the page's whole trip through the pipeline in the profile, ending now.
+    void ProfilePage(PageWork const& work) {
+        auto page = Profiler::PageScope(work.Page->Path);
+        auto span = Profiler::Span("Page", "page", work.Start);
+        span.SetPath(work.Page->OutputPath);
+        span.SetSyscalls(static_cast<uint64_t>(std::llround(work.Syscalls)));
+    }
+
+    // Renders every one of the page's outputs in memory. The source is only expanded once, every output after the
+    // first is rendered from the page's program (see PageProgram.h) or, when the page doesn't read Vars.txt, copied.
+    void RenderPageOutputs(PageWork& work, PagePrograms::StampFunction const& getComponentStamp) {
+        bool const several = work.Outputs.size() > 1;
+        PageProgram compiled;
+        PageProgram const* program = work.Program.get();
+        size_t rendered = 0;
+        if (program == nullptr) {
+            PageOutput& output = work.Outputs.front();
+            if (several) {
+                Logging::LogWork("Rendering %s", output.Path.string().c_str());
+            }
+            bool const compile = g_PageProgramOptions.Save || several;
+            RenderPageOutput(work.Source.GetText(), *output.Target->Vars, output.Text, output.Result, compile ? &compiled : nullptr);
+            // The output doesn't point into the source, so it can go now.
+            work.Source.Close();
+            if (output.Result.UsesVars) {
+                program = &compiled;
+                if (g_PageProgramOptions.Save) {
+                    work.ProgramData = PagePrograms::Serialize(compiled, work.Page->SitePathRelative, work.SourceStamp, getComponentStamp);
+                }
+            }
+            rendered = 1;
+        }
+
+        for (size_t index = rendered; index < work.Outputs.size(); ++index) {
+            PageOutput& output = work.Outputs[index];
+            if (program == nullptr) {
+                // Nothing came from Vars.txt, so it's the same for every target.
+                output.Text = work.Outputs.front().Text;
+                output.Result = work.Outputs.front().Result;
+                continue;
+            }
+            if (several) {
+                Logging::LogWork("Rendering %s", output.Path.string().c_str());
+            }
+            // What the includes and declarations came to is only logged with the first output.
+            RenderPageProgram(*program, *output.Target->Vars, output.Text, output.Result, index == 0);
+        }
+        work.Program.reset();
+    }
+
+    // Splits one stage thread's time into busy, starved and blocked. Added to the stage's stats when destroyed.
+    struct StageClock {
+        StageClock(PipelineStageStats& stats, std::mutex& mutex)
+        : m_Stats(stats)
+        , m_Mutex(mutex)
+        , m_Mark(std::chrono::steady_clock::now()) {
+        }
+
+        ~StageClock() {
+            // Whatever is left is the wait for a page that never came.
+            Lap(Starved);
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_Stats.Items += Items;
+            m_Stats.BusySeconds += Busy;
+            m_Stats.StarvedSeconds += Starved;
+            m_Stats.BlockedSeconds += Blocked;
+        }
+
+        // Adds the time since the last lap to counter and returns it.
+        double Lap(double& counter) {
+            auto const now = std::chrono::steady_clock::now();
+            double const seconds = std::chrono::duration<double>(now - m_Mark).count();
+            m_Mark = now;
+            counter += seconds;
+            return seconds;
+        }
+
+        int Items = 0;
+        double Busy = 0.0;
+        double Starved = 0.0;
+        double Blocked = 0.0;
+
+    private:
+        PipelineStageStats& m_Stats;
+        std::mutex& m_Mutex;
+        std::chrono::steady_clock::time_point m_Mark;
+    };
+}
+
+SiteRenderStats RenderPages(
+    std::vector<SitePage> const& pages, 
+    std::optional<VarsCollection> const& vars, 
+    BuildManifest& manifest, 
+    ThreadPool& pool, 
+    ThreadPool& assetPool, 
+    bool forceRender, 
+    std::atomic<bool> const* cancel)
+{
+    return RenderPages(pages, { SiteTarget { &vars, &manifest, GetPublicPath() } }, pool, assetPool, forceRender, cancel);
+}
+
+SiteRenderStats RenderPages(
+    std::vector<SitePage> const& pages, 
+    std::vector<SiteTarget> const& targets, 
+    ThreadPool& pool, 
+    ThreadPool& assetPool, 
+    bool forceRender, 
+    std::atomic<bool> const* cancel)
+{
+    std::atomic<int> pagesRendered = 0;
+    std::atomic<int> pagesSkipped = 0;
+    std::atomic<int> pagesWritten = 0;
+    std::atomic<int> assetsCopied = 0;
+    std::atomic<int> assetsSkipped = 0;
+    std::mutex unfinishedMutex;
+    SiteRenderStats stats;
+
+    size_t const indentation = Logging::GetIndentationLevel();
+
+    // Assets are submitted first so the copies start while pages are rendering.
+    std::vector<SitePage const*> sourcePages;
+    sourcePages.reserve(pages.size());
+    for (SitePage const& sitePage : pages) {
+        if (!IsAssetPath(sitePage.Path)) {
+            sourcePages.push_back(&sitePage);
+            continue;
+        }
+
+        assetPool.Submit([&, indentation]() {
+            std::filesystem::path const& path = sitePage.Path;
+            if (cancel != nullptr && *cancel) {
+                std::lock_guard<std::mutex> lock(unfinishedMutex);
+                stats.Unfinished.push_back(path);
+                return;
+            }
+
+            auto group = Logging::GroupScope(indentation);
+            auto page = Profiler::PageScope(path);
+            auto const startTime = std::chrono::steady_clock::now();
+
+            std::filesystem::path const& sitePathRelative = sitePage.SitePathRelative;
+            Logging::LogWork("Source File: %s", path.string().c_str());
+            for (SiteTarget const& target : targets) {
+                std::filesystem::path const outputPath = target.PublicPath / sitePathRelative;
+                Logging::LogWork("Output: %s", outputPath.string().c_str());
+
+                if (!forceRender && target.Manifest->CheckAssetUpToDate(sitePathRelative, path, outputPath, g_AssetOptions.HashContents)) {
+                    Logging::LogWork("Asset is unchanged. Skipping copy step.");
+                    Logging::LogWorkVerbose("If skipping copy is a mistake you can force the copy with --rebuild.");
+                    ++assetsSkipped;
+                    BuildReport::RecordPage(sitePathRelative, BuildReport::Outcome::AssetSkipped, MillisecondsSince(startTime), {});
+                    continue;
+                }
+
+                Logging::LogWork("Asset file being copied directly without using esd features.");
+                EnsureOutputDirectory(outputPath.parent_path());
+                bool const copied = CopyAsset(path, outputPath);
+                if (copied) {
+                    uint64_t contentHash = 0;
+                    if (g_AssetOptions.HashContents) {
+                        contentHash = HashFile(path).value_or(0);
+                    }
+                    target.Manifest->RecordAsset(sitePathRelative, path, outputPath, contentHash);
+                    ++assetsCopied;
+                }
+
+                if (BuildReport::IsEnabled()) {
+                    PageRenderMetrics metrics;
+                    std::error_code error;
+                    metrics.BytesIn = sitePage.Stamp.has_value() ? static_cast<uint64_t>(sitePage.Stamp->Size) : std::filesystem::file_size(path, error);
+                    metrics.BytesOut = copied && !error ? metrics.BytesIn : 0;
+                    BuildReport::RecordPage(sitePathRelative, copied ? BuildReport::Outcome::AssetCopied : BuildReport::Outcome::Failed, MillisecondsSince(startTime), metrics);
+                }
+            }
+            Logging::LogWork("");
+        });
+    }
+
+    // Pages go through three stages at once: reading sources, rendering (on pool) and writing outputs. Bounded
+    // queues between the stages keep a stage that runs ahead from holding more than a few pages in memory.
+    size_t const renderThreads = pool.GetThreadCount();
+    size_t const ioThreads = std::min(renderThreads, k_MaxIoThreads);
+    BoundedQueue<std::unique_ptr<PageWork>> renderQueue(renderThreads * k_QueuedPagesPerThread);
+    BoundedQueue<std::unique_ptr<PageWork>> writeQueue(renderThreads * k_QueuedPagesPerThread);
+
+    std::mutex failureMutex;
+    std::exception_ptr failure;
+    auto const fail = [&]() {
+        {
+            std::lock_guard<std::mutex> lock(failureMutex);
+            if (!failure) {
+                failure = std::current_exception();
+            }
+        }
+        renderQueue.Abort();
+        writeQueue.Abort();
+    };
+
+    // Components are the same for every target, so are their stamps.
+    BuildManifest& componentManifest = *targets.front().Manifest;
+    PagePrograms::StampFunction const getComponentStamp = [&componentManifest](std::filesystem::path const& component) {
+        return componentManifest.GetComponentStamp(component.generic_string());
+    };
+
+    std::mutex stageMutex;
+    PipelineStageStats readStats { "Read", ioThreads };
+    PipelineStageStats renderStats { "Render", renderThreads };
+    PipelineStageStats writeStats { "Write", ioThreads };
+    auto const pipelineStart = std::chrono::steady_clock::now();
+
+    // Read: checks the manifest and loads the source of every page that needs rendering. Pages are taken a batch
+    // at a time so their files can be stat'ed and read together (see BatchIO.h).
+    std::atomic<size_t> nextPage = 0;
+    std::atomic<size_t> readersLeft = ioThreads;
+    std::vector<std::thread> readers;
+    for (size_t i = 0; i < ioThreads; ++i) {
+        readers.emplace_back([&, indentation]() {
+            auto span = Profiler::Span("Read Stage", "stage");
+            StageClock clock(readStats, stageMutex);
+            BatchIO io;
+            try {
+                std::vector<std::unique_ptr<PageWork>> batch;
+                std::vector<std::optional<BuildReport::Outcome>> outcomes;
+                std::vector<FileStatRequest> stamps;
+                std::vector<size_t> sourceStamps;
+                std::vector<FileReadRequest> reads;
+                std::vector<size_t> readPages;
+                std::vector<FileReadRequest> programReads;
+                std::vector<size_t> programPages;
+                bool stopped = false;
+                for (size_t first = nextPage.fetch_add(k_IoBatchSize); !stopped && first < sourcePages.size(); first = nextPage.fetch_add(k_IoBatchSize)) {
+                    size_t const last = std::min(first + k_IoBatchSize, sourcePages.size());
+                    uint64_t const syscallsBefore = Profiler::GetSyscallCount();
+                    batch.clear();
+                    for (size_t index = first; index < last; ++index) {
+                        SitePage const& sitePage = *sourcePages[index];
+                        if (cancel != nullptr && *cancel) {
+                            std::lock_guard<std::mutex> lock(unfinishedMutex);
+                            stats.Unfinished.push_back(sitePage.Path);
+                            continue;
+                        }
+
+                        auto work = std::make_unique<PageWork>();
+                        work->Page = &sitePage;
+                        work->Start = std::chrono::steady_clock::now();
+                        batch.push_back(std::move(work));
+                    }
+                    if (batch.empty()) {
+                        continue;
+                    }
+
+                    // Every page's outputs are stat'ed at once (with the sources the walk didn't stat), then the
+                    // sources that need rendering are read at once.
+                    stamps.clear();
+                    sourceStamps.assign(batch.size(), SIZE_MAX);
+                    for (std::unique_ptr<PageWork> const& work : batch) {
+                        for (SiteTarget const& target : targets) {
+                            stamps.emplace_back().Path = target.PublicPath / work->Page->SitePathRelative;
+                        }
+                    }
+                    for (size_t page = 0; page < batch.size(); ++page) {
+                        if (!batch[page]->Page->Stamp.has_value()) {
+                            sourceStamps[page] = stamps.size();
+                            stamps.emplace_back().Path = batch[page]->Page->Path;
+                        }
+                    }
+                    io.Stat(stamps);
+
+                    outcomes.assign(batch.size(), std::nullopt);
+                    reads.clear();
+                    readPages.clear();
+                    programReads.clear();
+                    programPages.clear();
+                    for (size_t page = 0; page < batch.size(); ++page) {
+                        PageWork& work = *batch[page];
+                        SitePage const& sitePage = *work.Page;
+                        bool const sourceExists = sourceStamps[page] == SIZE_MAX || stamps[sourceStamps[page]].IsRegularFile;
+                        work.SourceStamp = sourceStamps[page] == SIZE_MAX ? sitePage.Stamp.value() : stamps[sourceStamps[page]].Stamp;
+
+                        // Keep all of this page's logs together in the output.
+                        auto group = Logging::GroupScope(indentation, work.Logs);
+                        for (size_t target = 0; target < targets.size(); ++target) {
+                            FileStatRequest& output = stamps[page * targets.size() + target];
+                            BuildManifest& manifest = *targets[target].Manifest;
+                            if (!forceRender && manifest.CheckPageUpToDate(sitePage.SitePathRelative, work.SourceStamp, output.Stamp)) {
+                                ++pagesSkipped;
+                                continue;
+                            }
+                            PageOutput& pageOutput = work.Outputs.emplace_back();
+                            pageOutput.Target = &targets[target];
+                            pageOutput.Path = std::move(output.Path);
+                            pageOutput.Stamp = output.Stamp;
+                            pageOutput.PreviousHash = manifest.GetOutputHash(sitePage.SitePathRelative, output.Stamp);
+                        }
+                        if (work.Outputs.empty()) {
+                            Logging::LogWorkVerbose("Unchanged, skipping: %s", sitePage.Path.string().c_str());
+                            outcomes[page] = BuildReport::Outcome::Skipped;
+                            continue;
+                        }
+
+                        Logging::LogWork("Source File: %s", sitePage.Path.string().c_str());
+                        for (PageOutput const& output : work.Outputs) {
+                            Logging::LogWork("Output: %s", output.Path.string().c_str());
+                        }
+                        if (!sourceExists) {
+                            Logging::LogError("File not found: %s", sitePage.Path.string().c_str());
+                            Logging::LogWork("");
+                            outcomes[page] = BuildReport::Outcome::Failed;
+                            continue;
+                        }
+                        if (static_cast<uint64_t>(work.SourceStamp.Size) > g_StreamThreshold) {
+                            work.Streamed = true;
+                            continue;
+                        }
+                        if (g_PageProgramOptions.Load || g_PageProgramOptions.Save) {
+                            programReads.emplace_back().Path = PagePrograms::GetPath(sitePage.SitePathRelative);
+                            programPages.push_back(page);
+                            if (g_PageProgramOptions.Load) {
+                                continue;
+                            }
+                        }
+                        reads.emplace_back().Path = sitePage.Path;
+                        readPages.push_back(page);
+                    }
+
+                    // Pages with an up to date program don't need their source, the rest are read with the others.
+                    io.Read(programReads);
+                    for (size_t read = 0; read < programReads.size(); ++read) {
+                        PageWork& work = *batch[programPages[read]];
+                        if (!g_PageProgramOptions.Load) {
+                            // Only kept so an identical program isn't written again.
+                            if (programReads[read].Succeeded) {
+                                work.SavedProgram = std::move(programReads[read].File);
+                            }
+                            continue;
+                        }
+                        if (programReads[read].Succeeded) {
+                            auto group = Logging::GroupScope(indentation, work.Logs);
+                            work.Program = PagePrograms::TryOpen(std::move(programReads[read].File), work.Page->SitePathRelative, work.SourceStamp, getComponentStamp);
+                        }
+                        if (!work.Program) {
+                            reads.emplace_back().Path = work.Page->Path;
+                            readPages.push_back(programPages[read]);
+                        }
+                    }
+
+                    io.Read(reads);
+                    for (size_t read = 0; read < reads.size(); ++read) {
+                        PageWork& work = *batch[readPages[read]];
+                        if (reads[read].Succeeded) {
+                            work.Source = std::move(reads[read].File);
+                            continue;
+                        }
+                        auto group = Logging::GroupScope(indentation, work.Logs);
+                        Logging::LogError("Could not open the source file for reading: %s", work.Page->Path.string().c_str());
+                        Logging::LogWork("");
+                        outcomes[readPages[read]] = BuildReport::Outcome::Failed;
+                    }
+
+                    // The batch's time and syscalls are shared evenly between its pages.
+                    double const milliseconds = clock.Lap(clock.Busy) * 1000.0 / static_cast<double>(batch.size());
+                    double const syscalls = static_cast<double>(Profiler::GetSyscallCount() - syscallsBefore) / static_cast<double>(batch.size());
+                    clock.Items += static_cast<int>(batch.size());
+
+                    for (size_t page = 0; page < batch.size(); ++page) {
+                        PageWork& work = *batch[page];
+                        work.Milliseconds += milliseconds;
+                        work.Syscalls += syscalls;
+                        if (outcomes[page].has_value()) {
+                            // Nothing more to do for this page.
+                            work.Logs.Print();
+                            ProfilePage(work);
+                            BuildReport::RecordPage(work.Page->SitePathRelative, outcomes[page].value(), work.Milliseconds, {});
+                            continue;
+                        }
+                        if (!renderQueue.Push(std::move(batch[page]))) {
+                            stopped = true;
+                            break;
+                        }
+                    }
+                    clock.Lap(clock.Blocked);
+                }
+            } catch (...) {
+                fail();
+            }
+            if (--readersLeft == 0) {
+                renderQueue.Close();
+            }
+        });
+    }
+
+    // Render: turns each source into its outputs, entirely in memory. Streamed pages are written here too.
+    std::atomic<size_t> renderersLeft = renderThreads;
+    for (size_t i = 0; i < renderThreads; ++i) {
+        pool.Submit([&, indentation]() {
+            auto span = Profiler::Span("Render Stage", "stage");
+            StageClock clock(renderStats, stageMutex);
+            try {
+                while (std::optional<std::unique_ptr<PageWork>> next = renderQueue.Pop()) {
+                    clock.Lap(clock.Starved);
+                    PageWork& work = **next;
+                    {
+                        auto group = Logging::GroupScope(indentation, work.Logs);
+                        auto page = Profiler::PageScope(work.Page->Path);
+                        auto pageSpan = Profiler::Span("Render Page", "page");
+                        pageSpan.SetPath(work.Page->Path);
+                        uint64_t const syscallsBefore = Profiler::GetSyscallCount();
+
+                        if (work.Streamed) {
+                            for (PageOutput& output : work.Outputs) {
+                                RenderPageStreaming(work.Page->Path, output.Path, *output.Target->Vars, output.Result);
+                            }
+                        } else {
+                            RenderPageOutputs(work, getComponentStamp);
+                        }
+                        work.Syscalls += static_cast<double>(Profiler::GetSyscallCount() - syscallsBefore);
+                    }
+                    work.Milliseconds += clock.Lap(clock.Busy) * 1000.0;
+                    ++clock.Items;
+
+                    if (!writeQueue.Push(std::move(*next))) {
+                        break;
+                    }
+                    clock.Lap(clock.Blocked);
+                }
+            } catch (...) {
+                fail();
+            }
+            if (--renderersLeft == 0) {
+                writeQueue.Close();
+            }
+        });
+    }
+
+    // Write: writes outputs that changed and records the pages in the manifests. Like reading, whatever is waiting
+    // to be written (up to a batch) is written at once.
+    std::vector<std::thread> writers;
+    for (size_t i = 0; i < ioThreads; ++i) {
+        writers.emplace_back([&, indentation]() {
+            auto span = Profiler::Span("Write Stage", "stage");
+            StageClock clock(writeStats, stageMutex);
+            BatchIO io;
+            try {
+                std::vector<FileWriteRequest> writes;
+                std::vector<size_t> writePages;
+                std::vector<PageOutput*> writeOutputs;
+                std::vector<FileStatRequest> stamps;
+                for (std::vector<std::unique_ptr<PageWork>> batch = writeQueue.PopSome(k_IoBatchSize); !batch.empty(); batch = writeQueue.PopSome(k_IoBatchSize)) {
+                    clock.Lap(clock.Starved);
+                    uint64_t const syscallsBefore = Profiler::GetSyscallCount();
+
+                    writes.clear();
+                    writePages.clear();
+                    writeOutputs.clear();
+                    for (size_t page = 0; page < batch.size(); ++page) {
+                        PageWork& work = *batch[page];
+                        auto group = Logging::GroupScope(indentation, work.Logs);
+                        auto pageScope = Profiler::PageScope(work.Page->Path);
+                        if (work.Streamed) {
+                            continue;
+                        }
+                        for (PageOutput& output : work.Outputs) {
+                            // Leaving identical output alone keeps its modification time, so syncing and caching see no change.
+                            if (IsPageOutputUnchanged(output.Path, output.Text, output.Result.OutputHash, output.PreviousHash)) {
+                                if (targets.size() == 1) {
+                                    Logging::LogWork("Output is unchanged. Skipping write step.");
+                                } else {
+                                    Logging::LogWork("%s is unchanged. Skipping write step.", output.Path.string().c_str());
+                                }
+                                continue;
+                            }
+                            EnsureOutputDirectory(output.Path.parent_path());
+                            writes.push_back({ output.Path, output.Text });
+                            writePages.push_back(page);
+                            writeOutputs.push_back(&output);
+                        }
+                    }
+                    // Programs go out with the outputs.
+                    size_t const outputWrites = writes.size();
+                    for (size_t page = 0; page < batch.size(); ++page) {
+                        PageWork const& work = *batch[page];
+                        if (!work.ProgramData.empty() && work.ProgramData != work.SavedProgram.GetText()) {
+                            EnsureOutputDirectory(GetPageProgramPath());
+                            writes.push_back({ PagePrograms::GetPath(work.Page->SitePathRelative), work.ProgramData });
+                            writePages.push_back(page);
+                        }
+                    }
+
+                    io.Write(writes);
+                    for (size_t write = outputWrites; write < writes.size(); ++write) {
+                        if (!writes[write].Succeeded) {
+                            // Only costs the next run a render from source.
+                            auto group = Logging::GroupScope(indentation, batch[writePages[write]]->Logs);
+                            Logging::LogWarning("Couldn't save the compiled page: %s", writes[write].Path.string().c_str());
+                        }
+                    }
+                    for (size_t write = 0; write < outputWrites; ++write) {
+                        if (!writes[write].Succeeded) {
+                            PageWork& work = *batch[writePages[write]];
+                            {
+                                auto group = Logging::GroupScope(indentation, work.Logs);
+                                Logging::LogError("Could not open output file for writing: %s", writes[write].Path.string().c_str());
+                            }
+                            // Print why before the build stops.
+                            work.Logs.Print();
+                            throw std::runtime_error("Could not open output file for writing.");
+                        }
+                        writeOutputs[write]->Result.Written = true;
+                    }
+
+                    // The manifests remember the outputs as they are now. Outputs that weren't written still have the
+                    // stamp the read stage found.
+                    stamps.clear();
+                    writeOutputs.clear();
+                    for (std::unique_ptr<PageWork> const& work : batch) {
+                        for (PageOutput& output : work->Outputs) {
+                            if (output.Result.Written) {
+                                stamps.emplace_back().Path = output.Path;
+                                writeOutputs.push_back(&output);
+                            }
+                        }
+                    }
+                    io.Stat(stamps);
+                    for (size_t write = 0; write < writeOutputs.size(); ++write) {
+                        writeOutputs[write]->Stamp = stamps[write].Stamp;
+                    }
+
+                    double const milliseconds = clock.Lap(clock.Busy) * 1000.0 / static_cast<double>(batch.size());
+                    double const syscalls = static_cast<double>(Profiler::GetSyscallCount() - syscallsBefore) / static_cast<double>(batch.size());
+                    clock.Items += static_cast<int>(batch.size());
+
+                    for (std::unique_ptr<PageWork> const& page : batch) {
+                        PageWork& work = *page;
+                        work.Milliseconds += milliseconds;
+                        work.Syscalls += syscalls;
+                        {
+                            auto group = Logging::GroupScope(indentation, work.Logs);
+                            for (PageOutput const& output : work.Outputs) {
+                                // Not rendered when a streamed page's source couldn't be read (the reason is logged).
+                                if (output.Result.Rendered) {
+                                    output.Target->Manifest->RecordPage(work.Page->SitePathRelative, work.SourceStamp, output.Stamp, output.Result.Components, output.Result.UsesVars, output.Result.OutputHash);
+                                }
+                            }
+                            Logging::LogWork("");
+                        }
+                        work.Logs.Print();
+                        ProfilePage(work);
+                        for (PageOutput const& output : work.Outputs) {
+                            BuildReport::Outcome outcome = BuildReport::Outcome::Failed;
+                            if (output.Result.Rendered) {
+                                ++pagesRendered;
+                                if (output.Result.Written) {
+                                    ++pagesWritten;
+                                }
+                                outcome = output.Result.Written ? BuildReport::Outcome::Written : BuildReport::Outcome::Unchanged;
+                            }
+                            BuildReport::RecordPage(work.Page->SitePathRelative, outcome, work.Milliseconds, output.Result.Metrics);
+                        }
+                    }
+                }
+            } catch (...) {
+                fail();
+            }
+        });
+    }
+    for (std::thread& reader : readers) {
+        reader.join();
+    }
+    pool.Wait();
+    for (std::thread& writer : writers) {
+        writer.join();
+    }
+    assetPool.Wait();
+
+    if (failure) {
+        std::rethrow_exception(failure);
+    }
+
+    double const pipelineSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - pipelineStart).count();
+    for (PipelineStageStats const& stage : { readStats, renderStats, writeStats }) {
+        double const available = pipelineSeconds * static_cast<double>(stage.Threads);
+        auto const percent = [available](double seconds) { return available > 0.0 ? 100.0 * seconds / available : 0.0; };
+        Logging::LogWorkVerbose("%s stage: %d page%s on %d thread%s, %.0f%% busy, %.0f%% waiting for pages, %.0f%% waiting for the next stage.",
+            stage.Name, stage.Items, stage.Items == 1 ? "" : "s", static_cast<int>(stage.Threads), stage.Threads == 1 ? "" : "s",
+            percent(stage.BusySeconds), percent(stage.StarvedSeconds), percent(stage.BlockedSeconds));
+    }
+    stats.Stages = { readStats, renderStats, writeStats };
+    stats.PipelineSeconds = pipelineSeconds;
+
+    stats.PagesRendered = pagesRendered;
+    stats.PagesSkipped = pagesSkipped;
+    stats.PagesWritten = pagesWritten;
+    stats.AssetsCopied = assetsCopied;
+    stats.AssetsSkipped = assetsSkipped;
+    return stats;
+}
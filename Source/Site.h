@@ -0,0 +1,104 @@
+#pragma once
+
+#include "BuildManifest.h"
+
+#include <atomic>
+#include <filesystem>
+#include <optional>
+#include <vector>
+
+class BuildManifest;
+class ThreadPool;
+class VarsCollection;
+
+// Loads Vars.txt (see GetVarsPath), logging what was loaded. Returns {} if there is no usable Vars.txt.
+std::optional<VarsCollection> LoadSiteVars();
+
+// As above for any vars file, using (and keeping up to date) the compiled copy at snapshotPath (see VarsSnapshot.h).
+std::optional<VarsCollection> LoadVarsFile(std::filesystem::path const& varsPath, std::filesystem::path const& snapshotPath);
+
+// A file in Private/Site, with what finding it already told us so the render pipeline doesn't ask again.
+struct SitePage {
+    std::filesystem::path Path;
+    // Path relative to Private/Site, which is also where it goes relative to Public.
+    std::filesystem::path SitePathRelative;
+    std::filesystem::path OutputPath;
+    // The source's stamp as of the walk, {} when the page wasn't found by a walk (see MakeSitePage).
+    std::optional<FileStamp> Stamp;
+};
+
+// Every regular file in Private/Site (following symbolic links to files, not to directories), stat'ed as it's found.
+// The site is read one directory at a time straight from the file system, each directory is opened once and the
+// type of every entry comes with it so only files are stat'ed. The walk shows up in the profile with its syscalls.
+std::vector<SitePage> FindSitePages();
+
+// A page known only by its path (inside Private/Site), ie: one a watch reported as changed.
+SitePage MakeSitePage(std::filesystem::path const& path);
+
+// How one stage of the render pipeline spent its time, see RenderPages.
+struct PipelineStageStats {
+    char const* Name = "";
+    size_t Threads = 0;
+    int Items = 0;
+    // Summed over all of the stage's threads.
+    double BusySeconds = 0.0;
+    // Waiting for the stage before to hand over a page.
+    double StarvedSeconds = 0.0;
+    // Waiting for the stage after to make room for a page.
+    double BlockedSeconds = 0.0;
+};
+
+struct SiteRenderStats {
+    int PagesRendered = 0;
+    int PagesSkipped = 0;
+    // Rendered pages whose output changed. The rest rendered to what was already in Public and weren't written.
+    int PagesWritten = 0;
+    int AssetsCopied = 0;
+    int AssetsSkipped = 0;
+    // Pages that were never started because the render was cancelled.
+    std::vector<std::filesystem::path> Unfinished;
+    // Read, render and write, with how long the pipeline ran for.
+    std::vector<PipelineStageStats> Stages;
+    double PipelineSeconds = 0.0;
+
+    // Files in Public that were written this run, and files that were left as they were.
+    int FilesRewritten() const { return PagesWritten + AssetsCopied; }
+    int FilesUntouched() const { return (PagesRendered - PagesWritten) + PagesSkipped + AssetsSkipped; }
+};
+
+// One copy of the site to render: the variables its pages see, where they go and the manifest that remembers them.
+// A normal build has one, a variant build one per variant (see Variants.h).
+struct SiteTarget {
+    std::optional<VarsCollection> const* Vars = nullptr;
+    BuildManifest* Manifest = nullptr;
+    // Takes the place of Public.
+    std::filesystem::path PublicPath;
+};
+
+// Renders pages (see FindSitePages) and records them in the manifest.
+// Pages go through a pipeline: a few threads read sources, pool renders them and a few more threads write the
+// outputs, so reads and writes for some pages overlap rendering others. Per stage utilization is logged with -v.
+// Assets (see Assets.h) are copied on assetPool at the same time, so large copies don't hold up rendering.
+// Pages and assets the manifest considers up to date are skipped unless forceRender is set.
+// Once cancel becomes true pages that haven't started yet are left alone and returned as Unfinished.
+SiteRenderStats RenderPages(
+    std::vector<SitePage> const& pages, 
+    std::optional<VarsCollection> const& vars, 
+    BuildManifest& manifest, 
+    ThreadPool& pool, 
+    ThreadPool& assetPool, 
+    bool forceRender, 
+    std::atomic<bool> const* cancel = nullptr);
+
+// As above for several targets at once. Each page is read, expanded and compiled once, and only substituted again
+// for every other target that needs it (see PageProgram.h). Pages that don't read Vars.txt render the same for
+// every target, so they're only rendered once. Assets are copied into every target.
+// Each target's manifest decides on its own which of its pages are up to date. Stats are counted per output, so a
+// page rendered for three targets counts three times.
+SiteRenderStats RenderPages(
+    std::vector<SitePage> const& pages, 
+    std::vector<SiteTarget> const& targets, 
+    ThreadPool& pool, 
+    ThreadPool& assetPool, 
+    bool forceRender, 
+    std::atomic<bool> const* cancel = nullptr);
@@ -0,0 +1,133 @@
+#include "Symbols.h"
+
+#include <cstring>
+#include <functional>
+#include <mutex>
+
+namespace {
+    constexpr size_t k_InitialSlots = 1024;
+    constexpr size_t k_NameBlockSize = 64 * 1024;
+
+    size_t HashName(std::string_view name) {
+        return std::hash<std::string_view>()(name);
+    }
+}
+
+//static
+SymbolTable& SymbolTable::Get() {
+    static SymbolTable s_Table;
+    return s_Table;
+}
+
+SymbolId SymbolTable::Intern(std::string_view name) {
+    size_t const hash = HashName(name);
+    {
+        std::shared_lock<std::shared_mutex> lock(m_Mutex);
+        SymbolId const found = FindLocked(name, hash);
+        if(found != k_NoSymbol) {
+            return found;
+        }
+    }
+
+    std::unique_lock<std::shared_mutex> lock(m_Mutex);
+    // Another thread may have interned it while we weren't holding the lock.
+    SymbolId const found = FindLocked(name, hash);
+    if(found != k_NoSymbol) {
+        return found;
+    }
+    return InsertLocked(name, hash);
+}
+
+void SymbolTable::InternAll(std::vector<std::string_view> const& names, std::vector<SymbolId>& ids) {
+    ids.resize(names.size());
+
+    std::unique_lock<std::shared_mutex> lock(m_Mutex);
+    for(size_t i = 0; i < names.size(); ++i) {
+        size_t const hash = HashName(names[i]);
+        SymbolId const found = FindLocked(names[i], hash);
+        ids[i] = found != k_NoSymbol ? found : InsertLocked(names[i], hash);
+    }
+}
+
+std::optional<SymbolId> SymbolTable::Find(std::string_view name) const {
+    size_t const hash = HashName(name);
+    std::shared_lock<std::shared_mutex> lock(m_Mutex);
+    SymbolId const found = FindLocked(name, hash);
+    if(found == k_NoSymbol) {
+        return {};
+    }
+    return found;
+}
+
+std::string_view SymbolTable::GetName(SymbolId id) const {
+    std::shared_lock<std::shared_mutex> lock(m_Mutex);
+    return m_Names[id];
+}
+
+SymbolId SymbolTable::FindLocked(std::string_view name, size_t hash) const {
+    if(m_Slots.empty()) {
+        return k_NoSymbol;
+    }
+    size_t const mask = m_Slots.size() - 1;
+    for(size_t index = hash & mask; ; index = (index + 1) & mask) {
+        Slot const& slot = m_Slots[index];
+        if(slot.Id == k_NoSymbol) {
+            return k_NoSymbol;
+        }
+        if(slot.Hash == hash && m_Names[slot.Id] == name) {
+            return slot.Id;
+        }
+    }
+}
+
+SymbolId SymbolTable::InsertLocked(std::string_view name, size_t hash) {
+    if((m_Names.size() + 1) * 2 > m_Slots.size()) {
+        Grow();
+    }
+
+    SymbolId const id = static_cast<SymbolId>(m_Names.size());
+    m_Names.push_back(StoreName(name));
+
+    size_t const mask = m_Slots.size() - 1;
+    size_t index = hash & mask;
+    while(m_Slots[index].Id != k_NoSymbol) {
+        index = (index + 1) & mask;
+    }
+    m_Slots[index] = {hash, id};
+    return id;
+}
+
+std::string_view SymbolTable::StoreName(std::string_view name) {
+    if(name.size() > k_NameBlockSize / 4) {
+        // Long names get a block of their own rather than wasting the rest of the current one.
+        m_Blocks.push_back(std::unique_ptr<char[]>(new char[name.size()]));
+        std::memcpy(m_Blocks.back().get(), name.data(), name.size());
+        return std::string_view(m_Blocks.back().get(), name.size());
+    }
+
+    if(m_CurrentBlock == nullptr || m_BlockUsed + name.size() > k_NameBlockSize) {
+        m_Blocks.push_back(std::unique_ptr<char[]>(new char[k_NameBlockSize]));
+        m_CurrentBlock = m_Blocks.back().get();
+        m_BlockUsed = 0;
+    }
+    char* const storage = m_CurrentBlock + m_BlockUsed;
+    std::memcpy(storage, name.data(), name.size());
+    m_BlockUsed += name.size();
+    return std::string_view(storage, name.size());
+}
+
+void SymbolTable::Grow() {
+    std::vector<Slot> slots(m_Slots.empty() ? k_InitialSlots : m_Slots.size() * 2);
+    size_t const mask = slots.size() - 1;
+    for(Slot const& slot : m_Slots) {
+        if(slot.Id == k_NoSymbol) {
+            continue;
+        }
+        size_t index = slot.Hash & mask;
+        while(slots[index].Id != k_NoSymbol) {
+            index = (index + 1) & mask;
+        }
+        slots[index] = slot;
+    }
+    m_Slots = std::move(slots);
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <shared_mutex>
+#include <string_view>
+#include <vector>
+
+// Identifies an interned variable name. Ids are small, dense and never reused, so they can index arrays.
+using SymbolId = uint32_t;
+constexpr SymbolId k_NoSymbol = ~SymbolId(0);
+
+/**************************************************************************************************
+Symbol Table:
+    A process-wide table of variable names. Every distinct name is stored once and given a
+    SymbolId the first time it's interned.
+
+    Vars collections store their values by id, and statements in cached components resolve their
+    name to an id once when the component is loaded. After that substituting a variable is an
+    array lookup instead of hashing its name again on every render.
+
+    Names are copied into large blocks and found through an open addressing table of
+    (hash, id) pairs, so looking up a string_view never allocates and rarely touches more than
+    one cache line besides the name itself. The table is safe to use from multiple threads.
+**************************************************************************************************/
+class SymbolTable
+{
+public:
+    static SymbolTable& Get();
+
+    // Returns the id of name, adding it to the table if it's new.
+    SymbolId Intern(std::string_view name);
+
+    // Interns many names while only taking the table's lock once. ids is resized to match names.
+    void InternAll(std::vector<std::string_view> const& names, std::vector<SymbolId>& ids);
+
+    // Returns the id of name if it has been interned.
+    std::optional<SymbolId> Find(std::string_view name) const;
+
+    // The name an id was interned from.
+    std::string_view GetName(SymbolId id) const;
+
+private:
+    struct Slot {
+        size_t Hash = 0;
+        SymbolId Id = k_NoSymbol;
+    };
+
+    SymbolTable() = default;
+
+    // Both expect m_Mutex to be held.
+    SymbolId FindLocked(std::string_view name, size_t hash) const;
+    SymbolId InsertLocked(std::string_view name, size_t hash);
+
+    std::string_view StoreName(std::string_view name);
+    void Grow();
+
+    mutable std::shared_mutex m_Mutex;
+    // Indexed by SymbolId, the views point into m_Blocks.
+    std::vector<std::string_view> m_Names;
+    // Size is a power of two. Kept at most half full.
+    std::vector<Slot> m_Slots;
+    // Blocks never move, so views into them stay valid as names are added.
+    std::vector<std::unique_ptr<char[]>> m_Blocks;
+    // The block new names are added to and how much of it is used.
+    char* m_CurrentBlock = nullptr;
+    size_t m_BlockUsed = 0;
+};
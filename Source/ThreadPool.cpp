@@ -0,0 +1,139 @@
+#include "ThreadPool.h"
+
+namespace {
+    // The pool and queue index of the worker running on the current thread, used so tasks
+    // submitted from inside a task land in the submitting worker's own queue.
+    thread_local ThreadPool const* s_CurrentPool = nullptr;
+    thread_local size_t s_CurrentWorkerIndex = 0;
+}
+
+ThreadPool::ThreadPool(size_t threadCount) {
+    if(threadCount == 0) {
+        threadCount = 1;
+    }
+
+    m_Queues.reserve(threadCount);
+    for(size_t i = 0; i < threadCount; ++i) {
+        m_Queues.push_back(std::make_unique<WorkerQueue>());
+    }
+
+    m_Threads.reserve(threadCount);
+    for(size_t i = 0; i < threadCount; ++i) {
+        m_Threads.emplace_back([this, i]() { WorkerMain(i); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::unique_lock<std::mutex> lock(m_StateMutex);
+        m_AllTasksDone.wait(lock, [this]() { return m_Pending == 0; });
+        m_Stopping = true;
+    }
+    m_WorkAvailable.notify_all();
+
+    for(std::thread& thread : m_Threads) {
+        thread.join();
+    }
+}
+
+void ThreadPool::Submit(std::function<void()> task) {
+    size_t const queueIndex = (s_CurrentPool == this)
+        ? s_CurrentWorkerIndex
+        : (m_NextQueue++ % m_Queues.size());
+
+    ++m_Pending;
+    {
+        // Incremented under the state mutex so a worker about to sleep can't miss the new task, and before the task
+        // is queued so a worker that takes it straight away never brings the count below zero.
+        std::lock_guard<std::mutex> lock(m_StateMutex);
+        ++m_Queued;
+    }
+    {
+        WorkerQueue& queue = *m_Queues[queueIndex];
+        std::lock_guard<std::mutex> lock(queue.Mutex);
+        queue.Tasks.push_back(std::move(task));
+    }
+    m_WorkAvailable.notify_one();
+}
+
+void ThreadPool::Wait() {
+    std::exception_ptr exception;
+    {
+        std::unique_lock<std::mutex> lock(m_StateMutex);
+        m_AllTasksDone.wait(lock, [this]() { return m_Pending == 0; });
+        std::swap(exception, m_FirstException);
+    }
+
+    if(exception) {
+        std::rethrow_exception(exception);
+    }
+}
+
+size_t ThreadPool::GetThreadCount() const {
+    return m_Threads.size();
+}
+
+//static
+size_t ThreadPool::GetDefaultThreadCount() {
+    unsigned int const hardwareThreads = std::thread::hardware_concurrency();
+    return hardwareThreads == 0 ? 1 : static_cast<size_t>(hardwareThreads);
+}
+
+bool ThreadPool::TryTakeTask(size_t workerIndex, std::function<void()>& task) {
+    // Our own queue first, oldest task first so pages are worked on roughly in the order they were submitted.
+    {
+        WorkerQueue& queue = *m_Queues[workerIndex];
+        std::lock_guard<std::mutex> lock(queue.Mutex);
+        if(!queue.Tasks.empty()) {
+            task = std::move(queue.Tasks.front());
+            queue.Tasks.pop_front();
+            --m_Queued;
+            return true;
+        }
+    }
+
+    // Then steal from the back of everyone else's.
+    for(size_t offset = 1; offset < m_Queues.size(); ++offset) {
+        WorkerQueue& queue = *m_Queues[(workerIndex + offset) % m_Queues.size()];
+        std::lock_guard<std::mutex> lock(queue.Mutex);
+        if(!queue.Tasks.empty()) {
+            task = std::move(queue.Tasks.back());
+            queue.Tasks.pop_back();
+            --m_Queued;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::WorkerMain(size_t workerIndex) {
+    s_CurrentPool = this;
+    s_CurrentWorkerIndex = workerIndex;
+
+    while(true) {
+        std::function<void()> task;
+        if(TryTakeTask(workerIndex, task)) {
+            try {
+                task();
+            }
+            catch(...) {
+                std::lock_guard<std::mutex> lock(m_StateMutex);
+                if(!m_FirstException) {
+                    m_FirstException = std::current_exception();
+                }
+            }
+
+            if(--m_Pending == 0) {
+                std::lock_guard<std::mutex> lock(m_StateMutex);
+                m_AllTasksDone.notify_all();
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_StateMutex);
+        m_WorkAvailable.wait(lock, [this]() { return m_Stopping || m_Queued > 0; });
+        if(m_Stopping && m_Queued == 0) {
+            return;
+        }
+    }
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**************************************************************************************************
+Thread Pool:
+    A fixed size pool of worker threads with work stealing.
+
+    Every worker owns a queue of tasks. Tasks submitted from outside the pool are spread across
+    the queues round-robin, tasks submitted from inside a worker go to that worker's own queue.
+    A worker takes work from the front of its own queue and once that is empty it steals from
+    the back of the other workers' queues.
+
+    If a task throws, the first exception is kept and rethrown from Wait().
+**************************************************************************************************/
+class ThreadPool
+{
+public:
+    explicit ThreadPool(size_t threadCount);
+    // Waits for all submitted tasks to finish before joining the worker threads.
+    ~ThreadPool();
+
+    ThreadPool(ThreadPool const&)            = delete;
+    ThreadPool& operator=(ThreadPool const&) = delete;
+
+    void Submit(std::function<void()> task);
+
+    // Blocks until every submitted task has finished. Rethrows the first exception a task threw.
+    void Wait();
+
+    size_t GetThreadCount() const;
+
+    // The number of threads to use when the user doesn't ask for a specific amount.
+    static size_t GetDefaultThreadCount();
+
+private:
+    struct WorkerQueue {
+        std::mutex Mutex;
+        std::deque<std::function<void()>> Tasks;
+    };
+
+    bool TryTakeTask(size_t workerIndex, std::function<void()>& task);
+    void WorkerMain(size_t workerIndex);
+
+    std::vector<std::unique_ptr<WorkerQueue>> m_Queues;
+    std::vector<std::thread> m_Threads;
+
+    std::mutex m_StateMutex;
+    std::condition_variable m_WorkAvailable;
+    std::condition_variable m_AllTasksDone;
+
+    // Tasks sitting in a queue waiting for a worker. Counted just before they're queued, so it can briefly be ahead.
+    std::atomic<size_t> m_Queued = 0;
+    // Tasks submitted but not yet finished (queued or running).
+    std::atomic<size_t> m_Pending = 0;
+    std::atomic<size_t> m_NextQueue = 0;
+    bool m_Stopping = false;
+    std::exception_ptr m_FirstException;
+};
@@ -0,0 +1,74 @@
+#include "Variants.h"
+
+#include "Logging.h"
+#include "Paths.h"
+
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string_view>
+
+namespace {
+    constexpr std::string_view k_VariantPlaceholder = "{variant}";
+
+    // outputPattern with every {variant} replaced by name.
+    std::filesystem::path GetVariantPublicPath(std::string const& outputPattern, std::string const& name) {
+        std::string path = outputPattern;
+        for(size_t at = path.find(k_VariantPlaceholder); at != std::string::npos; at = path.find(k_VariantPlaceholder, at + name.size())) {
+            path.replace(at, k_VariantPlaceholder.size(), name);
+        }
+        return std::filesystem::path(path).make_preferred();
+    }
+}
+
+std::vector<std::unique_ptr<SiteVariant>> LoadSiteVariants(std::vector<std::filesystem::path> const& varsPaths, std::string const& outputPattern, bool fullRebuild) {
+    if(varsPaths.size() > 1 && outputPattern.find(k_VariantPlaceholder) == std::string::npos) {
+        throw std::runtime_error("--out has no {variant} in it, every variant would be written to " + outputPattern + ".");
+    }
+
+    auto loadingJob = Logging::JobScope("Loading Variants");
+    std::vector<std::unique_ptr<SiteVariant>> variants;
+    std::set<std::string> names;
+    for(std::filesystem::path const& varsPath : varsPaths) {
+        std::error_code error;
+        if(!std::filesystem::is_regular_file(varsPath, error)) {
+            std::stringstream errorText;
+            errorText << varsPath << " does not exist or is not a file.\n";
+            Logging::AppendFileDetails(errorText, varsPath);
+            throw std::runtime_error(errorText.str());
+        }
+
+        auto variant = std::make_unique<SiteVariant>();
+        variant->Name = varsPath.stem().string();
+        if(!names.insert(variant->Name).second) {
+            throw std::runtime_error("More than one vars file makes the variant \"" + variant->Name + "\", variants are named after their file so they need different names.");
+        }
+        variant->VarsPath = varsPath;
+        variant->PublicPath = GetVariantPublicPath(outputPattern, variant->Name);
+        Logging::LogWork("Variant %s: %s, written to %s", variant->Name.c_str(), varsPath.string().c_str(), variant->PublicPath.string().c_str());
+
+        variant->Vars = LoadVarsFile(varsPath, GetVariantVarsSnapshotPath(variant->Name));
+        // Each variant remembers its own outputs, so changing one vars file leaves the other variants alone.
+        if(!fullRebuild) {
+            variant->Manifest.Load(GetVariantManifestPath(variant->Name));
+        }
+        variant->Manifest.BeginRun(FileStamp::Of(varsPath));
+        variants.push_back(std::move(variant));
+    }
+    return variants;
+}
+
+SiteRenderStats RenderSiteVariants(std::vector<std::unique_ptr<SiteVariant>> const& variants, ThreadPool& pool, ThreadPool& assetPool, bool forceRender) {
+    std::vector<SiteTarget> targets;
+    targets.reserve(variants.size());
+    for(std::unique_ptr<SiteVariant> const& variant : variants) {
+        targets.push_back({ &variant->Vars, &variant->Manifest, variant->PublicPath });
+    }
+
+    SiteRenderStats const stats = RenderPages(FindSitePages(), targets, pool, assetPool, forceRender);
+
+    for(std::unique_ptr<SiteVariant> const& variant : variants) {
+        variant->Manifest.Save(GetVariantManifestPath(variant->Name));
+    }
+    return stats;
+}
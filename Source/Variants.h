@@ -0,0 +1,51 @@
+#pragma once
+
+#include "BuildManifest.h"
+#include "Site.h"
+#include "VarsCollection.h"
+
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+class ThreadPool;
+
+/**************************************************************************************************
+Variants:
+    One site built against several vars files in a single run (--variants), ie: one per locale
+    or theme. Each vars file is a variant named after the file (vars/en-US.txt is "en-US"), and
+    its pages go where --out says with {variant} replaced by that name (Public/{variant} unless
+    --out is given).
+
+        esd --variants vars/en-US.txt vars/fr-FR.txt --out Public/{variant}
+
+    The site is walked once and each page is read, expanded and compiled once (see RenderPages
+    in Site.h). Every variant then costs one substitution pass per page that uses its variables.
+    Pages that don't use any are rendered once and written to every variant as they are. Assets
+    are copied into every variant.
+
+    Each variant has its own manifest and compiled vars in .esd/variants/<name>, so changing one
+    vars file only renders that variant's pages again. Component snapshots and page programs
+    don't depend on variables, so every variant (and normal builds) share them.
+**************************************************************************************************/
+
+// The pattern pages go to when --out isn't given.
+constexpr char const* k_DefaultVariantOutput = "./Public/{variant}";
+
+struct SiteVariant {
+    std::string Name;
+    std::filesystem::path VarsPath;
+    std::filesystem::path PublicPath;
+    std::optional<VarsCollection> Vars;
+    BuildManifest Manifest;
+};
+
+// Makes a variant for each vars file, its pages going to outputPattern with {variant} replaced by its name, and loads
+// its vars and (unless fullRebuild) its manifest. Throws if a vars file doesn't exist, two share a name, or there's
+// more than one and outputPattern has no {variant} to tell them apart.
+std::vector<std::unique_ptr<SiteVariant>> LoadSiteVariants(std::vector<std::filesystem::path> const& varsPaths, std::string const& outputPattern, bool fullRebuild);
+
+// Renders every page of the site for every variant at once and saves their manifests.
+SiteRenderStats RenderSiteVariants(std::vector<std::unique_ptr<SiteVariant>> const& variants, ThreadPool& pool, ThreadPool& assetPool, bool forceRender);
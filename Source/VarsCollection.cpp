@@ -5,48 +5,66 @@
 #include <algorithm> 
 #include <cctype>
 #include <cwctype>
-#include <fstream>
 #include <iostream>
 #include <locale>
-#include <string.h>
+#include <cstring>
 
 namespace {
-    std::istream& GetVarsLine(std::istream& is, std::string& t)
-    {
-        t.clear();
-        std::istream::sentry se(is, true);
-        std::streambuf* sb = is.rdbuf();
-
-        while(true) {
-            int c = sb->sbumpc();
-            switch (c) {
-            case '\n':
-                return is;
-            case '\r':
-                if (sb->sgetc() == '\n')
-                    sb->sbumpc();
-                return is;
-            case std::streambuf::traits_type::eof():
-                if (t.empty())
-                    is.setstate(std::ios::eofbit);
-                return is;
-            default:
-                t += (char)c;
+    // Splits the next line off the front of text. Lines end with \n, \r\n or \r.
+    // Like the stream based reader this replaced, an empty line is always produced at the very end.
+    bool NextVarsLine(std::string_view& text, bool& finished, std::string_view& line) {
+        if(text.empty()) {
+            if(finished) {
+                return false;
             }
+            finished = true;
+            line = {};
+            return true;
+        }
+
+        // memchr is much faster than find_first_of, look for \r only within the line \n ends.
+        char const* const begin = text.data();
+        char const* newline = static_cast<char const*>(std::memchr(begin, '\n', text.size()));
+        size_t const lineLimit = newline != nullptr ? static_cast<size_t>(newline - begin) : text.size();
+        char const* const carriageReturn = static_cast<char const*>(std::memchr(begin, '\r', lineLimit));
+        size_t const end = carriageReturn != nullptr ? static_cast<size_t>(carriageReturn - begin)
+            : newline != nullptr ? lineLimit : std::string_view::npos;
+        if(end == std::string_view::npos) {
+            line = text;
+            text = {};
+            return true;
+        }
+
+        line = text.substr(0, end);
+        size_t next = end + 1;
+        if(text[end] == '\r' && next < text.size() && text[next] == '\n') {
+            ++next;
         }
+        text.remove_prefix(next);
+        return true;
+    }
+
+    // std::isspace for the "C" locale, without the call.
+    bool IsSpace(char ch) {
+        return ch == ' ' || (ch >= '\t' && ch <= '\r');
     }
 
-    std::string VarNameTrim(std::string const& s) {
-        std::string trimmed = s;
-        trimmed.erase(trimmed.begin(), std::find_if(trimmed.begin(), trimmed.end(), [](unsigned char ch) {
-            return !std::isspace(ch);
-        }));
-        trimmed.erase(std::find_if(trimmed.rbegin(), trimmed.rend(), [](unsigned char ch) {
-            return !std::isspace(ch); 
-        }).base(), trimmed.end());
-        return trimmed;
+    std::string_view VarNameTrim(std::string_view s) {
+        while(!s.empty() && IsSpace(s.front())) {
+            s.remove_prefix(1);
+        }
+        while(!s.empty() && IsSpace(s.back())) {
+            s.remove_suffix(1);
+        }
+        return s;
     }
 
+    // A variable found by the parser, before it's added to the collection.
+    struct ParsedVariable {
+        std::string_view Name;
+        std::string_view Value;
+    };
+
 }
 
 VarNameValidity CheckVariableNameValidity(std::string_view variableName) {
@@ -77,23 +95,31 @@ std::optional<VarsCollection> VarsCollection::TryLoadVarsCollection(std::filesys
         return {};
     }
 
-    std::ifstream stream(path.c_str());
+    VarsCollection collection;
+    collection.m_Storage = std::make_shared<Storage>();
 
-    if(stream.bad()) {
-        Logging::LogError("Couldn't open %s for reading.", path.c_str());
+    if(!collection.m_Storage->Source.Open(path)) {
+        Logging::LogError("Couldn't open %s for reading.", path.string().c_str());
         return {};
     }
 
-    VarsCollection collection;
-    std::string line;
+    // Lines and values are views into the file, only continued (multi-line) values are copied.
+    // Everything is parsed first, then every name is interned in one go and the values are stored by id.
+    std::string_view text = collection.m_Storage->Source.GetText();
+    bool finished = false;
+    std::string_view line;
+
+    std::vector<ParsedVariable> parsed;
+    // A rough guess (most lines are a short name and a value), it only saves a few reallocations.
+    parsed.reserve(text.size() / 32);
 
     bool insideContinuation = false;
-    std::string continuationKey;
-    std::string continuationValue;
+    std::string_view continuationKey;
+    std::string* continuationValue = nullptr;
 
     auto const LineIsComment = [](std::string_view line) -> bool {
         for (char ch : line) {
-            if (!std::isspace(ch) && ch != '#') {
+            if (!IsSpace(ch) && ch != '#') {
                 return false;
             }
             if (ch == '#') {
@@ -111,18 +137,22 @@ std::optional<VarsCollection> VarsCollection::TryLoadVarsCollection(std::filesys
         && (line.size() == 1 || line[line.size()-2] == '\\');
     };
 
+    // Logged with each problem, Vars.txt unless it's a variant's (see Variants.h).
+    std::string const fileName = path.filename().string();
     int lineNum = 0;
-    while(GetVarsLine(stream, line)) {
+    while(NextVarsLine(text, finished, line)) {
         lineNum++;
         if(insideContinuation) {
             if(LineHasContinuation(line)) {
                 // continuation keeps going, don't include the last char.
-                continuationValue += "\n" + line.substr(0, line.size()-1);
+                *continuationValue += '\n';
+                *continuationValue += line.substr(0, line.size()-1);
             }
             else {
                 // continuation ends here, we can accept this entire line.
-                continuationValue += "\n" + line;
-                collection.SetVariable(std::move(continuationKey), std::move(continuationValue));
+                *continuationValue += '\n';
+                *continuationValue += line;
+                parsed.push_back({continuationKey, *continuationValue});
                 insideContinuation = false;
             }
             continue;
@@ -136,9 +166,9 @@ std::optional<VarsCollection> VarsCollection::TryLoadVarsCollection(std::filesys
         }
         
         // Check if this is an assignment operation
-        size_t const assignmentIndex = line.find_first_of('=');
+        size_t const assignmentIndex = line.find('=');
         if(assignmentIndex != std::string::npos) {
-            std::string const variableName = VarNameTrim(line.substr(0, assignmentIndex));
+            std::string_view const variableName = VarNameTrim(line.substr(0, assignmentIndex));
 
             VarNameValidity validity = CheckVariableNameValidity(variableName);
 
@@ -147,8 +177,9 @@ std::optional<VarsCollection> VarsCollection::TryLoadVarsCollection(std::filesys
                 if (LineHasContinuation(line)) {
                     continuationKey = variableName;
                     // just like usual we pick up the value after the assignment op
-                    // except we want to stop one short from the end so we don't pick up the backslash
-                    continuationValue = line.substr(assignmentIndex + 1, line.size() - assignmentIndex - 2);
+                    // except we want to stop one short from the end so we don't pick up the backslash.
+                    // The value is built in place where the collection will keep it.
+                    continuationValue = &collection.m_Storage->OwnedValues.emplace_back(line.substr(assignmentIndex + 1, line.size() - assignmentIndex - 2));
                     // This bool helps us pick up all following continuations
                     insideContinuation = true;
                 }
@@ -156,13 +187,11 @@ std::optional<VarsCollection> VarsCollection::TryLoadVarsCollection(std::filesys
                     if (line[line.size() - 1] == '\\') {
                         // just like usual we pick up the value after the assignment op
                         // except we want to stop one short from the end so we don't pick up the escaped backslash
-                        std::string const variableValue = line.substr(assignmentIndex + 1, line.size() - assignmentIndex - 2);
-                        collection.SetVariable(variableName, variableValue);
+                        parsed.push_back({variableName, line.substr(assignmentIndex + 1, line.size() - assignmentIndex - 2)});
                     }
                     else {
                         // pick up the value after the assignment op
-                        std::string const variableValue = line.substr(assignmentIndex + 1);
-                        collection.SetVariable(variableName, variableValue);
+                        parsed.push_back({variableName, line.substr(assignmentIndex + 1)});
                     }
                 }
             }
@@ -171,16 +200,16 @@ std::optional<VarsCollection> VarsCollection::TryLoadVarsCollection(std::filesys
                     default:
                     case VarNameValidity::Invalid:
                         if (variableName.size() < 64) {
-                            Logging::LogError("Error in Vars.txt(%d) \"%s\" is not a valid name.", lineNum, variableName.c_str());
+                            Logging::LogError("Error in %s(%d) \"%s\" is not a valid name.", fileName.c_str(), lineNum, std::string(variableName).c_str());
                         }
                         else {
-                            Logging::LogError("Error in Vars.txt(%d) Name is invalid (and too long to print here).");
+                            Logging::LogError("Error in %s(%d) Name is invalid (and too long to print here).", fileName.c_str(), lineNum);
                         }
                         break;
 
                     case VarNameValidity::FirstCharInvalid:
                         // The size check here shouldn't be necessary but let's me sleep easier at night.
-                        Logging::LogError("Error in Vars.txt(%d) '%c' is not a valid first character of a variable name. Must be a letter, hyphen or underscore." , lineNum, variableName.size() ? variableName[0] : ' ');
+                        Logging::LogError("Error in %s(%d) '%c' is not a valid first character of a variable name. Must be a letter, hyphen or underscore." , fileName.c_str(), lineNum, variableName.size() ? variableName[0] : ' ');
                         break;
                 }
             }
@@ -188,40 +217,196 @@ std::optional<VarsCollection> VarsCollection::TryLoadVarsCollection(std::filesys
             continue;
         }
 
-        Logging::LogWarning("Unrecognized line: Vars.txt(%d)", lineNum);
+        Logging::LogWarning("Unrecognized line: %s(%d)", fileName.c_str(), lineNum);
+    }
+
+    std::vector<std::string_view> names;
+    names.reserve(parsed.size());
+    for(ParsedVariable const& variable : parsed) {
+        names.push_back(variable.Name);
     }
+    std::vector<SymbolId> symbols;
+    SymbolTable::Get().InternAll(names, symbols);
 
+    SymbolId maxSymbol = 0;
+    for(SymbolId symbol : symbols) {
+        maxSymbol = std::max(maxSymbol, symbol);
+    }
+    collection.m_Slots.resize(symbols.empty() ? 0 : static_cast<size_t>(maxSymbol) + 1);
+    collection.m_Symbols.reserve(symbols.size());
+    for(size_t i = 0; i < parsed.size(); ++i) {
+        collection.SetVariableSymbol(symbols[i], parsed[i].Value);
+    }
     return {collection};
 }
 
 
-std::optional<std::string_view> VarsCollection::TryGetVariable(std::string_view key) const {
-    // todo: Once C++20 support improves it should be possible remove this temporary string with a little work.
-    // see: https://stackoverflow.com/q/34596768
-    auto found = m_VarMap.find(std::string(key));
-    if(found == m_VarMap.end()) {
+//static
+std::optional<VarsCollection> VarsCollection::TryLoadVarsCollection(std::filesystem::path const& path, std::filesystem::path const& snapshotPath) {
+    FileStamp const varsStamp = FileStamp::Of(path);
+    if(varsStamp.Size < 0) {
         return {};
     }
-    return { found->second };
+
+    if(std::shared_ptr<VarsSnapshot const> snapshot = VarsSnapshot::TryOpen(snapshotPath, varsStamp)) {
+        VarsCollection collection;
+        collection.m_Storage = std::make_shared<Storage>();
+        collection.m_Storage->Snapshot = std::move(snapshot);
+        return {collection};
+    }
+
+    std::optional<VarsCollection> collection = TryLoadVarsCollection(path);
+    if(collection.has_value()) {
+        std::vector<std::pair<std::string_view, std::string_view>> variables;
+        variables.reserve(collection->m_Symbols.size());
+        for(SymbolId symbol : collection->m_Symbols) {
+            variables.emplace_back(SymbolTable::Get().GetName(symbol), collection->FindSlot(symbol)->Value);
+        }
+        VarsSnapshot::Write(snapshotPath, varsStamp, variables);
+    }
+    return collection;
+}
+
+std::optional<std::string_view> VarsCollection::TryGetVariable(std::string_view key) const {
+    std::optional<SymbolId> const symbol = SymbolTable::Get().Find(key);
+    if(symbol.has_value()) {
+        if(Slot const* slot = FindSlot(symbol.value())) {
+            return { slot->Value };
+        }
+    }
+    if(m_Storage && m_Storage->Snapshot) {
+        return m_Storage->Snapshot->TryGetVariable(key);
+    }
+    return {};
+}
+
+std::optional<std::string_view> VarsCollection::TryGetVariable(SymbolId symbol) const {
+    if(Slot const* slot = FindSlot(symbol)) {
+        return { slot->Value };
+    }
+    if(symbol != k_NoSymbol && m_Storage && m_Storage->Snapshot) {
+        return m_Storage->Snapshot->TryGetVariable(SymbolTable::Get().GetName(symbol));
+    }
+    return {};
 }
 
 void VarsCollection::SetVariable(std::string_view key, std::string_view value) {
-    // todo: Once C++20 support improves it should be possible remove this temporary string with a little work.
-    // see: https://stackoverflow.com/q/34596768
-    std::string keyString(key);
-    auto found = m_VarMap.find(keyString);
-    if(found != m_VarMap.end() && Logging::g_Verbose) {
-        Logging::LogWarning("Overwriting variable \"%s\" from \"%s\" to \"%s\".", keyString.c_str(), found->first.c_str(), std::string(value).c_str());
+    if(!m_Storage) {
+        m_Storage = std::make_shared<Storage>();
     }
-    m_VarMap[keyString] = value;
+    SymbolId const symbol = SymbolTable::Get().Intern(key);
+    std::string*& owned = m_Storage->OwnedBySymbol[symbol];
+    // Unless a copy shares the storage the old value can be replaced, so a variable that's set over and over
+    // (ie: in a streamed page) only ever takes up one value.
+    if(owned != nullptr && m_Storage.use_count() == 1) {
+        owned->assign(value);
+    } else {
+        owned = &m_Storage->OwnedValues.emplace_back(value);
+    }
+    SetVariableSymbol(symbol, *owned);
+}
+
+void VarsCollection::SetVariableView(std::string_view key, std::string_view value) {
+    SetVariableSymbol(SymbolTable::Get().Intern(key), value);
+}
+
+void VarsCollection::SetVariableSymbol(SymbolId symbol, std::string_view value) {
+    Slot& slot = GetOrAddSlot(symbol);
+    if(slot.IsSet) {
+        if(Logging::IsVerbose()) {
+            std::string const keyString(SymbolTable::Get().GetName(symbol));
+            Logging::LogWarning("Overwriting variable \"%s\" from \"%s\" to \"%s\".", keyString.c_str(), keyString.c_str(), std::string(value).c_str());
+        }
+    } else {
+        slot.IsSet = true;
+        m_Symbols.push_back(symbol);
+    }
+    slot.Value = value;
+}
+
+VarsCollection::Slot const* VarsCollection::FindSlot(SymbolId symbol) const {
+    if(symbol < m_Slots.size()) {
+        return m_Slots[symbol].IsSet ? &m_Slots[symbol] : nullptr;
+    }
+    auto const it = std::lower_bound(m_SparseSlots.begin(), m_SparseSlots.end(), symbol, [](std::pair<SymbolId, Slot> const& entry, SymbolId id) { return entry.first < id; });
+    if(it != m_SparseSlots.end() && it->first == symbol) {
+        return &it->second;
+    }
+    return nullptr;
+}
+
+VarsCollection::Slot& VarsCollection::GetOrAddSlot(SymbolId symbol) {
+    if(symbol < m_Slots.size()) {
+        return m_Slots[symbol];
+    }
+    // Symbols are interned across the whole process, so sizing m_Slots to fit one would cost as much as every name
+    // interned before it (ie: all of Vars.txt) for each collection.
+    auto const it = std::lower_bound(m_SparseSlots.begin(), m_SparseSlots.end(), symbol, [](std::pair<SymbolId, Slot> const& entry, SymbolId id) { return entry.first < id; });
+    if(it != m_SparseSlots.end() && it->first == symbol) {
+        return it->second;
+    }
+    return m_SparseSlots.insert(it, { symbol, Slot() })->second;
 }
 
 void VarsCollection::ForeachKey(std::function<void(std::string_view)> const& func) const {
-    for(auto const& kvp : m_VarMap) {
-        func(kvp.first);
+    if(m_Storage && m_Storage->Snapshot) {
+        VarsSnapshot const& snapshot = *m_Storage->Snapshot;
+        for(size_t i = 0; i < snapshot.size(); ++i) {
+            std::string_view const name = snapshot.GetName(i);
+            std::optional<SymbolId> const symbol = SymbolTable::Get().Find(name);
+            // Variables set since loading are listed below.
+            if(!symbol.has_value() || FindSlot(symbol.value()) == nullptr) {
+                func(name);
+            }
+        }
+    }
+    for(SymbolId symbol : m_Symbols) {
+        func(SymbolTable::Get().GetName(symbol));
     }
 }
 
 size_t VarsCollection::size() const {
-    return m_VarMap.size();
-}
\ No newline at end of file
+    size_t count = m_Symbols.size();
+    if(m_Storage && m_Storage->Snapshot) {
+        count += m_Storage->Snapshot->size();
+        for(SymbolId symbol : m_Symbols) {
+            if(m_Storage->Snapshot->TryGetVariable(SymbolTable::Get().GetName(symbol)).has_value()) {
+                --count;
+            }
+        }
+    }
+    return count;
+}
+
+VarsScope::VarsScope(VarsCollection const* collection, VarsScope const* parent)
+: m_Collection(collection)
+, m_Parent(parent) {
+}
+
+std::optional<std::string_view> VarsScope::TryGetVariable(std::string_view key, size_t* layersSearched) const {
+    return Search(key, layersSearched);
+}
+
+std::optional<std::string_view> VarsScope::TryGetVariable(SymbolId symbol, size_t* layersSearched) const {
+    return Search(symbol, layersSearched);
+}
+
+template<typename Key>
+std::optional<std::string_view> VarsScope::Search(Key key, size_t* layersSearched) const {
+    size_t searched = 0;
+    std::optional<std::string_view> value;
+    for(VarsScope const* scope = this; scope != nullptr; scope = scope->m_Parent) {
+        ++searched;
+        if(scope->m_Collection != nullptr) {
+            value = scope->m_Collection->TryGetVariable(key);
+            if(value.has_value()) {
+                break;
+            }
+        }
+    }
+
+    if(layersSearched != nullptr) {
+        *layersSearched = searched;
+    }
+    return value;
+}
@@ -1,10 +1,19 @@
 #pragma once
 
+#include "FileIO.h"
+#include "Symbols.h"
+#include "VarsSnapshot.h"
+
+#include <deque>
 #include <filesystem>
 #include <functional>
+#include <memory>
 #include <optional>
+#include <string>
 #include <string_view>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 enum class VarNameValidity {
     Valid,
@@ -20,6 +29,15 @@ Vars Collection:
     Vars collection provides access to a table of named variables.
 
     See TryLoadVarsCollection for details on the Vars.txt file format.
+
+    Values loaded from a file point straight into the (memory mapped) file rather than being
+    copied. Copies of a collection share the file and any stored values.
+
+    Names are interned in the SymbolTable, so a lookup by name never allocates. A collection
+    loaded from a file keeps a slot per SymbolId up to the largest one it holds, so a lookup by
+    id is an array access. Any other collection (ie: a page's inline variables) only keeps
+    slots for what it holds, sorted by SymbolId, so it stays small however many names were
+    interned before it.
 **************************************************************************************************/
 class VarsCollection
 {
@@ -36,6 +54,10 @@ public:
     ***************************************************************************************************/
     static std::optional<VarsCollection> TryLoadVarsCollection(std::filesystem::path const& path);
 
+    // As above, but uses the compiled snapshot at snapshotPath when it was built from the current path.
+    // Otherwise path is parsed and the snapshot is written again for next time. See VarsSnapshot.h.
+    static std::optional<VarsCollection> TryLoadVarsCollection(std::filesystem::path const& path, std::filesystem::path const& snapshotPath);
+
     VarsCollection()                                 = default;
     ~VarsCollection()                                = default;
     VarsCollection(VarsCollection const&)            = default;
@@ -46,8 +68,10 @@ public:
     // Attempts to retrieve a string variable from the collection by key.
     // No logging is done if the variable is not found.
     std::optional<std::string_view> TryGetVariable(std::string_view key) const;
+    std::optional<std::string_view> TryGetVariable(SymbolId symbol) const;
 
     // Assigns a variable with a key and a value. Logs a warning if the value is a duplicate.
+    // Views of the variable's old value may not be valid afterwards.
     void SetVariable(std::string_view key, std::string_view value);
 
     void ForeachKey(std::function<void(std::string_view)> const& func) const;
@@ -55,6 +79,65 @@ public:
     size_t size() const;
 
 private:
+    // Keeps the memory that values point into alive.
+    struct Storage {
+        // The file the collection was loaded from.
+        MappedFile Source;
+        // Values that aren't a plain slice of Source (ie: set at runtime or joined from multiple lines).
+        // A deque never moves its elements, so views into it stay valid.
+        std::deque<std::string> OwnedValues;
+        // The value in OwnedValues each variable was last given by SetVariable.
+        std::unordered_map<SymbolId, std::string*> OwnedBySymbol;
+        // Set when the collection was loaded from a snapshot. Variables set afterwards go in the slots and take priority.
+        std::shared_ptr<VarsSnapshot const> Snapshot;
+    };
+
+    struct Slot {
+        std::string_view Value;
+        bool IsSet = false;
+    };
+
+    // Assigns a value that already lives in m_Storage.
+    void SetVariableView(std::string_view key, std::string_view value);
+    void SetVariableSymbol(SymbolId symbol, std::string_view value);
+
+    // The slot of symbol if it's set, null otherwise.
+    Slot const* FindSlot(SymbolId symbol) const;
+    Slot& GetOrAddSlot(SymbolId symbol);
+
+    std::shared_ptr<Storage> m_Storage;
+    // Indexed by SymbolId. Only sized when loading from a file.
+    std::vector<Slot> m_Slots;
+    // Slots past the end of m_Slots, sorted by SymbolId.
+    std::vector<std::pair<SymbolId, Slot>> m_SparseSlots;
+    // The symbols that are set, in the order they were first set.
+    std::vector<SymbolId> m_Symbols;
+};
+
+/**************************************************************************************************
+Vars Scope:
+    One layer in a chain of variable collections. A lookup starts at the innermost layer and
+    walks out through its parents until one of them has the variable, ie: a page's inline
+    variables, then any layers in between, then Vars.txt.
+
+    Scopes only refer to their collection and parent, nothing is copied. Both must outlive the
+    scope, which is easiest by keeping the whole chain on the stack while rendering a page.
+**************************************************************************************************/
+class VarsScope
+{
+public:
+    // collection may be null, the layer is then searched but never has anything.
+    explicit VarsScope(VarsCollection const* collection, VarsScope const* parent = nullptr);
+
+    // Attempts to retrieve a variable from the innermost layer that has it.
+    // If layersSearched isn't null it's set to the number of layers that were looked at.
+    std::optional<std::string_view> TryGetVariable(std::string_view key, size_t* layersSearched = nullptr) const;
+    std::optional<std::string_view> TryGetVariable(SymbolId symbol, size_t* layersSearched = nullptr) const;
+
+private:
+    template<typename Key>
+    std::optional<std::string_view> Search(Key key, size_t* layersSearched) const;
 
-    std::unordered_map<std::string, std::string> m_VarMap;
+    VarsCollection const* m_Collection;
+    VarsScope const* m_Parent;
 };
\ No newline at end of file
@@ -0,0 +1,222 @@
+#include "VarsSnapshot.h"
+
+#include "Logging.h"
+#include "Profiler.h"
+
+#include <cstring>
+#include <fstream>
+#include <string>
+
+namespace {
+    constexpr char k_SnapshotMagic[8] = { 'E', 'S', 'D', 'V', 'A', 'R', 'S', '1' };
+    // Reads back differently on a machine with the other byte order.
+    constexpr uint32_t k_ByteOrderMark = 0x01020304;
+
+    struct Header {
+        char Magic[8];
+        uint32_t ByteOrder;
+        uint32_t TableSize;
+        uint64_t Count;
+        int64_t VarsTime;
+        int64_t VarsSize;
+        uint64_t EntriesOffset;
+        uint64_t TableOffset;
+        uint64_t StringsOffset;
+        uint64_t StringsSize;
+    };
+
+    // FNV-1a, the hashes are stored in the file so they can't depend on the standard library.
+    uint64_t HashName(std::string_view name) {
+        uint64_t hash = 14695981039346656037ull;
+        for(char ch : name) {
+            hash ^= static_cast<unsigned char>(ch);
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    template<typename T>
+    T ReadAt(std::string_view data, uint64_t offset) {
+        T value;
+        std::memcpy(&value, data.data() + offset, sizeof(T));
+        return value;
+    }
+
+    template<typename T>
+    void Append(std::string& data, T const& value) {
+        data.append(reinterpret_cast<char const*>(&value), sizeof(T));
+    }
+}
+
+//static
+std::shared_ptr<VarsSnapshot const> VarsSnapshot::TryOpen(std::filesystem::path const& path, FileStamp const& varsStamp) {
+    auto span = Profiler::Span("Open Vars Snapshot", "io");
+    span.SetPath(path);
+
+    std::error_code error;
+    if(!std::filesystem::is_regular_file(path, error)) {
+        return nullptr;
+    }
+
+    auto snapshot = std::make_shared<VarsSnapshot>();
+    if(!snapshot->m_File.Open(path)) {
+        return nullptr;
+    }
+
+    std::string_view const data = snapshot->m_File.GetText();
+    if(data.size() < sizeof(Header)) {
+        return nullptr;
+    }
+    Header const header = ReadAt<Header>(data, 0);
+    if(std::memcmp(header.Magic, k_SnapshotMagic, sizeof(k_SnapshotMagic)) != 0 || header.ByteOrder != k_ByteOrderMark) {
+        return nullptr;
+    }
+    if(header.VarsTime != varsStamp.Time || header.VarsSize != varsStamp.Size) {
+        return nullptr;
+    }
+
+    // Everything has to fit in the file, entries and strings are checked again when they are read.
+    bool const fits = header.EntriesOffset <= data.size()
+        && header.Count <= (data.size() - header.EntriesOffset) / sizeof(Entry)
+        && header.TableOffset <= data.size()
+        && header.TableSize <= (data.size() - header.TableOffset) / sizeof(uint32_t)
+        && header.StringsOffset <= data.size()
+        && header.StringsSize <= data.size() - header.StringsOffset
+        && header.TableSize != 0 && (header.TableSize & (header.TableSize - 1)) == 0
+        && header.Count < header.TableSize;
+    if(!fits) {
+        Logging::LogWarning("Ignoring %s, it's malformed.", path.string().c_str());
+        return nullptr;
+    }
+
+    snapshot->m_Count = static_cast<size_t>(header.Count);
+    snapshot->m_TableSize = header.TableSize;
+    snapshot->m_EntriesOffset = header.EntriesOffset;
+    snapshot->m_TableOffset = header.TableOffset;
+    snapshot->m_StringsOffset = header.StringsOffset;
+    snapshot->m_StringsSize = header.StringsSize;
+    span.SetBytes(data.size());
+    return snapshot;
+}
+
+//static
+bool VarsSnapshot::Write(std::filesystem::path const& path, FileStamp const& varsStamp, std::vector<std::pair<std::string_view, std::string_view>> const& variables) {
+    auto span = Profiler::Span("Write Vars Snapshot", "io");
+    span.SetPath(path);
+
+    uint32_t tableSize = 16;
+    while(tableSize < variables.size() * 2) {
+        tableSize *= 2;
+    }
+
+    Header header {};
+    std::memcpy(header.Magic, k_SnapshotMagic, sizeof(k_SnapshotMagic));
+    header.ByteOrder = k_ByteOrderMark;
+    header.TableSize = tableSize;
+    header.Count = variables.size();
+    header.VarsTime = varsStamp.Time;
+    header.VarsSize = varsStamp.Size;
+    header.EntriesOffset = sizeof(Header);
+    header.TableOffset = header.EntriesOffset + variables.size() * sizeof(Entry);
+    header.StringsOffset = header.TableOffset + tableSize * sizeof(uint32_t);
+
+    std::vector<Entry> entries;
+    entries.reserve(variables.size());
+    std::vector<uint32_t> table(tableSize, 0);
+    std::string strings;
+    for(auto const& [name, value] : variables) {
+        if(name.size() > UINT32_MAX || value.size() > UINT32_MAX) {
+            return false;
+        }
+
+        Entry entry {};
+        entry.Hash = HashName(name);
+        entry.NameOffset = strings.size();
+        entry.NameSize = static_cast<uint32_t>(name.size());
+        strings.append(name);
+        entry.ValueOffset = strings.size();
+        entry.ValueSize = static_cast<uint32_t>(value.size());
+        strings.append(value);
+
+        uint32_t index = static_cast<uint32_t>(entry.Hash) & (tableSize - 1);
+        while(table[index] != 0) {
+            index = (index + 1) & (tableSize - 1);
+        }
+        entries.push_back(entry);
+        table[index] = static_cast<uint32_t>(entries.size());
+    }
+    header.StringsSize = strings.size();
+
+    std::string data;
+    data.reserve(static_cast<size_t>(header.StringsOffset) + strings.size());
+    Append(data, header);
+    for(Entry const& entry : entries) {
+        Append(data, entry);
+    }
+    for(uint32_t slot : table) {
+        Append(data, slot);
+    }
+    data.append(strings);
+
+    std::error_code error;
+    std::filesystem::create_directories(path.parent_path(), error);
+
+    // Write next to the snapshot and move it into place, the old snapshot may still be mapped.
+    std::filesystem::path temporaryPath = path;
+    temporaryPath += ".tmp";
+    {
+        std::ofstream file(temporaryPath, std::ios::out | std::ios::binary | std::ios::trunc);
+        if(!file.is_open() || !file.write(data.data(), static_cast<std::streamsize>(data.size()))) {
+            Logging::LogWarning("Couldn't write %s.", temporaryPath.string().c_str());
+            return false;
+        }
+    }
+    std::filesystem::rename(temporaryPath, path, error);
+    if(error) {
+        Logging::LogWarning("Couldn't write %s.", path.string().c_str());
+        std::filesystem::remove(temporaryPath, error);
+        return false;
+    }
+
+    span.SetBytes(data.size());
+    return true;
+}
+
+std::optional<std::string_view> VarsSnapshot::TryGetVariable(std::string_view name) const {
+    std::string_view const data = m_File.GetText();
+    uint64_t const hash = HashName(name);
+    uint32_t const mask = m_TableSize - 1;
+
+    // The table is never full, so there's always an empty slot to stop at.
+    for(uint32_t index = static_cast<uint32_t>(hash) & mask; ; index = (index + 1) & mask) {
+        uint32_t const slot = ReadAt<uint32_t>(data, m_TableOffset + index * sizeof(uint32_t));
+        if(slot == 0 || slot > m_Count) {
+            return {};
+        }
+        Entry const entry = GetEntry(slot - 1);
+        if(entry.Hash == hash && GetString(entry.NameOffset, entry.NameSize) == name) {
+            return GetString(entry.ValueOffset, entry.ValueSize);
+        }
+    }
+}
+
+size_t VarsSnapshot::size() const {
+    return m_Count;
+}
+
+std::string_view VarsSnapshot::GetName(size_t index) const {
+    Entry const entry = GetEntry(index);
+    return GetString(entry.NameOffset, entry.NameSize);
+}
+
+VarsSnapshot::Entry VarsSnapshot::GetEntry(size_t index) const {
+    return ReadAt<Entry>(m_File.GetText(), m_EntriesOffset + index * sizeof(Entry));
+}
+
+std::string_view VarsSnapshot::GetString(uint64_t offset, uint32_t size) const {
+    if(offset > m_StringsSize || size > m_StringsSize - offset) {
+        // Only a damaged snapshot gets here.
+        return {};
+    }
+    return m_File.GetText().substr(static_cast<size_t>(m_StringsOffset + offset), size);
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "BuildManifest.h"
+#include "FileIO.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/**************************************************************************************************
+Vars Snapshot:
+    A compiled copy of Vars.txt (.esd/Vars.esdvars) that is mapped straight into memory instead
+    of being parsed. Opening one costs the same no matter how many variables it holds, lookups
+    probe a hash table stored in the file.
+
+    The snapshot records the size and modification time of the Vars.txt it was built from and
+    is only used while they still match. Otherwise Vars.txt is parsed as usual and the snapshot
+    is written again (see VarsCollection::TryLoadVarsCollection).
+
+    File layout (native byte order, the header records it):
+        Header
+        Entry[Count]          in the order the variables were declared
+        uint32[TableSize]     open addressing table of entry index + 1, 0 is empty
+        char[]                names and values
+**************************************************************************************************/
+class VarsSnapshot
+{
+public:
+    // Opens the snapshot at path if it was built from a Vars.txt matching varsStamp by this version of esd.
+    static std::shared_ptr<VarsSnapshot const> TryOpen(std::filesystem::path const& path, FileStamp const& varsStamp);
+
+    // Writes a snapshot of variables (name, value) built from the Vars.txt matching varsStamp.
+    // The file is replaced in one step, so a snapshot that is currently open stays intact.
+    static bool Write(std::filesystem::path const& path, FileStamp const& varsStamp, std::vector<std::pair<std::string_view, std::string_view>> const& variables);
+
+    std::optional<std::string_view> TryGetVariable(std::string_view name) const;
+
+    // Variables are numbered in the order they were declared.
+    size_t size() const;
+    std::string_view GetName(size_t index) const;
+
+private:
+    struct Entry {
+        uint64_t Hash;
+        uint64_t NameOffset;
+        uint64_t ValueOffset;
+        uint32_t NameSize;
+        uint32_t ValueSize;
+    };
+
+    Entry GetEntry(size_t index) const;
+    std::string_view GetString(uint64_t offset, uint32_t size) const;
+
+    MappedFile m_File;
+    size_t m_Count = 0;
+    uint32_t m_TableSize = 0;
+    uint64_t m_EntriesOffset = 0;
+    uint64_t m_TableOffset = 0;
+    uint64_t m_StringsOffset = 0;
+    uint64_t m_StringsSize = 0;
+};
@@ -0,0 +1,313 @@
+#include "Watch.h"
+
+#include "BuildManifest.h"
+#include "BuildReport.h"
+#include "ComponentCache.h"
+#include "Logging.h"
+#include "Paths.h"
+#include "Profiler.h"
+#include "Site.h"
+#include "ThreadPool.h"
+#include "VarsCollection.h"
+
+#if defined(__linux__)
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace {
+    // How long the watched files have to be quiet before a burst of changes is considered finished.
+    constexpr int k_BurstQuietMilliseconds = 10;
+
+    struct ChangeSet {
+        // Files in Private/Site that changed.
+        std::set<std::filesystem::path> Pages;
+        // Normalized paths of components that changed, appeared or disappeared.
+        std::set<std::string> Components;
+        bool Vars = false;
+        // Something changed that can't be narrowed down to files (ie: a components directory moved), check every page.
+        bool Everything = false;
+
+        bool Empty() const {
+            return Pages.empty() && Components.empty() && !Vars && !Everything;
+        }
+
+        void Merge(ChangeSet&& other) {
+            Pages.merge(other.Pages);
+            Components.merge(other.Components);
+            Vars |= other.Vars;
+            Everything |= other.Everything;
+        }
+    };
+
+    class Watcher
+    {
+    public:
+        ~Watcher() {
+            if(m_Fd >= 0) {
+                close(m_Fd);
+            }
+        }
+
+        bool Start() {
+            m_Fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            if(m_Fd < 0) {
+                return false;
+            }
+
+            std::filesystem::path varsDirectory = GetVarsPath().parent_path();
+            if(varsDirectory.empty()) {
+                varsDirectory = ".";
+            }
+
+            return AddDirectory(GetSitePath(), Root::Site, nullptr)
+                && AddDirectory(GetComponentPath(), Root::Components, nullptr)
+                && AddWatch(varsDirectory, Root::Vars);
+        }
+
+        // Waits up to timeoutMilliseconds (forever if negative) for events and adds them to changes.
+        // Returns false if the wait timed out.
+        bool WaitForChanges(int timeoutMilliseconds, ChangeSet& changes) {
+            pollfd descriptor { m_Fd, POLLIN, 0 };
+            if(poll(&descriptor, 1, timeoutMilliseconds) <= 0) {
+                return false;
+            }
+
+            alignas(inotify_event) char buffer[16 * 1024];
+            while(true) {
+                ssize_t const length = read(m_Fd, buffer, sizeof(buffer));
+                if(length <= 0) {
+                    break;
+                }
+                for(char const* cursor = buffer; cursor < buffer + length; ) {
+                    auto const* event = reinterpret_cast<inotify_event const*>(cursor);
+                    HandleEvent(*event, changes);
+                    cursor += sizeof(inotify_event) + event->len;
+                }
+            }
+            return true;
+        }
+
+    private:
+        enum class Root {
+            Site, Components, Vars
+        };
+
+        struct WatchedDirectory {
+            Root WatchRoot;
+            std::filesystem::path Path;
+        };
+
+        bool AddWatch(std::filesystem::path const& directory, Root root) {
+            uint32_t const mask = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
+            int const watch = inotify_add_watch(m_Fd, directory.c_str(), mask);
+            if(watch < 0) {
+                Logging::LogError("Couldn't watch %s.", directory.string().c_str());
+                return false;
+            }
+            m_Directories[watch] = {root, directory};
+            return true;
+        }
+
+        // Watches directory and everything below it. Files found are added to newFiles if it isn't null.
+        bool AddDirectory(std::filesystem::path const& directory, Root root, std::set<std::filesystem::path>* newFiles) {
+            auto span = Profiler::Span("Walk Directory", "io");
+            span.SetPath(directory);
+
+            if(!AddWatch(directory, root)) {
+                return false;
+            }
+            std::error_code error;
+            for(auto const& entry : std::filesystem::recursive_directory_iterator(directory, error)) {
+                if(entry.is_directory()) {
+                    AddWatch(entry.path(), root);
+                } else if(newFiles != nullptr && entry.is_regular_file()) {
+                    newFiles->insert(entry.path());
+                }
+            }
+            return true;
+        }
+
+        void HandleEvent(inotify_event const& event, ChangeSet& changes) {
+            if(event.mask & IN_Q_OVERFLOW) {
+                Logging::LogWarning("Too many changes at once to track individually, checking every page.");
+                changes.Everything = true;
+                return;
+            }
+
+            auto const found = m_Directories.find(event.wd);
+            if(found == m_Directories.end()) {
+                return;
+            }
+            if(event.mask & IN_IGNORED) {
+                m_Directories.erase(found);
+                return;
+            }
+            if(event.len == 0) {
+                return;
+            }
+
+            WatchedDirectory const directory = found->second;
+            std::filesystem::path const path = directory.Path / event.name;
+            bool const isDirectory = (event.mask & IN_ISDIR) != 0;
+            bool const appeared = (event.mask & (IN_CREATE | IN_MOVED_TO)) != 0;
+
+            switch(directory.WatchRoot) {
+                case Root::Site:
+                    if(isDirectory) {
+                        // Pages in a new directory all need rendering. Removed pages leave their output behind (as usual).
+                        if(appeared) {
+                            AddDirectory(path, Root::Site, &changes.Pages);
+                        }
+                    } else {
+                        changes.Pages.insert(path);
+                    }
+                    break;
+                case Root::Components:
+                    if(isDirectory) {
+                        if(appeared) {
+                            AddDirectory(path, Root::Components, nullptr);
+                        }
+                        changes.Everything = true;
+                    } else {
+                        changes.Components.insert(path.lexically_normal().generic_string());
+                    }
+                    break;
+                case Root::Vars:
+                    if(!isDirectory && std::filesystem::path(event.name) == GetVarsPath().filename()) {
+                        changes.Vars = true;
+                    }
+                    break;
+            }
+        }
+
+        int m_Fd = -1;
+        std::unordered_map<int, WatchedDirectory> m_Directories;
+    };
+
+    // Renders everything affected by changes. Returns the changes that were left undone because the rebuild was cancelled.
+    ChangeSet Rebuild(ChangeSet const& changes, std::optional<VarsCollection>& vars, BuildManifest& manifest, ThreadPool& pool, ThreadPool& assetPool, std::atomic<bool> const& cancel) {
+        auto const startTime = std::chrono::steady_clock::now();
+
+        if(changes.Vars) {
+            vars = LoadSiteVars();
+        }
+
+        auto rebuildJob = Logging::JobScope("Rebuilding");
+
+        if(changes.Everything) {
+            ComponentCache::Get().Clear();
+        }
+        for(std::string const& component : changes.Components) {
+            Logging::LogWorkVerbose("Component changed: %s", component.c_str());
+            ComponentCache::Get().Invalidate(component);
+        }
+
+        FileStamp const varsStamp = FileStamp::Of(GetVarsPath());
+        ChangeSet unfinished;
+        SiteRenderStats stats;
+
+        if(changes.Everything) {
+            // Not cancellable: the manifest only keeps pages visited by a full pass.
+            manifest.BeginRun(varsStamp);
+            stats = RenderPages(FindSitePages(), vars, manifest, pool, assetPool, false);
+        }
+        else {
+            manifest.RefreshStamps(varsStamp);
+
+            std::set<std::filesystem::path> pages;
+            for(std::filesystem::path const& page : changes.Pages) {
+                std::error_code error;
+                if(std::filesystem::is_regular_file(page, error)) {
+                    pages.insert(page);
+                }
+            }
+            for(std::filesystem::path const& page : manifest.GetAffectedPages(changes.Components, changes.Vars)) {
+                pages.insert(GetSitePath() / page);
+            }
+
+            std::vector<SitePage> sitePages;
+            sitePages.reserve(pages.size());
+            for(std::filesystem::path const& page : pages) {
+                sitePages.push_back(MakeSitePage(page));
+            }
+            stats = RenderPages(sitePages, vars, manifest, pool, assetPool, true, &cancel);
+            unfinished.Pages.insert(stats.Unfinished.begin(), stats.Unfinished.end());
+        }
+
+        manifest.Save(GetManifestPath());
+        BuildReport::Save(manifest, vars, changes.Everything);
+
+        std::chrono::duration<double> const elapsedSeconds = std::chrono::steady_clock::now() - startTime;
+        if(unfinished.Empty()) {
+            Logging::LogSummary("%d page%s rendered in %.2fms, %d file%s rewritten, %d untouched.", 
+                stats.PagesRendered, stats.PagesRendered == 1 ? "" : "s", (elapsedSeconds * 1000.0).count(), 
+                stats.FilesRewritten(), stats.FilesRewritten() == 1 ? "" : "s", stats.FilesUntouched());
+        } else {
+            Logging::LogSummary("Cancelled by newer changes, %d page%s left for the next rebuild.", static_cast<int>(unfinished.Pages.size()), unfinished.Pages.size() == 1 ? "" : "s");
+        }
+
+        // Keep the profile up to date, watching only ends when esd is killed.
+        Profiler::Save();
+        return unfinished;
+    }
+}
+
+void WatchSite(std::optional<VarsCollection>& vars, BuildManifest& manifest, ThreadPool& pool, ThreadPool& assetPool) {
+    Watcher watcher;
+    if(!watcher.Start()) {
+        Logging::LogError("Couldn't start watching the site for changes.");
+        return;
+    }
+    Logging::LogSummary("Watching for changes. Press Ctrl+C to stop.");
+
+    ChangeSet pending;
+    ChangeSet unfinished;
+    std::thread rebuild;
+    std::atomic<bool> cancel = false;
+
+    while(true) {
+        // With nothing pending block until something changes, otherwise wait for the burst of changes to end.
+        if(watcher.WaitForChanges(pending.Empty() ? -1 : k_BurstQuietMilliseconds, pending)) {
+            if(rebuild.joinable() && !pending.Empty()) {
+                // The running rebuild is already out of date.
+                cancel = true;
+            }
+            continue;
+        }
+
+        if(pending.Empty()) {
+            continue;
+        }
+
+        if(rebuild.joinable()) {
+            rebuild.join();
+            pending.Merge(std::move(unfinished));
+            unfinished = {};
+        }
+
+        cancel = false;
+        rebuild = std::thread([changes = std::move(pending), &vars, &manifest, &pool, &assetPool, &cancel, &unfinished]() {
+            unfinished = Rebuild(changes, vars, manifest, pool, assetPool, cancel);
+        });
+        pending = {};
+    }
+}
+
+#else
+
+void WatchSite(std::optional<VarsCollection>&, BuildManifest&, ThreadPool&, ThreadPool&) {
+    Logging::LogError("--watch is only supported on Linux.");
+}
+
+#endif
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <optional>
+
+class BuildManifest;
+class ThreadPool;
+class VarsCollection;
+
+/**************************************************************************************************
+    Watch Mode:
+
+        Keeps esd running after the first render and re-renders pages as their inputs change.
+
+        Private/Site, Private/Components and Vars.txt are watched (with inotify, so this is Linux
+        only). Only the pages affected by a change are rendered again: a changed page, every page
+        that included a changed component (found through the build manifest) or every page that
+        read from Vars.txt. Components and variables stay loaded between rebuilds, only what
+        changed is read again.
+
+        Changes that arrive close together (like an editor saving several files) are merged into
+        one rebuild. If files change while a rebuild is running the rebuild is cancelled and the
+        pages it didn't get to are rendered along with the new changes.
+**************************************************************************************************/
+
+// Watches the site until the process is stopped. Only returns if watching couldn't be started.
+void WatchSite(std::optional<VarsCollection>& vars, BuildManifest& manifest, ThreadPool& pool, ThreadPool& assetPool);
@@ -1,27 +1,160 @@
 
+#include "Assets.h"
+#include "BatchIO.h"
+#include "BuildManifest.h"
+#include "BuildReport.h"
+#include "ComponentCache.h"
 #include "Logging.h"
+#include "PageProgram.h"
 #include "Paths.h"
+#include "Profiler.h"
 #include "Render.h"
+#include "Site.h"
+#include "ThreadPool.h"
+#include "Variants.h"
 #include "VarsCollection.h"
+#include "Watch.h"
 
+#include <algorithm>
 #include <chrono>
+#include <cstdint>
+#include <cstdlib>
 #include <cstring>
 #include <filesystem>
-#include <iostream>
 #include <optional>
 #include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+    // Asset copies mostly wait on the disk, a few at a time is enough to keep it busy.
+    constexpr size_t k_MaxAssetThreads = 4;
+
+    // Parses a number of bytes, optionally followed by K, M or G (as in KiB, MiB and GiB). Returns false for anything else.
+    bool TryParseByteSize(char const* text, uint64_t& bytes) {
+        char* end = nullptr;
+        unsigned long long const parsed = std::strtoull(text, &end, 10);
+        if (end == text || *text == '-') {
+            return false;
+        }
+        int shift = 0;
+        switch (*end) {
+            case '\0':           break;
+            case 'K': case 'k': shift = 10; ++end; break;
+            case 'M': case 'm': shift = 20; ++end; break;
+            case 'G': case 'g': shift = 30; ++end; break;
+            default:            return false;
+        }
+        if (*end != '\0' || parsed > (UINT64_MAX >> shift)) {
+            return false;
+        }
+        bytes = static_cast<uint64_t>(parsed) << shift;
+        return true;
+    }
+
+    void LogRenderSummary(SiteRenderStats const& stats) {
+        Logging::LogSummary("%d page%s rendered, %d unchanged page%s skipped.", 
+            stats.PagesRendered, stats.PagesRendered == 1 ? "" : "s", 
+            stats.PagesSkipped, stats.PagesSkipped == 1 ? "" : "s");
+        Logging::LogSummary("%d asset%s copied, %d unchanged asset%s skipped.", 
+            stats.AssetsCopied, stats.AssetsCopied == 1 ? "" : "s", 
+            stats.AssetsSkipped, stats.AssetsSkipped == 1 ? "" : "s");
+        Logging::LogSummary("%d file%s rewritten, %d file%s untouched.", 
+            stats.FilesRewritten(), stats.FilesRewritten() == 1 ? "" : "s", 
+            stats.FilesUntouched(), stats.FilesUntouched() == 1 ? "" : "s");
+    }
+}
 
 int main(int argc, char const* argv[])
 {
     auto startTime = std::chrono::steady_clock::now();
     try 
     {
+        size_t threadCount = ThreadPool::GetDefaultThreadCount();
+        bool fullRebuild = false;
+        bool watch = false;
+        std::vector<std::filesystem::path> variantPaths;
+        std::optional<std::string> variantOutput;
+
         for (int i = 0; i < argc; ++i) {
             if (std::strcmp(argv[i], "-v") == 0) {
-                Logging::g_Verbose = true;
+                Logging::g_LogLevel = Logging::LogLevel::Verbose;
+            }
+            else if (std::strncmp(argv[i], "--log=", 6) == 0) {
+                if (!Logging::TryParseLogLevel(argv[i] + 6, Logging::g_LogLevel)) {
+                    throw std::runtime_error(std::string("--log expects quiet, summary, normal or verbose, got \"") + (argv[i] + 6) + "\".");
+                }
+            }
+            else if (std::strcmp(argv[i], "--rebuild") == 0) {
+                fullRebuild = true;
+            }
+            else if (std::strcmp(argv[i], "--watch") == 0) {
+                watch = true;
+            }
+            else if (std::strcmp(argv[i], "--profile") == 0) {
+                if (i + 1 >= argc) {
+                    throw std::runtime_error("--profile expects a path to write the profile to.");
+                }
+                Profiler::Start(argv[++i]);
+            }
+            else if (std::strcmp(argv[i], "--report") == 0) {
+                if (i + 1 >= argc) {
+                    throw std::runtime_error("--report expects a path to write the build report to.");
+                }
+                BuildReport::Start(argv[++i]);
+            }
+            else if (std::strncmp(argv[i], "--assets=", 9) == 0) {
+                if (!TryParseAssetCopyMode(argv[i] + 9, g_AssetOptions.CopyMode)) {
+                    throw std::runtime_error(std::string("--assets expects copy, reflink or hardlink, got \"") + (argv[i] + 9) + "\".");
+                }
+            }
+            else if (std::strncmp(argv[i], "--io=", 5) == 0) {
+                if (!TryParseIoBackend(argv[i] + 5, g_IoBackend)) {
+                    throw std::runtime_error(std::string("--io expects sync, threads or uring, got \"") + (argv[i] + 5) + "\".");
+                }
+            }
+            else if (std::strncmp(argv[i], "--stream-threshold=", 19) == 0) {
+                if (!TryParseByteSize(argv[i] + 19, g_StreamThreshold)) {
+                    throw std::runtime_error(std::string("--stream-threshold expects a size in bytes (optionally followed by K, M or G), got \"") + (argv[i] + 19) + "\".");
+                }
+            }
+            else if (std::strcmp(argv[i], "--variants") == 0) {
+                // Takes every argument up to the next option, so a shell glob (vars/*.txt) works.
+                while (i + 1 < argc && argv[i + 1][0] != '-') {
+                    variantPaths.emplace_back(argv[++i]);
+                }
+                if (variantPaths.empty()) {
+                    throw std::runtime_error("--variants expects one or more vars files.");
+                }
+            }
+            else if (std::strcmp(argv[i], "--out") == 0) {
+                if (i + 1 >= argc) {
+                    throw std::runtime_error("--out expects where to write each variant, ie: Public/{variant}.");
+                }
+                variantOutput = argv[++i];
+            }
+            else if (std::strcmp(argv[i], "--hash-assets") == 0) {
+                g_AssetOptions.HashContents = true;
+            }
+            else if (std::strncmp(argv[i], "-j", 2) == 0) {
+                // Accept both "-j 8" and "-j8"
+                char const* count = argv[i][2] != '\0' ? argv[i] + 2 : (i + 1 < argc ? argv[++i] : "");
+                char* end = nullptr;
+                long const parsed = std::strtol(count, &end, 10);
+                if (end == count || *end != '\0' || parsed <= 0) {
+                    throw std::runtime_error(std::string("-j expects a positive number of threads, got \"") + count + "\".");
+                }
+                threadCount = static_cast<size_t>(parsed);
             }
         }
 
+        if (variantOutput.has_value() && variantPaths.empty()) {
+            throw std::runtime_error("--out is only used with --variants.");
+        }
+        if (!variantPaths.empty() && (watch || BuildReport::IsEnabled())) {
+            throw std::runtime_error("--variants can't be combined with --watch or --report.");
+        }
+
         {
             // The site path is required, if we don't have it we probably didn't start the program correctly.
             const auto& sitePath = GetSitePath();
@@ -45,56 +178,73 @@ int main(int argc, char const* argv[])
             }
         }
 
-        std::optional<VarsCollection> vars;
+        // Expanded components from the last run skip reading and expanding every component they include.
+        ComponentCache::Get().SetSnapshotDirectory(GetComponentSnapshotPath(), !fullRebuild);
+        // And pages that only need rendering again because their variables changed are rendered from their compiled programs.
+        g_PageProgramOptions.Save = true;
+        g_PageProgramOptions.Load = !fullRebuild;
 
-        {
-            auto loadingVarsJob = Logging::JobScope("Loading Vars.txt");
-            if(std::filesystem::exists(GetVarsPath()) && std::filesystem::is_regular_file(GetVarsPath()))
-            {
-                vars = VarsCollection::TryLoadVarsCollection(GetVarsPath());
-
-                if(vars.has_value()) {
-                    Logging::LogWork("%d variables loaded.", static_cast<int>(vars.value().size()));
-
-                    if(Logging::g_Verbose) {
-                        std::stringstream ss;
-                        vars.value().ForeachKey([&ss](std::string_view key) -> void {
-                            ss << key << " ";
-                        }); 
-                        Logging::LogWorkVerbose("Variables: %s", ss.str().c_str());
-                    }
-                } else {
-                    Logging::LogWarning("Vars.txt couldn't be loaded. No variables loaded.");
-                }
+        if (!variantPaths.empty()) {
+            std::vector<std::unique_ptr<SiteVariant>> const variants = LoadSiteVariants(variantPaths, variantOutput.value_or(k_DefaultVariantOutput), fullRebuild);
+
+            ThreadPool pool(threadCount);
+            ThreadPool assetPool(std::min<size_t>(threadCount, k_MaxAssetThreads));
+
+            auto renderJob = Logging::JobScope("Rendering Variants");
+            Logging::LogWorkVerbose("Rendering with %d thread%s.", static_cast<int>(threadCount), threadCount == 1 ? "" : "s");
+
+            // Counted per variant, a page rendered for every variant counts once for each.
+            SiteRenderStats const stats = RenderSiteVariants(variants, pool, assetPool, fullRebuild);
+            Logging::LogSummary("%d variant%s built.", static_cast<int>(variants.size()), variants.size() == 1 ? "" : "s");
+            LogRenderSummary(stats);
+        }
+        else {
+            std::optional<VarsCollection> vars = LoadSiteVars();
+
+            // The manifest from the last run lets us skip pages whose sources, components and variables haven't changed.
+            BuildManifest manifest;
+            if (!fullRebuild) {
+                manifest.Load(GetManifestPath());
             }
-            else {
-                Logging::AppendFileDetails(std::cout, GetVarsPath());
+            manifest.BeginRun(FileStamp::Of(GetVarsPath()));
+
+            ThreadPool pool(threadCount);
+            ThreadPool assetPool(std::min<size_t>(threadCount, k_MaxAssetThreads));
+
+            {
+                auto renderJob = Logging::JobScope("Rendering Site");
+                Logging::LogWorkVerbose("Rendering with %d thread%s.", static_cast<int>(threadCount), threadCount == 1 ? "" : "s");
+
+                SiteRenderStats const stats = RenderPages(FindSitePages(), vars, manifest, pool, assetPool, fullRebuild);
 
-                Logging::LogWarning("Vars.txt not found, no variables loaded.");
-                // A safe warning to ignore if you know what you're doing and don't need vars.txt
-                Logging::LogWorkVerbose("Warning: This is unexpected but can be ignored.");
-                
+                manifest.Save(GetManifestPath());
+                BuildReport::Save(manifest, vars, true);
+                LogRenderSummary(stats);
             }
-        }
 
-        {
-            auto renderJob = Logging::JobScope("Rendering Site");
-            for (const std::filesystem::directory_entry& entry : std::filesystem::recursive_directory_iterator(GetSitePath())) {
-                if(entry.is_regular_file()) {
-                    RenderPage(entry.path(), vars);
-                }
+            if (watch) {
+                auto const endTime = std::chrono::steady_clock::now();
+                std::chrono::duration<double> const elapsedSeconds = endTime - startTime;
+                Logging::LogSummary("Took %dms", static_cast<int>((elapsedSeconds * 1000.0).count()));
+                Profiler::Save();
+
+                // Only returns if watching fails to start.
+                WatchSite(vars, manifest, pool, assetPool);
+                return -1;
             }
         }
     }
     catch(std::exception& exception)
     {
         Logging::LogError(exception.what());
+        Profiler::Save();
         return -1;
     }
+    Profiler::Save();
     auto endTime = std::chrono::steady_clock::now();
     std::chrono::duration<double> elapsedSeconds = endTime - startTime;
     auto ms = (elapsedSeconds * 1000.0).count();
-    std::cout << "Took " << static_cast<int>(ms) << "ms" << std::endl;
+    Logging::LogSummary("Took %dms", static_cast<int>(ms));
 
     return 0;
 }
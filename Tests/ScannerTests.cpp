@@ -0,0 +1,417 @@
+#include "Scanner.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+/**************************************************************************************************
+    esd_tests:
+
+        Checks every scanner backend the CPU supports against the Reference backend (see
+        Scanner.h), with both FindIndicatorsWithCaps and Tokenize, over:
+
+            - hand written edge cases (ie: "{{$name}", unclosed statements, stray caps)
+            - near misses: every partial indicator followed by what breaks (or restarts) it
+            - indicators and caps at every offset around 16 and 32 byte block edges
+            - randomized text made mostly of indicators, partial indicators and braces
+
+        Every input is scanned twice: once from an ordinary allocation and once placed so it ends
+        exactly where a page ends, with the next page unreadable, so reading past the end crashes.
+
+        Tokenize is also checked against the Reference backend's FindIndicatorsWithCaps: its
+        tokens have to cover the text exactly, and when the text holds only one kind of indicator
+        its statements have to be exactly the ones FindIndicatorsWithCaps finds.
+
+        Usage: esd_tests [seed]
+
+            seed            Seeds the randomized inputs, to reproduce a failure. The seed used is
+                            printed on every run.
+
+        Exits with 1 if anything disagrees. Registered with CTest, run it with ctest.
+**************************************************************************************************/
+
+namespace {
+    constexpr ScannerBackend k_AllBackends[] = {
+        ScannerBackend::Reference,
+        ScannerBackend::Portable,
+        ScannerBackend::SSE2,
+        ScannerBackend::AVX2
+    };
+
+    constexpr std::string_view k_AllIndicators[] = {
+        Indicators::k_Include,
+        Indicators::k_VarDeclaration,
+        Indicators::k_VarSubstitution
+    };
+
+    // The statement kind Tokenize gives each of k_AllIndicators.
+    constexpr Token::Type k_IndicatorTokenTypes[] = {
+        Token::Type::Include,
+        Token::Type::Declaration,
+        Token::Type::Substitution
+    };
+
+    // The widest block any backend scans at once, edge cases are placed around multiples of it.
+    constexpr size_t k_MaxBlockSize = 32;
+
+    constexpr uint32_t k_DefaultSeed = 0xE5D5EED;
+    constexpr int k_RandomInputCount = 4000;
+    constexpr size_t k_MaxRandomLength = 300;
+    constexpr int k_LongRandomInputCount = 8;
+    constexpr size_t k_LongRandomLength = 64 * 1024;
+
+    constexpr std::string_view k_EdgeCases[] = {
+        "",
+        "{",
+        "}",
+        "$",
+        "{$",
+        "{$}",
+        "{$a",
+        "{$a}",
+        "{{$a}",
+        "{{{$a}",
+        "{${$a}",
+        "{$a{$b}}",
+        "{$a}{$b}",
+        "{$a}}{$b}",
+        "}{$a}{",
+        "{include:",
+        "{include:}",
+        "{include:a}",
+        "{includ{include:a}",
+        "{include{include:a}",
+        "{include:{include:a}}",
+        "{variable:",
+        "{variable:a=b}",
+        "{variable:{$a}}",
+        "{variable:a={include:b}}",
+        "{$a {include:b} }",
+        "{include:a {$b} }",
+        "{{{{{{{{",
+        "}}}}}}}}",
+        "{:}{$:}{include$}{variable$a}",
+        "<style>body { margin: 0; }</style>{$a}",
+    };
+
+    int s_Failures = 0;
+    size_t s_Inputs = 0;
+
+    // text, escaped and shortened so it fits on a line.
+    std::string Describe(std::string_view text) {
+        constexpr size_t k_MaxShown = 120;
+        std::string described = "\"";
+        for(size_t i = 0; i < text.size() && i < k_MaxShown; ++i) {
+            char const ch = text[i];
+            if(ch == '\n') {
+                described += "\\n";
+            } else if(ch == '"' || ch == '\\') {
+                described += '\\';
+                described += ch;
+            } else {
+                described += ch;
+            }
+        }
+        described += '"';
+        if(text.size() > k_MaxShown) {
+            described += "... (" + std::to_string(text.size()) + " bytes)";
+        }
+        return described;
+    }
+
+    void Fail(char const* source, std::string_view text, char const* format, char const* detail) {
+        std::printf("FAILED: ");
+        std::printf(format, detail);
+        std::printf(" in %s input %s\n", source, Describe(text).c_str());
+        ++s_Failures;
+    }
+
+    bool SameResults(std::vector<CappedSearchResult> const& expected, std::vector<CappedSearchResult> const& actual) {
+        if(expected.size() != actual.size()) {
+            return false;
+        }
+        for(size_t i = 0; i < expected.size(); ++i) {
+            if(expected[i].ResultStart != actual[i].ResultStart
+                || expected[i].ResultSize != actual[i].ResultSize
+                || expected[i].ResultCenter.data() != actual[i].ResultCenter.data()
+                || expected[i].ResultCenter.size() != actual[i].ResultCenter.size()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool SameTokens(std::vector<Token> const& expected, std::vector<Token> const& actual) {
+        if(expected.size() != actual.size()) {
+            return false;
+        }
+        for(size_t i = 0; i < expected.size(); ++i) {
+            if(expected[i].TokenType != actual[i].TokenType
+                || expected[i].Text.data() != actual[i].Text.data()
+                || expected[i].Text.size() != actual[i].Text.size()
+                || expected[i].Center.data() != actual[i].Center.data()
+                || expected[i].Center.size() != actual[i].Center.size()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Checks the tokens of text against what the Reference backend's FindIndicatorsWithCaps finds.
+    void CheckTokensAgainstSearch(char const* source, std::string_view text, std::vector<Token> const& tokens) {
+        // Literals and statements follow each other without gaps, from the start of the text to its end, and literals
+        // never follow each other.
+        char const* next = text.data();
+        bool literal = false;
+        for(Token const& token : tokens) {
+            bool const isLiteral = token.TokenType == Token::Type::Literal;
+            if(token.Text.data() != next || token.Text.empty() || (isLiteral && literal)) {
+                Fail(source, text, "%s tokens don't cover the text", "reference");
+                return;
+            }
+            next += token.Text.size();
+            literal = isLiteral;
+        }
+        if(next != text.data() + text.size()) {
+            Fail(source, text, "%s tokens don't cover the text", "reference");
+            return;
+        }
+
+        // With a single kind of indicator in the text Tokenize has to find exactly what searching for it finds.
+        size_t present = 0;
+        size_t kind = 0;
+        for(size_t i = 0; i < std::size(k_AllIndicators); ++i) {
+            if(text.find(k_AllIndicators[i]) != std::string_view::npos) {
+                ++present;
+                kind = i;
+            }
+        }
+        if(present > 1) {
+            return;
+        }
+
+        std::vector<CappedSearchResult> const found = FindIndicatorsWithCaps(text, k_AllIndicators[kind], Indicators::k_Cap, ScannerBackend::Reference);
+        std::vector<CappedSearchResult> statements;
+        for(Token const& token : tokens) {
+            if(token.TokenType == Token::Type::Literal) {
+                continue;
+            }
+            if(token.TokenType != k_IndicatorTokenTypes[kind]) {
+                Fail(source, text, "%s tokenizing found a statement of a kind that isn't there", "reference");
+                return;
+            }
+            statements.push_back({ static_cast<size_t>(token.Text.data() - text.data()), token.Text.size(), token.Center });
+        }
+        if(!SameResults(found, statements)) {
+            Fail(source, text, "%s tokenizing disagrees with searching for the only indicator", "reference");
+        }
+    }
+
+    void CheckText(char const* source, std::string_view text) {
+        ++s_Inputs;
+
+        for(std::string_view indicator : k_AllIndicators) {
+            std::vector<CappedSearchResult> const expected = FindIndicatorsWithCaps(text, indicator, Indicators::k_Cap, ScannerBackend::Reference);
+            for(ScannerBackend backend : k_AllBackends) {
+                if(backend == ScannerBackend::Reference || !IsScannerBackendSupported(backend)) {
+                    continue;
+                }
+                if(!SameResults(expected, FindIndicatorsWithCaps(text, indicator, Indicators::k_Cap, backend))) {
+                    std::string const what = std::string(GetScannerBackendName(backend)) + " scanning for \"" + std::string(indicator) + "\"";
+                    Fail(source, text, "%s disagrees with reference", what.c_str());
+                }
+            }
+        }
+
+        std::vector<Token> const expected = Tokenize(text, ScannerBackend::Reference);
+        CheckTokensAgainstSearch(source, text, expected);
+        for(ScannerBackend backend : k_AllBackends) {
+            if(backend == ScannerBackend::Reference || !IsScannerBackendSupported(backend)) {
+                continue;
+            }
+            if(!SameTokens(expected, Tokenize(text, backend))) {
+                Fail(source, text, "%s tokenizing disagrees with reference", GetScannerBackendName(backend));
+            }
+        }
+    }
+
+    // Memory that ends where a page ends, followed by a page that can't be read. Anything placed at the end of it
+    // crashes a scanner that reads past the end of its text.
+    class GuardedBuffer
+    {
+    public:
+        explicit GuardedBuffer(size_t capacity) {
+#if defined(__linux__) || defined(__APPLE__)
+            size_t const pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+            m_Size = (capacity + pageSize - 1) / pageSize * pageSize;
+            m_MappedSize = m_Size + pageSize;
+            void* const memory = mmap(nullptr, m_MappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if(memory == MAP_FAILED || mprotect(static_cast<char*>(memory) + m_Size, pageSize, PROT_NONE) != 0) {
+                std::printf("Couldn't map a guarded buffer.\n");
+                std::exit(1);
+            }
+            m_Data = static_cast<char*>(memory);
+#else
+            // No guard page, inputs are still scanned at the end of an allocation.
+            m_Size = capacity;
+            m_Fallback = std::unique_ptr<char[]>(new char[capacity]);
+            m_Data = m_Fallback.get();
+#endif
+        }
+
+        ~GuardedBuffer() {
+#if defined(__linux__) || defined(__APPLE__)
+            munmap(m_Data, m_MappedSize);
+#endif
+        }
+
+        GuardedBuffer(GuardedBuffer const&)            = delete;
+        GuardedBuffer& operator=(GuardedBuffer const&) = delete;
+
+        // Copies text so it ends at the guard page.
+        std::string_view PlaceAtEnd(std::string_view text) {
+            char* const start = m_Data + m_Size - text.size();
+            std::memcpy(start, text.data(), text.size());
+            return std::string_view(start, text.size());
+        }
+
+    private:
+        char* m_Data = nullptr;
+        size_t m_Size = 0;
+        size_t m_MappedSize = 0;
+        std::unique_ptr<char[]> m_Fallback;
+    };
+
+    GuardedBuffer& GetGuardedBuffer() {
+        static GuardedBuffer s_Buffer(k_LongRandomLength + k_MaxBlockSize * 4);
+        return s_Buffer;
+    }
+
+    // Checks text where it is and again at the end of a page.
+    void Check(char const* source, std::string const& text) {
+        CheckText(source, text);
+        CheckText(source, GetGuardedBuffer().PlaceAtEnd(text));
+    }
+
+    void CheckEdgeCases() {
+        for(std::string_view text : k_EdgeCases) {
+            Check("edge case", std::string(text));
+        }
+    }
+
+    // Every partial indicator, followed by what might break it or start another.
+    void CheckNearMisses() {
+        constexpr std::string_view k_Breakers[] = { "", "{", "}", "$", "x", "{$", "{include:", "{variable:", "\n" };
+        for(std::string_view indicator : k_AllIndicators) {
+            for(size_t length = 1; length <= indicator.size(); ++length) {
+                std::string_view const partial = indicator.substr(0, length);
+                for(std::string_view breaker : k_Breakers) {
+                    for(std::string_view after : k_AllIndicators) {
+                        std::string const text = std::string(partial) + std::string(breaker) + std::string(after) + "name}";
+                        Check("near miss", text);
+                        // The same again, with the end of the statement missing.
+                        Check("near miss", text.substr(0, text.size() - 1));
+                        Check("near miss", std::string(partial));
+                        Check("near miss", "{" + text);
+                    }
+                }
+            }
+        }
+    }
+
+    // Indicators and caps at every offset around the blocks the vector backends scan, with different filler before
+    // them (a brace in the filler is a candidate the scanner has to reject first).
+    void CheckBlockEdges() {
+        constexpr char k_Fillers[] = { 'x', '{', '$', '}' };
+        constexpr size_t k_CenterLengths[] = { 0, 1, 14, 15, 16, 17, 31, 32, 33 };
+        for(std::string_view indicator : k_AllIndicators) {
+            for(char filler : k_Fillers) {
+                for(size_t lead = 0; lead <= k_MaxBlockSize * 2 + 1; ++lead) {
+                    for(size_t centerLength : k_CenterLengths) {
+                        std::string text(lead, filler);
+                        text += indicator;
+                        text.append(centerLength, 'n');
+                        for(size_t tail = 0; tail <= 2; ++tail) {
+                            Check("block edge", text + "}" + std::string(tail, 'x'));
+                        }
+                        // Never closed.
+                        Check("block edge", text);
+                    }
+                }
+            }
+        }
+    }
+
+    // Builds text out of pieces that are likely to confuse a scanner: indicators, partial indicators and braces.
+    std::string MakeRandomText(std::mt19937& random, size_t length, bool singleKind) {
+        std::vector<std::string_view> pieces = { "{", "}", "$", "x", "name", " ", "\n", "=", ":" };
+        if(singleKind) {
+            std::string_view const indicator = k_AllIndicators[random() % std::size(k_AllIndicators)];
+            for(size_t prefix = 1; prefix <= indicator.size(); ++prefix) {
+                pieces.push_back(indicator.substr(0, prefix));
+            }
+        } else {
+            for(std::string_view indicator : k_AllIndicators) {
+                pieces.push_back(indicator);
+                pieces.push_back(indicator.substr(0, 1 + random() % indicator.size()));
+            }
+        }
+
+        std::string text;
+        while(text.size() < length) {
+            text += pieces[random() % pieces.size()];
+        }
+        text.resize(length);
+        return text;
+    }
+
+    void CheckRandom(uint32_t seed) {
+        std::mt19937 random(seed);
+        for(int i = 0; i < k_RandomInputCount; ++i) {
+            Check("random", MakeRandomText(random, random() % (k_MaxRandomLength + 1), (i & 1) != 0));
+        }
+        for(int i = 0; i < k_LongRandomInputCount; ++i) {
+            Check("long random", MakeRandomText(random, k_LongRandomLength - random() % k_MaxBlockSize, (i & 1) != 0));
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    uint32_t seed = k_DefaultSeed;
+    if(argc > 1) {
+        seed = static_cast<uint32_t>(std::strtoul(argv[1], nullptr, 0));
+    }
+
+    std::printf("Checking scanner backends against reference:");
+    for(ScannerBackend backend : k_AllBackends) {
+        if(backend != ScannerBackend::Reference && IsScannerBackendSupported(backend)) {
+            std::printf(" %s", GetScannerBackendName(backend));
+        }
+    }
+    std::printf(" (seed 0x%X)\n", static_cast<unsigned int>(seed));
+    // A scanner reading past the end of its text crashes, make sure the seed gets out first.
+    std::fflush(stdout);
+
+    CheckEdgeCases();
+    CheckNearMisses();
+    CheckBlockEdges();
+    CheckRandom(seed);
+
+    if(s_Failures != 0) {
+        std::printf("%d checks failed over %zu inputs.\n", s_Failures, s_Inputs);
+        return 1;
+    }
+    std::printf("All %zu inputs match.\n", s_Inputs);
+    return 0;
+}